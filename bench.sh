@@ -0,0 +1,41 @@
+#!/bin/sh
+# Benchmarks uifont_opsz over generated fonts along each dimension production fonts vary in:
+# axis count, glyph count, variation region count, and thread count. The static font, with no
+# axes, runs the paths that hand back the original font instead of making an instance.
+#
+#   ./bench.sh [threads] [seconds]
+#
+# threads is a comma separated list (default 1,2,4,8,16,32,64); seconds is per measurement.
+
+set -e
+threads=${1:-1,2,4,8,16,32,64}
+seconds=${2:-0.5}
+dir=bench_fonts
+mkdir -p $dir
+
+fonts=""
+generate() {
+    name=$1
+    shift
+    ./make_varfont "$@" $dir/$name.ttf > /dev/null
+    fonts="$fonts --font $dir/$name.ttf"
+}
+
+generate static --static --glyphs 1000
+# Up to uifont_opsz's kMaxFontAxes (64); it skips fonts with more, whose extra axes it doesn't vary.
+for axes in 1 2 4 8 16; do
+    generate axes$axes --axes $axes --glyphs 1000
+done
+for glyphs in 100 1000 10000 65535; do
+    generate glyphs$glyphs --glyphs $glyphs
+done
+for regions in 1 10 100 1000; do
+    generate regions$regions --axes 4 --glyphs 1000 --regions $regions --gvar-density 0.2
+done
+
+# The sweep and --check compare a request's variation with the original's, which a static font
+# doesn't have; run them once on it so that path doesn't go untried.
+./uifont_opsz --font $dir/static.ttf > /dev/null
+./uifont_opsz --font $dir/static.ttf --check 100 > /dev/null
+
+./uifont_opsz $fonts --bench --threads $threads --seconds $seconds
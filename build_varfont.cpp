@@ -0,0 +1,1684 @@
+// Compile with
+// c++ -O2 -std=c++17 build_varfont.cpp -o build_varfont -pthread
+
+// Builds a variable TrueType font from static masters described by a designspace file, the way
+// fontTools' varLib does, so the fonts the tests run against can be built from masters here.
+//
+//   build_varfont [-j N] [--no-iup] [--no-optimize] [--order tag,...] font.designspace out.ttf
+//
+// The default master's tables are copied over, and fvar, avar (when an axis has a map), gvar,
+// HVAR, MVAR and STAT are added, with names for the axes and instances added to its name table.
+// Deltas are worked out per glyph on N threads (default: one per core). Point deltas that
+// interpolating the rest would reproduce to within half a unit (IUP, as the rasterizer does for
+// points a tuple leaves out) are dropped. HVAR's and MVAR's ItemVariationStores are optimized
+// for size unless --no-optimize. Tables are laid out by tag, or with those --order lists first
+// (--order recommended: the OpenType spec's order).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "sfnt.h"
+#include "sfnt_writer.h"
+
+// The font tables' rounding, which std::lround isn't for halves below 0.
+int32_t ot_round(double value) {
+    return static_cast<int32_t>(std::floor(value + 0.5));
+}
+
+bool read_file(const std::string& path, std::vector<uint8_t>* data) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    uint8_t buffer[65536];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data->insert(data->end(), buffer, buffer + read);
+    }
+    fclose(file);
+    return true;
+}
+
+// The designspace: axes in user units with an optional map to design units, masters at design
+// locations, and named instances.
+
+struct DesignAxis {
+    std::string name;
+    uint32_t tag = 0;
+    double minimum = 0, def = 0, maximum = 0;       // user units
+    std::vector<std::pair<double, double>> map;     // user to design, by input
+};
+
+struct Master {
+    std::string path;
+    std::vector<double> location;                   // design units, per axis
+    std::vector<uint8_t> data;
+    Reader font;
+    GlyfTables glyf;
+};
+
+struct Instance {
+    std::string name;
+    std::vector<double> location;                   // design units, per axis
+};
+
+struct Designspace {
+    std::vector<DesignAxis> axes;
+    std::vector<Master> masters;
+    std::vector<Instance> instances;
+};
+
+// Piecewise linear through the map's pairs, clamped at the ends. inverse maps design to user.
+double map_value(const DesignAxis& axis, double value, bool inverse = false) {
+    std::vector<std::pair<double, double>> map = axis.map;
+    if (inverse) {
+        for (auto& pair : map) {
+            std::swap(pair.first, pair.second);
+        }
+        std::sort(map.begin(), map.end());
+    }
+    if (map.empty()) {
+        return value;
+    }
+    if (value <= map.front().first) {
+        return map.front().second;
+    }
+    for (size_t i = 1; i < map.size(); ++i) {
+        if (value <= map[i].first) {
+            const auto& [x0, y0] = map[i - 1];
+            const auto& [x1, y1] = map[i];
+            return x1 == x0 ? y1 : y0 + (value - x0) * (y1 - y0) / (x1 - x0);
+        }
+    }
+    return map.back().second;
+}
+
+// -1, 0 and 1 at the minimum, default and maximum, linear between and clamped outside.
+double normalize(double value, double minimum, double def, double maximum) {
+    value = std::clamp(value, minimum, maximum);
+    if (value < def) {
+        return (value - def) / (def - minimum);
+    }
+    if (value > def) {
+        return (value - def) / (maximum - def);
+    }
+    return 0;
+}
+
+// Where a design location lands in normalized coordinates, before avar. Design units are what
+// avar maps to, so this is the normalization after it.
+double normalize_design(const DesignAxis& axis, double value) {
+    return normalize(value, map_value(axis, axis.minimum), map_value(axis, axis.def), map_value(axis, axis.maximum));
+}
+
+// Just enough XML for designspace files: elements and their attributes, with the usual entities.
+struct XmlTag {
+    std::string name;   // "/name" for a closing tag
+    std::map<std::string, std::string> attributes;
+    bool empty = false; // <name ... />
+};
+
+std::string xml_unescape(const std::string& text) {
+    std::string out;
+    for (size_t i = 0; i < text.size(); ++i) {
+        size_t semicolon = text.find(';', i);
+        if (text[i] != '&' || semicolon == std::string::npos) {
+            out += text[i];
+            continue;
+        }
+        std::string entity = text.substr(i + 1, semicolon - i - 1);
+        uint32_t c = entity == "amp" ? '&' : entity == "lt" ? '<' : entity == "gt" ? '>' : entity == "quot" ? '"' : entity == "apos" ? '\'' : 0;
+        if (entity.size() > 1 && entity[0] == '#') {
+            c = entity[1] == 'x' ? strtoul(entity.c_str() + 2, nullptr, 16) : strtoul(entity.c_str() + 1, nullptr, 10);
+        }
+        if (!c) {
+            out += text[i];
+            continue;
+        }
+        // As UTF-8.
+        if (c < 0x80) {
+            out += char(c);
+        } else if (c < 0x800) {
+            out += char(0xC0 | c >> 6);
+            out += char(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            out += char(0xE0 | c >> 12);
+            out += char(0x80 | (c >> 6 & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        } else {
+            out += char(0xF0 | c >> 18);
+            out += char(0x80 | (c >> 12 & 0x3F));
+            out += char(0x80 | (c >> 6 & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        }
+        i = semicolon;
+    }
+    return out;
+}
+
+std::vector<XmlTag> xml_tags(const std::string& text) {
+    std::vector<XmlTag> tags;
+    size_t i = 0;
+    while ((i = text.find('<', i)) != std::string::npos) {
+        if (text.compare(i, 4, "<!--") == 0) {
+            size_t end = text.find("-->", i);
+            i = end == std::string::npos ? text.size() : end + 3;
+            continue;
+        }
+        size_t end = text.find('>', i);
+        if (end == std::string::npos) {
+            break;
+        }
+        if (text[i + 1] == '?' || text[i + 1] == '!') {
+            i = end + 1;
+            continue;
+        }
+        XmlTag tag;
+        bool closing = text[i + 1] == '/';
+        size_t p = closing ? i + 2 : i + 1;
+        auto skip_space = [&] {
+            while (p < end && isspace(static_cast<unsigned char>(text[p]))) {
+                ++p;
+            }
+        };
+        while (p < end && !isspace(static_cast<unsigned char>(text[p])) && text[p] != '/') {
+            tag.name += text[p++];
+        }
+        if (closing) {
+            tag.name = "/" + tag.name;
+            p = end;
+        }
+        for (;;) {
+            skip_space();
+            if (p >= end || text[p] == '/') {
+                tag.empty = p < end;
+                break;
+            }
+            size_t equals = text.find('=', p);
+            if (equals == std::string::npos || equals >= end) {
+                break;
+            }
+            std::string key = text.substr(p, equals - p);
+            key.erase(key.find_last_not_of(" \t\r\n") + 1);
+            p = equals + 1;
+            skip_space();
+            char quote = text[p];
+            size_t close = text.find(quote, p + 1);
+            if ((quote != '"' && quote != '\'') || close == std::string::npos) {
+                break;
+            }
+            // A quoted '>' would have ended the tag early; look for the real end past it.
+            if (close > end) {
+                end = text.find('>', close);
+                if (end == std::string::npos) {
+                    end = text.size();
+                }
+            }
+            tag.attributes[key] = xml_unescape(text.substr(p + 1, close - p - 1));
+            p = close + 1;
+        }
+        tags.push_back(tag);
+        i = end + 1;
+    }
+    return tags;
+}
+
+double attribute(const XmlTag& tag, const char* name, double fallback) {
+    auto found = tag.attributes.find(name);
+    return found == tag.attributes.end() ? fallback : atof(found->second.c_str());
+}
+
+// The order the OpenType spec recommends for a TrueType font's tables, for loading them front to
+// back; --order recommended lays them out this way, with the tables it doesn't list after them.
+const std::vector<uint32_t> kRecommendedTableOrder = {
+    sfnt_tag('h', 'e', 'a', 'd'), sfnt_tag('h', 'h', 'e', 'a'), sfnt_tag('m', 'a', 'x', 'p'), sfnt_tag('O', 'S', '/', '2'),
+    sfnt_tag('h', 'm', 't', 'x'), sfnt_tag('L', 'T', 'S', 'H'), sfnt_tag('V', 'D', 'M', 'X'), sfnt_tag('h', 'd', 'm', 'x'),
+    sfnt_tag('c', 'm', 'a', 'p'), sfnt_tag('f', 'p', 'g', 'm'), sfnt_tag('p', 'r', 'e', 'p'), sfnt_tag('c', 'v', 't', ' '),
+    sfnt_tag('l', 'o', 'c', 'a'), sfnt_tag('g', 'l', 'y', 'f'), sfnt_tag('k', 'e', 'r', 'n'), sfnt_tag('n', 'a', 'm', 'e'),
+    sfnt_tag('p', 'o', 's', 't'), sfnt_tag('g', 'a', 's', 'p'), sfnt_tag('P', 'C', 'L', 'T'), sfnt_tag('D', 'S', 'I', 'G'),
+};
+
+uint32_t tag_from_string(const std::string& string) {
+    char buffer[4] = { ' ', ' ', ' ', ' ' };
+    memcpy(buffer, string.data(), std::min<size_t>(string.size(), 4));
+    return sfnt_tag(buffer[0], buffer[1], buffer[2], buffer[3]);
+}
+
+// Reads the axes, sources and instances; masters' fonts are loaded later. Locations leave out
+// axes at their default.
+bool parse_designspace(const char* path, Designspace* designspace) {
+    std::vector<uint8_t> data;
+    if (!read_file(path, &data)) {
+        printf("Could not open: %s\n", path);
+        return false;
+    }
+    std::string directory = path;
+    directory = directory.find('/') == std::string::npos ? "" : directory.substr(0, directory.rfind('/') + 1);
+
+    std::vector<std::string> open;  // the elements the current tag is inside
+    std::vector<double>* location = nullptr;
+    for (const XmlTag& tag : xml_tags(std::string(data.begin(), data.end()))) {
+        if (tag.name[0] == '/') {
+            if (!open.empty()) {
+                open.pop_back();
+            }
+            if (tag.name == "/source" || tag.name == "/instance") {
+                location = nullptr;
+            }
+            continue;
+        }
+        std::string parent = open.empty() ? "" : open.back();
+        if (tag.name == "axis" && parent == "axes") {
+            DesignAxis axis;
+            axis.name = tag.attributes.count("name") ? tag.attributes.at("name") : "";
+            axis.tag = tag_from_string(tag.attributes.count("tag") ? tag.attributes.at("tag") : axis.name);
+            axis.minimum = attribute(tag, "minimum", 0);
+            axis.def = attribute(tag, "default", 0);
+            axis.maximum = attribute(tag, "maximum", 0);
+            designspace->axes.push_back(axis);
+        } else if (tag.name == "map" && parent == "axis" && !designspace->axes.empty()) {
+            auto& map = designspace->axes.back().map;
+            map.push_back({ attribute(tag, "input", 0), attribute(tag, "output", 0) });
+            std::sort(map.begin(), map.end());
+        } else if (tag.name == "source" && parent == "sources") {
+            Master master;
+            master.path = directory + (tag.attributes.count("filename") ? tag.attributes.at("filename") : "");
+            designspace->masters.push_back(master);
+            location = &designspace->masters.back().location;
+        } else if (tag.name == "instance" && parent == "instances") {
+            Instance instance;
+            instance.name = tag.attributes.count("stylename") ? tag.attributes.at("stylename")
+                            : tag.attributes.count("name") ? tag.attributes.at("name") : "";
+            designspace->instances.push_back(instance);
+            location = &designspace->instances.back().location;
+        } else if (tag.name == "dimension" && parent == "location" && location) {
+            std::string name = tag.attributes.count("name") ? tag.attributes.at("name") : "";
+            auto axis = std::find_if(designspace->axes.begin(), designspace->axes.end(), [&](const DesignAxis& a) { return a.name == name; });
+            if (axis == designspace->axes.end()) {
+                printf("%s: unknown axis %s\n", path, name.c_str());
+                return false;
+            }
+            size_t index = axis - designspace->axes.begin();
+            if (location->empty()) {
+                for (const DesignAxis& a : designspace->axes) {
+                    location->push_back(map_value(a, a.def));
+                }
+            }
+            (*location)[index] = tag.attributes.count("xvalue") ? attribute(tag, "xvalue", 0) : map_value(*axis, attribute(tag, "uservalue", 0));
+        }
+        if (!tag.empty) {
+            open.push_back(tag.name);
+        }
+    }
+
+    for (Master& master : designspace->masters) {
+        if (master.location.empty()) {
+            for (const DesignAxis& a : designspace->axes) {
+                master.location.push_back(map_value(a, a.def));
+            }
+        }
+    }
+    for (Instance& instance : designspace->instances) {
+        if (instance.location.empty()) {
+            for (const DesignAxis& a : designspace->axes) {
+                instance.location.push_back(map_value(a, a.def));
+            }
+        }
+    }
+    if (designspace->axes.empty() || designspace->masters.empty()) {
+        printf("%s: no axes or no sources\n", path);
+        return false;
+    }
+    for (const DesignAxis& axis : designspace->axes) {
+        if (!(axis.minimum <= axis.def && axis.def <= axis.maximum) || axis.minimum == axis.maximum) {
+            printf("%s: axis %s has a bad range\n", path, axis.name.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// A variation region, in normalized coordinates, per axis.
+struct Region {
+    std::vector<double> start, peak, end;
+};
+
+// How master values become deltas, as fontTools' VariationModel does it, so fonts built here and
+// there agree. Masters are put in order from the default out, each gets a region whose peak is
+// its location, cut back so it doesn't reach past the masters before it, and each master's delta
+// is its value less what the regions before it already add up to there.
+struct VariationModel {
+    std::vector<size_t> order;                                  // master indices, default first
+    std::vector<Region> supports;                               // per position in order
+    std::vector<std::vector<std::pair<size_t, double>>> weights; // per position: (earlier position, scalar)
+
+    // Deltas per position in order, rounded, from one value per master.
+    template <typename Value>
+    void deltas(Value masterValue, double* out) const {
+        for (size_t i = 0; i < order.size(); ++i) {
+            double delta = masterValue(order[i]);
+            for (const auto& [j, weight] : weights[i]) {
+                delta -= out[j] * weight;
+            }
+            out[i] = ot_round(delta);
+        }
+    }
+};
+
+bool build_model(const std::vector<std::vector<double>>& locations, VariationModel* model) {
+    size_t axisCount = locations[0].size();
+    auto base = std::find(locations.begin(), locations.end(), std::vector<double>(axisCount));
+    if (base == locations.end()) {
+        printf("No master at the default location\n");
+        return false;
+    }
+    for (size_t i = 0; i < locations.size(); ++i) {
+        if (std::count(locations.begin(), locations.end(), locations[i]) > 1) {
+            printf("Masters %zu and %zu are at the same location\n", i,
+                   size_t(std::find(locations.begin() + i + 1, locations.end(), locations[i]) - locations.begin()));
+            return false;
+        }
+    }
+
+    // The values masters on just one axis put on it. A master on several axes that's at one of
+    // those values on an axis is on a point there, and comes before masters that aren't.
+    std::vector<std::vector<double>> axisPoints(axisCount, std::vector<double>{ 0 });
+    for (const std::vector<double>& location : locations) {
+        if (std::count(location.begin(), location.end(), 0.0) == ptrdiff_t(axisCount) - 1) {
+            for (size_t axis = 0; axis < axisCount; ++axis) {
+                if (location[axis]) {
+                    axisPoints[axis].push_back(location[axis]);
+                }
+            }
+        }
+    }
+    auto key = [&](const std::vector<double>& location) {
+        std::vector<size_t> axes;
+        std::vector<int> signs;
+        std::vector<double> magnitudes;
+        int onPoint = 0;
+        for (size_t axis = 0; axis < axisCount; ++axis) {
+            double v = location[axis];
+            if (v) {
+                axes.push_back(axis);
+                signs.push_back(v < 0 ? -1 : 1);
+                magnitudes.push_back(std::abs(v));
+                onPoint += std::count(axisPoints[axis].begin(), axisPoints[axis].end(), v) > 0;
+            }
+        }
+        return std::make_tuple(axes.size(), -onPoint, axes, signs, magnitudes);
+    };
+    model->order.resize(locations.size());
+    for (size_t i = 0; i < locations.size(); ++i) {
+        model->order[i] = i;
+    }
+    std::stable_sort(model->order.begin(), model->order.end(), [&](size_t a, size_t b) { return key(locations[a]) < key(locations[b]); });
+
+    // Each master's region starts out reaching from 0 to the furthest master on each of its axes.
+    std::vector<double> minimum(axisCount), maximum(axisCount);
+    for (const std::vector<double>& location : locations) {
+        for (size_t axis = 0; axis < axisCount; ++axis) {
+            minimum[axis] = std::min(minimum[axis], location[axis]);
+            maximum[axis] = std::max(maximum[axis], location[axis]);
+        }
+    }
+    for (size_t i = 0; i < model->order.size(); ++i) {
+        const std::vector<double>& location = locations[model->order[i]];
+        Region region = { std::vector<double>(axisCount), location, std::vector<double>(axisCount) };
+        for (size_t axis = 0; axis < axisCount; ++axis) {
+            if (location[axis] > 0) {
+                region.end[axis] = maximum[axis];
+            } else if (location[axis] < 0) {
+                region.start[axis] = minimum[axis];
+            }
+        }
+        // Then masters before it on the same axes and inside its box cut it: on whichever axes
+        // cutting leaves the largest fraction of it, all of them when there's a tie.
+        for (size_t j = 0; j < i; ++j) {
+            const std::vector<double>& previous = locations[model->order[j]];
+            bool relevant = true;
+            for (size_t axis = 0; axis < axisCount && relevant; ++axis) {
+                relevant = (previous[axis] != 0) == (location[axis] != 0);
+                if (location[axis] && relevant) {
+                    relevant = previous[axis] == location[axis] ||
+                               (region.start[axis] < previous[axis] && previous[axis] < region.end[axis]);
+                }
+            }
+            if (!relevant) {
+                continue;
+            }
+            double bestRatio = -1;
+            std::vector<std::tuple<size_t, double, double>> best; // axis, start, end
+            for (size_t axis = 0; axis < axisCount; ++axis) {
+                double value = previous[axis], peak = location[axis];
+                if (!peak || value == peak) {
+                    continue;
+                }
+                double start = region.start[axis], end = region.end[axis], ratio;
+                if (value < peak) {
+                    ratio = (value - peak) / (start - peak);
+                    start = value;
+                } else {
+                    ratio = (value - peak) / (end - peak);
+                    end = value;
+                }
+                if (ratio > bestRatio) {
+                    best.clear();
+                    bestRatio = ratio;
+                }
+                if (ratio == bestRatio) {
+                    best.push_back({ axis, start, end });
+                }
+            }
+            for (const auto& [axis, start, end] : best) {
+                region.start[axis] = start;
+                region.end[axis] = end;
+            }
+        }
+        model->supports.push_back(region);
+    }
+
+    for (size_t i = 0; i < model->order.size(); ++i) {
+        const std::vector<double>& location = locations[model->order[i]];
+        model->weights.emplace_back();
+        for (size_t j = 0; j < i; ++j) {
+            const Region& support = model->supports[j];
+            double scalar = 1;
+            for (size_t axis = 0; axis < axisCount && scalar; ++axis) {
+                scalar *= axis_scalar(support.start[axis], support.peak[axis], support.end[axis], location[axis]);
+            }
+            if (scalar) {
+                model->weights[i].push_back({ j, scalar });
+            }
+        }
+    }
+    return true;
+}
+
+// IUP: the deltas of a tuple's points that interpolating from the others reproduces, to within a
+// tolerance, can be left out. Per contour, the points that can't be are forced; the fewest points
+// to keep is then a shortest path over the contour, each step skipping points that interpolate
+// between its ends. This follows fontTools' iup_contour_optimize.
+
+struct Vec {
+    int32_t x, y;
+    bool operator==(const Vec& other) const { return x == other.x && y == other.y; }
+};
+
+constexpr double kIupTolerance = 0.5;
+constexpr int kIupLookback = 8;
+
+// Whether the deltas of the points strictly between i and j are within tolerance of interpolating
+// theirs. Indices are into deltas and coordinates as a ring, so i can be -1.
+bool can_iup_between(const std::vector<Vec>& deltas, const std::vector<Vec>& coordinates, int i, int j, double tolerance) {
+    int n = deltas.size();
+    const Vec& c1 = coordinates[(i + n) % n];
+    const Vec& d1 = deltas[(i + n) % n];
+    const Vec& c2 = coordinates[j];
+    const Vec& d2 = deltas[j];
+    for (int k = i + 1; k < j; ++k) {
+        double interpolated[2];
+        for (int axis = 0; axis < 2; ++axis) {
+            double x1 = axis ? c1.y : c1.x, x2 = axis ? c2.y : c2.x;
+            double delta1 = axis ? d1.y : d1.x, delta2 = axis ? d2.y : d2.x;
+            double x = axis ? coordinates[k].y : coordinates[k].x;
+            if (x1 == x2) {
+                interpolated[axis] = delta1 == delta2 ? delta1 : 0;
+                continue;
+            }
+            if (x1 > x2) {
+                std::swap(x1, x2);
+                std::swap(delta1, delta2);
+            }
+            interpolated[axis] = x <= x1 ? delta1 : x >= x2 ? delta2 : delta1 + (x - x1) * (delta2 - delta1) / (x2 - x1);
+        }
+        if (std::hypot(deltas[k].x - interpolated[0], deltas[k].y - interpolated[1]) > tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Points that interpolating between their neighbors can't get right whatever else is kept.
+std::vector<bool> iup_forced(const std::vector<Vec>& deltas, const std::vector<Vec>& coordinates, double tolerance) {
+    int n = deltas.size();
+    std::vector<bool> forced(n);
+    for (int i = n - 1; i >= 0; --i) {
+        int last = (i + n - 1) % n, next = (i + 1) % n;
+        for (int axis = 0; axis < 2 && !forced[i]; ++axis) {
+            auto get = [axis](const Vec& v) { return double(axis ? v.y : v.x); };
+            double c = get(coordinates[i]), d = get(deltas[i]);
+            double c1 = get(coordinates[last]), c2 = get(coordinates[next]);
+            double d1 = get(deltas[last]), d2 = get(deltas[next]);
+            if (c1 > c2) {
+                std::swap(c1, c2);
+                std::swap(d1, d2);
+            }
+            if (c1 == c2) {
+                forced[i] = std::abs(d1 - d2) > tolerance && std::abs(d) > tolerance;
+            } else if (c1 <= c && c <= c2) {
+                forced[i] = !(std::min(d1, d2) - tolerance <= d && d <= tolerance + std::max(d1, d2));
+            } else if (d1 != d2) {
+                if (c < c1) {
+                    forced[i] = std::abs(d) > tolerance && std::abs(d - d1) > tolerance && ((d - tolerance < d1) != (d1 < d2));
+                } else {
+                    forced[i] = std::abs(d) > tolerance && std::abs(d - d2) > tolerance && ((d2 < d + tolerance) != (d1 < d2));
+                }
+            }
+        }
+    }
+    return forced;
+}
+
+// The shortest chain through points 0..n-1 of deltas, ending at each point: chain[i + 1] is the
+// point before i, and cost[i + 1] the points kept up to i. Index 0 stands for point -1.
+void iup_chain(const std::vector<Vec>& deltas, const std::vector<Vec>& coordinates, const std::vector<bool>& forced,
+               double tolerance, std::vector<int>* chain, std::vector<int>* cost) {
+    int n = deltas.size();
+    int lookback = std::min(n, kIupLookback);
+    auto is_forced = [&](int i) { return i >= 0 && i < int(forced.size()) && forced[i]; };
+    chain->assign(n + 1, -2);
+    cost->assign(n + 1, 0);
+    for (int i = 0; i < n; ++i) {
+        int best = (*cost)[i] + 1;
+        (*cost)[i + 1] = best;
+        (*chain)[i + 1] = i - 1;
+        if (is_forced(i - 1)) {
+            continue;
+        }
+        for (int j = i - 2; j > std::max(i - lookback, -2); --j) {
+            int c = (*cost)[j + 1] + 1;
+            if (c < best && can_iup_between(deltas, coordinates, j, i, tolerance)) {
+                (*cost)[i + 1] = best = c;
+                (*chain)[i + 1] = j;
+            }
+            if (is_forced(j)) {
+                break;
+            }
+        }
+    }
+}
+
+// Which points of a contour to keep deltas for.
+std::vector<bool> iup_contour(const std::vector<Vec>& deltas, const std::vector<Vec>& coordinates, double tolerance) {
+    int n = deltas.size();
+    if (std::all_of(deltas.begin(), deltas.end(), [&](const Vec& d) { return std::hypot(d.x, d.y) <= tolerance; })) {
+        return std::vector<bool>(n);
+    }
+    if (n == 1) {
+        return { true };
+    }
+    std::vector<bool> keep(n);
+    if (std::all_of(deltas.begin(), deltas.end(), [&](const Vec& d) { return d == deltas[0]; })) {
+        keep[0] = true;
+        return keep;
+    }
+
+    std::vector<bool> forced = iup_forced(deltas, coordinates, tolerance);
+    std::vector<int> chain, cost;
+    int lastForced = -1;
+    for (int i = 0; i < n; ++i) {
+        if (forced[i]) {
+            lastForced = i;
+        }
+    }
+    if (lastForced >= 0) {
+        // Rotate the contour so that it ends on a forced point, which the chain then has to reach.
+        int k = n - 1 - lastForced;
+        std::vector<Vec> rotatedDeltas(n), rotatedCoordinates(n);
+        std::vector<bool> rotatedForced(n);
+        for (int i = 0; i < n; ++i) {
+            rotatedDeltas[(i + k) % n] = deltas[i];
+            rotatedCoordinates[(i + k) % n] = coordinates[i];
+            rotatedForced[(i + k) % n] = forced[i];
+        }
+        iup_chain(rotatedDeltas, rotatedCoordinates, rotatedForced, tolerance, &chain, &cost);
+        for (int i = n - 1; i >= 0; i = chain[i + 1]) {
+            keep[(i - k + n) % n] = true;
+        }
+        return keep;
+    }
+
+    // Nothing forced: solve for the contour twice over, and find the cheapest stretch of n points
+    // that closes on itself.
+    std::vector<Vec> twiceDeltas = deltas, twiceCoordinates = coordinates;
+    twiceDeltas.insert(twiceDeltas.end(), deltas.begin(), deltas.end());
+    twiceCoordinates.insert(twiceCoordinates.end(), coordinates.begin(), coordinates.end());
+    iup_chain(twiceDeltas, twiceCoordinates, forced, tolerance, &chain, &cost);
+    int bestCost = n + 1;
+    std::vector<bool> best(n, true);
+    for (int start = n - 1; start < 2 * n - 1; ++start) {
+        std::vector<bool> solution(n);
+        int i = start;
+        while (i > start - n) {
+            solution[i % n] = true;
+            i = chain[i + 1];
+        }
+        if (i == start - n && cost[start + 1] - cost[start - n + 1] <= bestCost) {
+            bestCost = cost[start + 1] - cost[start - n + 1];
+            best = solution;
+        }
+    }
+    return best;
+}
+
+// Packed point numbers: a count, then runs of increments as bytes or words. No points at all
+// means every point.
+void write_packed_points(Writer& w, const std::vector<uint16_t>& points) {
+    if (points.size() < 128) {
+        w.u8(points.size());
+    } else {
+        w.u8(0x80 | points.size() >> 8);
+        w.u8(points.size());
+    }
+    size_t i = 0;
+    uint16_t last = 0;
+    while (i < points.size()) {
+        bool words = points[i] - last > 255;
+        size_t run = 0;
+        uint16_t previous = last;
+        while (i + run < points.size() && run < 128 && (points[i + run] - previous > 255) == words) {
+            previous = points[i + run];
+            ++run;
+        }
+        w.u8((words ? 0x80 : 0) | (run - 1));
+        for (size_t j = i; j < i + run; ++j) {
+            if (words) {
+                w.u16(points[j] - last);
+            } else {
+                w.u8(points[j] - last);
+            }
+            last = points[j];
+        }
+        i += run;
+    }
+}
+
+// Packed point deltas: runs of up to 64 zeros, bytes or words, each ending where starting a new
+// one is smaller than going on, as fontTools packs them. A lone zero is a byte in a run of bytes,
+// and a lone byte value a word in a run of words.
+void write_packed_deltas(Writer& w, const std::vector<int16_t>& deltas) {
+    auto fits_byte = [&](size_t i) { return i < deltas.size() && deltas[i] >= -128 && deltas[i] <= 127; };
+    auto is_zero = [&](size_t i) { return i < deltas.size() && deltas[i] == 0; };
+    size_t i = 0;
+    while (i < deltas.size()) {
+        size_t end = i;
+        uint8_t kind;
+        if (is_zero(i)) {
+            while (end - i < 64 && is_zero(end)) {
+                ++end;
+            }
+            kind = 0x80;
+        } else if (fits_byte(i)) {
+            while (end - i < 64 && fits_byte(end) && !(is_zero(end) && is_zero(end + 1))) {
+                ++end;
+            }
+            kind = 0x00;
+        } else {
+            while (end - i < 64 && end < deltas.size() && !is_zero(end) && !(fits_byte(end) && fits_byte(end + 1))) {
+                ++end;
+            }
+            kind = 0x40;
+        }
+        w.u8(kind | (end - i - 1));
+        for (; i < end; ++i) {
+            if (kind == 0x40) {
+                w.i16(deltas[i]);
+            } else if (kind == 0x00) {
+                w.u8(static_cast<uint8_t>(static_cast<int8_t>(deltas[i])));
+            }
+        }
+    }
+}
+
+// A tuple's point numbers, when it lists them, and its deltas for those points or for all.
+std::vector<uint8_t> serialize_tuple(const std::vector<Vec>& deltas, const std::vector<uint16_t>* points) {
+    Writer w;
+    std::vector<int16_t> dx, dy;
+    if (points) {
+        write_packed_points(w, *points);
+        for (uint16_t point : *points) {
+            dx.push_back(deltas[point].x);
+            dy.push_back(deltas[point].y);
+        }
+    } else {
+        for (const Vec& delta : deltas) {
+            dx.push_back(delta.x);
+            dy.push_back(delta.y);
+        }
+    }
+    write_packed_deltas(w, dx);
+    write_packed_deltas(w, dy);
+    return w.data;
+}
+
+struct GlyphVariations {
+    std::vector<uint8_t> gvar;              // the glyph's GlyphVariationData, empty when it has none
+    std::vector<int16_t> advanceDeltas;     // per region, empty when the advance doesn't vary
+    size_t deltas = 0;                      // point deltas before and after IUP, over its tuples
+    size_t keptDeltas = 0;
+};
+
+struct Build {
+    Designspace designspace;
+    VariationModel model;
+    size_t base = 0;                        // the default master
+    uint16_t glyphCount = 0;
+    bool iup = true;
+    bool optimize = true;
+};
+
+// Masters have to agree on every glyph's structure for their deltas to mean anything.
+bool check_glyph(const Build& build, uint16_t glyphID, std::vector<GlyphOutline>* outlines) {
+    for (const Master& master : build.designspace.masters) {
+        outlines->push_back(glyph_outline(master.glyf, glyphID));
+    }
+    const GlyphOutline& base = (*outlines)[build.base];
+    for (size_t i = 0; i < outlines->size(); ++i) {
+        const GlyphOutline& outline = (*outlines)[i];
+        if (outline.x.size() != base.x.size() || outline.endPoints != base.endPoints || outline.components != base.components) {
+            printf("Glyph %u isn't compatible between %s and %s\n", glyphID, build.designspace.masters[build.base].path.c_str(),
+                   build.designspace.masters[i].path.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool build_glyph(const Build& build, uint16_t glyphID, GlyphVariations* variations) {
+    std::vector<GlyphOutline> outlines;
+    if (!check_glyph(build, glyphID, &outlines)) {
+        return false;
+    }
+    const VariationModel& model = build.model;
+    const GlyphOutline& base = outlines[build.base];
+    size_t pointCount = base.x.size(), regionCount = model.order.size() - 1;
+    bool composite = !base.components.empty();
+
+    // Deltas per point per region; position 0 of the model is the default master.
+    std::vector<std::vector<Vec>> deltas(regionCount, std::vector<Vec>(pointCount));
+    std::vector<double> out(model.order.size());
+    for (size_t point = 0; point < pointCount; ++point) {
+        model.deltas([&](size_t master) { return outlines[master].x[point]; }, out.data());
+        for (size_t region = 0; region < regionCount; ++region) {
+            deltas[region][point].x = out[region + 1];
+        }
+        model.deltas([&](size_t master) { return outlines[master].y[point]; }, out.data());
+        for (size_t region = 0; region < regionCount; ++region) {
+            deltas[region][point].y = out[region + 1];
+        }
+    }
+    model.deltas([&](size_t master) { return outlines[master].advance; }, out.data());
+    if (std::any_of(out.begin() + 1, out.end(), [](double d) { return d != 0; })) {
+        variations->advanceDeltas.assign(out.begin() + 1, out.end());
+    }
+
+    // Contours for IUP, the phantom points each on their own.
+    std::vector<Vec> coordinates(pointCount);
+    for (size_t point = 0; point < pointCount; ++point) {
+        coordinates[point] = { base.x[point], base.y[point] };
+    }
+    std::vector<uint16_t> ends = base.endPoints;
+    for (size_t point = pointCount - 4; point < pointCount; ++point) {
+        ends.push_back(point);
+    }
+
+    struct Tuple {
+        size_t region;
+        std::vector<uint8_t> data;
+        bool allPoints;                     // data has no point numbers and uses every point
+    };
+    std::vector<Tuple> tuples;
+    for (size_t region = 0; region < regionCount; ++region) {
+        const std::vector<Vec>& tuple = deltas[region];
+        if (std::all_of(tuple.begin(), tuple.end(), [](const Vec& d) { return !d.x && !d.y; })) {
+            continue;
+        }
+        // Composites don't interpolate points a tuple leaves out, which move by 0; simple glyphs
+        // interpolate them within each contour.
+        std::vector<uint16_t> points;
+        size_t start = 0;
+        for (uint16_t end : ends) {
+            std::vector<Vec> contourDeltas(tuple.begin() + start, tuple.begin() + end + 1);
+            std::vector<Vec> contourCoordinates(coordinates.begin() + start, coordinates.begin() + end + 1);
+            std::vector<bool> keep;
+            if (!build.iup) {
+                keep.assign(contourDeltas.size(), true);
+            } else if (composite) {
+                for (const Vec& d : contourDeltas) {
+                    keep.push_back(d.x || d.y);
+                }
+            } else {
+                keep = iup_contour(contourDeltas, contourCoordinates, kIupTolerance);
+            }
+            for (size_t i = 0; i < keep.size(); ++i) {
+                if (keep[i]) {
+                    points.push_back(start + i);
+                }
+            }
+            start = end + 1;
+        }
+        variations->deltas += pointCount;
+        if (points.empty()) {
+            continue;
+        }
+        // Listing the points only pays when it leaves out enough of them. Using all of them takes
+        // a byte for the point numbers, unless other tuples share it.
+        std::vector<uint8_t> all = serialize_tuple(tuple, nullptr);
+        std::vector<uint8_t> some = points.size() < pointCount ? serialize_tuple(tuple, &points) : std::vector<uint8_t>();
+        bool sparse = !some.empty() && some.size() < all.size() + 1;
+        variations->keptDeltas += sparse ? points.size() : pointCount;
+        tuples.push_back({ region, sparse ? some : all, !sparse });
+    }
+    if (tuples.empty()) {
+        return true;
+    }
+
+    // The "all points" numbers are shared when more than one tuple uses them.
+    bool shared = std::count_if(tuples.begin(), tuples.end(), [](const Tuple& tuple) { return tuple.allPoints; }) > 1;
+    Writer headers, data;
+    if (shared) {
+        data.u8(0);
+    }
+    for (const Tuple& tuple : tuples) {
+        bool privatePoints = !(tuple.allPoints && shared);
+        const Region& support = model.supports[tuple.region + 1];
+        bool intermediate = false;
+        for (size_t axis = 0; axis < support.peak.size(); ++axis) {
+            double peak = support.peak[axis];
+            intermediate |= support.start[axis] != std::min(peak, 0.0) || support.end[axis] != std::max(peak, 0.0);
+        }
+        headers.u16(tuple.data.size() + (privatePoints && tuple.allPoints));
+        headers.u16(tuple.region | (intermediate ? 0x4000 : 0) | (privatePoints ? 0x2000 : 0)); // PRIVATE_POINT_NUMBERS
+        if (intermediate) {
+            for (double start : support.start) {
+                headers.f2dot14(start);
+            }
+            for (double end : support.end) {
+                headers.f2dot14(end);
+            }
+        }
+        if (privatePoints && tuple.allPoints) {
+            data.u8(0);
+        }
+        data.bytes(tuple.data);
+    }
+    Writer w;
+    w.u16((shared ? 0x8000 : 0) | tuples.size()); // SHARED_POINT_NUMBERS
+    w.u16(4 + headers.size());              // dataOffset
+    w.bytes(headers.data);
+    w.bytes(data.data);
+    w.pad(2);
+    variations->gvar = std::move(w.data);
+    return true;
+}
+
+std::vector<uint8_t> build_gvar(const Build& build, const std::vector<GlyphVariations>& glyphs) {
+    size_t axisCount = build.designspace.axes.size();
+    Writer w;
+    w.u16(1); w.u16(0);
+    w.u16(axisCount);
+    w.u16(build.model.order.size() - 1);    // sharedTupleCount: a peak per region
+    size_t sharedTuplesOffset = w.size();
+    w.u32(0);
+    w.u16(glyphs.size());
+    w.u16(1);                               // flags: long offsets
+    size_t dataArrayOffset = w.size();
+    w.u32(0);
+    size_t offsetsStart = w.size();
+    for (size_t i = 0; i <= glyphs.size(); ++i) {
+        w.u32(0);
+    }
+    w.patch32(sharedTuplesOffset, w.size());
+    for (size_t region = 1; region < build.model.supports.size(); ++region) {
+        for (double peak : build.model.supports[region].peak) {
+            w.f2dot14(peak);
+        }
+    }
+    w.pad(4);
+    size_t dataStart = w.size();
+    w.patch32(dataArrayOffset, dataStart);
+    for (size_t glyphID = 0; glyphID < glyphs.size(); ++glyphID) {
+        w.patch32(offsetsStart + glyphID * 4, w.size() - dataStart);
+        w.bytes(glyphs[glyphID].gvar);
+    }
+    w.patch32(offsetsStart + glyphs.size() * 4, w.size() - dataStart);
+    return w.data;
+}
+
+// Where a row of deltas ended up in an ItemVariationStore.
+struct DeltaSetIndex {
+    uint16_t outer, inner;
+};
+
+// The bytes a subtable of count rows with these column widths (0 for a column it leaves out, 1 or
+// 2) takes, counting its offset in the store.
+size_t item_variation_data_cost(const std::vector<uint8_t>& widths, size_t count) {
+    size_t columns = 0, rowSize = 0;
+    for (uint8_t width : widths) {
+        columns += width != 0;
+        rowSize += width;
+    }
+    return 4 + 6 + columns * 2 + count * rowSize;
+}
+
+// Rows grouped into subtables. Unoptimized, every row goes in one subtable over every region, as
+// words. Optimized, the store only has the regions some row uses, identical rows are stored once,
+// and rows are grouped by which columns they need and how wide: each row starts in the group of
+// rows needing the same, and the two groups whose merging saves the most bytes are merged until
+// no merge saves any. This is fontTools' VarStore optimization.
+struct StoreLayout {
+    std::vector<uint16_t> regions;              // the regions kept, indices into the model's
+    std::vector<std::vector<int16_t>> rows;     // distinct rows, over the kept regions
+    std::vector<size_t> rowOf;                  // per row given, its index in rows
+    struct Group {
+        std::vector<uint8_t> widths;            // per kept region
+        std::vector<size_t> rows;
+    };
+    std::vector<Group> groups;
+};
+
+StoreLayout layout_store(size_t regionCount, const std::vector<std::vector<int16_t>>& rows, bool optimize) {
+    StoreLayout layout;
+    for (size_t region = 0; region < regionCount; ++region) {
+        bool used = !optimize || std::any_of(rows.begin(), rows.end(), [&](const std::vector<int16_t>& row) { return row[region]; });
+        if (used) {
+            layout.regions.push_back(region);
+        }
+    }
+    std::map<std::vector<int16_t>, size_t> distinct;
+    for (const std::vector<int16_t>& row : rows) {
+        std::vector<int16_t> kept;
+        for (uint16_t region : layout.regions) {
+            kept.push_back(row[region]);
+        }
+        auto [found, inserted] = distinct.insert({ kept, layout.rows.size() });
+        if (inserted || !optimize) {
+            layout.rowOf.push_back(layout.rows.size());
+            layout.rows.push_back(kept);
+        } else {
+            layout.rowOf.push_back(found->second);
+        }
+    }
+    if (!optimize) {
+        layout.groups.push_back({ std::vector<uint8_t>(layout.regions.size(), 2), {} });
+        for (size_t row = 0; row < layout.rows.size(); ++row) {
+            layout.groups[0].rows.push_back(row);
+        }
+        return layout;
+    }
+
+    std::map<std::vector<uint8_t>, size_t> byWidths;
+    for (size_t row = 0; row < layout.rows.size(); ++row) {
+        std::vector<uint8_t> widths;
+        for (int16_t delta : layout.rows[row]) {
+            widths.push_back(!delta ? 0 : delta >= -128 && delta <= 127 ? 1 : 2);
+        }
+        auto [found, inserted] = byWidths.insert({ widths, layout.groups.size() });
+        if (inserted) {
+            layout.groups.push_back({ widths, {} });
+        }
+        layout.groups[found->second].rows.push_back(row);
+    }
+
+    // Merging is greedy through a heap of the savings of every pair; pairs with a group that has
+    // since been merged away are skipped when they come up.
+    std::vector<StoreLayout::Group>& groups = layout.groups;
+    std::vector<bool> merged(groups.size());
+    auto merge_widths = [](const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+        std::vector<uint8_t> widths(a.size());
+        for (size_t i = 0; i < a.size(); ++i) {
+            widths[i] = std::max(a[i], b[i]);
+        }
+        return widths;
+    };
+    auto saving = [&](size_t a, size_t b) {
+        return ptrdiff_t(item_variation_data_cost(groups[a].widths, groups[a].rows.size()) +
+                         item_variation_data_cost(groups[b].widths, groups[b].rows.size())) -
+               ptrdiff_t(item_variation_data_cost(merge_widths(groups[a].widths, groups[b].widths),
+                                                  groups[a].rows.size() + groups[b].rows.size()));
+    };
+    std::vector<std::tuple<ptrdiff_t, size_t, size_t>> heap;
+    for (size_t a = 0; a < groups.size(); ++a) {
+        for (size_t b = a + 1; b < groups.size(); ++b) {
+            if (ptrdiff_t gain = saving(a, b); gain > 0) {
+                heap.push_back({ gain, a, b });
+            }
+        }
+    }
+    std::make_heap(heap.begin(), heap.end());
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end());
+        auto [gain, a, b] = heap.back();
+        heap.pop_back();
+        if (merged[a] || merged[b]) {
+            continue;
+        }
+        StoreLayout::Group group = { merge_widths(groups[a].widths, groups[b].widths), groups[a].rows };
+        group.rows.insert(group.rows.end(), groups[b].rows.begin(), groups[b].rows.end());
+        merged[a] = merged[b] = true;
+        groups.push_back(std::move(group));
+        merged.push_back(false);
+        size_t c = groups.size() - 1;
+        for (size_t other = 0; other < c; ++other) {
+            if (ptrdiff_t gain = merged[other] ? 0 : saving(other, c); gain > 0) {
+                heap.push_back({ gain, other, c });
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+    }
+    std::vector<StoreLayout::Group> kept;
+    for (size_t i = 0; i < groups.size(); ++i) {
+        if (!merged[i]) {
+            kept.push_back(std::move(groups[i]));
+        }
+    }
+    groups = std::move(kept);
+    return layout;
+}
+
+// Writes rows, each with a delta per region but the default's, as an ItemVariationStore, and
+// returns where each row went.
+std::vector<DeltaSetIndex> write_item_variation_store(Writer& w, const Build& build, const std::vector<std::vector<int16_t>>& rows, bool optimize) {
+    size_t axisCount = build.designspace.axes.size();
+    StoreLayout layout = layout_store(build.model.supports.size() - 1, rows, optimize);
+    // A subtable holds at most 65535 rows.
+    std::vector<std::pair<const StoreLayout::Group*, size_t>> subtables; // group, first row
+    for (const StoreLayout::Group& group : layout.groups) {
+        for (size_t first = 0; first < std::max<size_t>(group.rows.size(), 1); first += 0xFFFF) {
+            subtables.push_back({ &group, first });
+        }
+    }
+
+    size_t start = w.size();
+    w.u16(1);                               // format
+    size_t regionListOffset = w.size();
+    w.u32(0);
+    w.u16(subtables.size());                // itemVariationDataCount
+    size_t dataOffsets = w.size();
+    for (size_t i = 0; i < subtables.size(); ++i) {
+        w.u32(0);
+    }
+
+    w.patch32(regionListOffset, w.size() - start);
+    w.u16(axisCount);
+    w.u16(layout.regions.size());
+    for (uint16_t region : layout.regions) {
+        const Region& support = build.model.supports[region + 1];
+        for (size_t axis = 0; axis < axisCount; ++axis) {
+            w.f2dot14(support.start[axis]);
+            w.f2dot14(support.peak[axis]);
+            w.f2dot14(support.end[axis]);
+        }
+    }
+
+    std::vector<DeltaSetIndex> placed(layout.rows.size());
+    for (size_t outer = 0; outer < subtables.size(); ++outer) {
+        const auto& [group, first] = subtables[outer];
+        size_t count = std::min<size_t>(group->rows.size() - first, 0xFFFF);
+        // Word columns go first.
+        std::vector<uint16_t> columns;
+        for (uint8_t width : { 2, 1 }) {
+            for (size_t column = 0; column < group->widths.size(); ++column) {
+                if (group->widths[column] == width) {
+                    columns.push_back(column);
+                }
+            }
+        }
+        uint16_t wordCount = std::count(group->widths.begin(), group->widths.end(), 2);
+        w.patch32(dataOffsets + outer * 4, w.size() - start);
+        w.u16(count);                       // itemCount
+        w.u16(wordCount);                   // wordDeltaCount
+        w.u16(columns.size());              // regionIndexCount
+        for (uint16_t column : columns) {
+            w.u16(column);
+        }
+        for (size_t inner = 0; inner < count; ++inner) {
+            size_t row = group->rows[first + inner];
+            placed[row] = { uint16_t(outer), uint16_t(inner) };
+            for (size_t i = 0; i < columns.size(); ++i) {
+                int16_t delta = layout.rows[row][columns[i]];
+                if (i < wordCount) {
+                    w.i16(delta);
+                } else {
+                    w.u8(static_cast<uint8_t>(static_cast<int8_t>(delta)));
+                }
+            }
+        }
+    }
+    std::vector<DeltaSetIndex> indices;
+    for (size_t row : layout.rowOf) {
+        indices.push_back(placed[row]);
+    }
+    return indices;
+}
+
+std::vector<uint8_t> build_hvar(const Build& build, const std::vector<GlyphVariations>& glyphs, bool optimize) {
+    // An all zero row is shared by every glyph whose advance doesn't vary; when every glyph's does
+    // there's none, so the rows always fit 16 bits of index.
+    std::vector<std::vector<int16_t>> rows;
+    std::vector<uint16_t> rowOf;
+    int zeroRow = -1;
+    for (const GlyphVariations& glyph : glyphs) {
+        if (glyph.advanceDeltas.empty()) {
+            if (zeroRow < 0) {
+                zeroRow = rows.size();
+                rows.emplace_back(build.model.supports.size() - 1);
+            }
+            rowOf.push_back(zeroRow);
+        } else {
+            rowOf.push_back(rows.size());
+            rows.push_back(glyph.advanceDeltas);
+        }
+    }
+
+    Writer w;
+    w.u16(1); w.u16(0);
+    size_t storeOffset = w.size();
+    w.u32(0);
+    size_t advanceMapOffset = w.size();
+    w.u32(0);
+    w.u32(0);                               // lsbMappingOffset
+    w.u32(0);                               // rsbMappingOffset
+
+    Writer store;
+    std::vector<DeltaSetIndex> indices = write_item_variation_store(store, build, rows, optimize);
+    std::vector<DeltaSetIndex> map;
+    for (uint16_t row : rowOf) {
+        map.push_back(indices[row]);
+    }
+    // Glyphs past the end of the map use its last entry, so repeats of it at the end can go.
+    while (optimize && map.size() > 1 && map[map.size() - 2].outer == map.back().outer && map[map.size() - 2].inner == map.back().inner) {
+        map.pop_back();
+    }
+    // Entries are as narrow as the largest index allows.
+    int innerBits = optimize ? 1 : 16, outerBits = 0;
+    for (const DeltaSetIndex& index : map) {
+        while (index.inner >> innerBits) {
+            ++innerBits;
+        }
+        while (index.outer >> outerBits) {
+            ++outerBits;
+        }
+    }
+    int entrySize = (innerBits + outerBits + 7) / 8;
+
+    w.patch32(advanceMapOffset, w.size());
+    w.u8(0);                                // DeltaSetIndexMap format 0
+    w.u8((entrySize - 1) << 4 | (innerBits - 1));
+    w.u16(map.size());
+    for (const DeltaSetIndex& index : map) {
+        uint32_t entry = uint32_t(index.outer) << innerBits | index.inner;
+        for (int i = entrySize - 1; i >= 0; --i) {
+            w.u8(entry >> (i * 8));
+        }
+    }
+    w.pad(4);
+
+    w.patch32(storeOffset, w.size());
+    w.bytes(store.data);
+    return w.data;
+}
+
+// The metrics MVAR can vary, sorted by tag as the table requires, and where the masters keep them.
+struct MvarMetric {
+    uint32_t tag;
+    uint32_t table;
+    int (*read)(const Reader& table);
+};
+
+const MvarMetric kMvarMetrics[] = {
+    { sfnt_tag('c', 'p', 'h', 't'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).sCapHeight(); } },
+    { sfnt_tag('h', 'a', 's', 'c'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).sTypoAscender(); } },
+    { sfnt_tag('h', 'c', 'l', 'a'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).usWinAscent(); } },
+    { sfnt_tag('h', 'c', 'l', 'd'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).usWinDescent(); } },
+    { sfnt_tag('h', 'c', 'o', 'f'), kHheaTag, [](const Reader& t) -> int { return HheaView(t).caretOffset(); } },
+    { sfnt_tag('h', 'c', 'r', 'n'), kHheaTag, [](const Reader& t) -> int { return HheaView(t).caretSlopeRun(); } },
+    { sfnt_tag('h', 'c', 'r', 's'), kHheaTag, [](const Reader& t) -> int { return HheaView(t).caretSlopeRise(); } },
+    { sfnt_tag('h', 'd', 's', 'c'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).sTypoDescender(); } },
+    { sfnt_tag('h', 'l', 'g', 'p'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).sTypoLineGap(); } },
+    { sfnt_tag('s', 'b', 'x', 'o'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).ySubscriptXOffset(); } },
+    { sfnt_tag('s', 'b', 'x', 's'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).ySubscriptXSize(); } },
+    { sfnt_tag('s', 'b', 'y', 'o'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).ySubscriptYOffset(); } },
+    { sfnt_tag('s', 'b', 'y', 's'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).ySubscriptYSize(); } },
+    { sfnt_tag('s', 'p', 'x', 'o'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).ySuperscriptXOffset(); } },
+    { sfnt_tag('s', 'p', 'x', 's'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).ySuperscriptXSize(); } },
+    { sfnt_tag('s', 'p', 'y', 'o'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).ySuperscriptYOffset(); } },
+    { sfnt_tag('s', 'p', 'y', 's'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).ySuperscriptYSize(); } },
+    { sfnt_tag('s', 't', 'r', 'o'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).yStrikeoutPosition(); } },
+    { sfnt_tag('s', 't', 'r', 's'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).yStrikeoutSize(); } },
+    { sfnt_tag('u', 'n', 'd', 'o'), sfnt_tag('p', 'o', 's', 't'), [](const Reader& t) -> int { return PostView(t).underlinePosition(); } },
+    { sfnt_tag('u', 'n', 'd', 's'), sfnt_tag('p', 'o', 's', 't'), [](const Reader& t) -> int { return PostView(t).underlineThickness(); } },
+    { sfnt_tag('x', 'h', 'g', 't'), sfnt_tag('O', 'S', '/', '2'), [](const Reader& t) -> int { return Os2View(t).sxHeight(); } },
+};
+
+// Value records for the metrics that vary, or an empty table when none do.
+std::vector<uint8_t> build_mvar(const Build& build, bool optimize) {
+    std::vector<uint32_t> tags;
+    std::vector<std::vector<int16_t>> rows;
+    std::vector<double> out(build.model.order.size());
+    for (const MvarMetric& metric : kMvarMetrics) {
+        build.model.deltas([&](size_t master) { return metric.read(sfnt_table(build.designspace.masters[master].font, metric.table)); }, out.data());
+        if (std::any_of(out.begin() + 1, out.end(), [](double d) { return d != 0; })) {
+            tags.push_back(metric.tag);
+            rows.emplace_back(out.begin() + 1, out.end());
+        }
+    }
+    if (tags.empty()) {
+        return {};
+    }
+
+    Writer w;
+    w.u16(1); w.u16(0);
+    w.u16(0);                               // reserved
+    w.u16(8);                               // valueRecordSize
+    w.u16(tags.size());
+    size_t storeOffset = w.size();
+    w.u16(0);
+    size_t recordsStart = w.size();
+    for (size_t i = 0; i < tags.size(); ++i) {
+        w.tag(tags[i]);
+        w.u16(0);
+        w.u16(0);
+    }
+    w.pad(4);
+    w.patch16(storeOffset, w.size());
+    std::vector<DeltaSetIndex> indices = write_item_variation_store(w, build, rows, optimize);
+    for (size_t i = 0; i < tags.size(); ++i) {
+        w.patch16(recordsStart + i * 8 + 4, indices[i].outer);
+        w.patch16(recordsStart + i * 8 + 6, indices[i].inner);
+    }
+    return w.data;
+}
+
+// Names the new tables refer to, added to the default master's. fvar and STAT share the axis
+// names.
+struct Names {
+    std::vector<std::pair<uint16_t, std::string>> added;
+    uint16_t next = 256;
+
+    uint16_t add(const std::string& name) {
+        for (const auto& [nameID, text] : added) {
+            if (text == name) {
+                return nameID;
+            }
+        }
+        added.push_back({ next, name });
+        return next++;
+    }
+};
+
+std::vector<uint8_t> build_fvar(const Build& build, Names& names) {
+    const Designspace& designspace = build.designspace;
+    Writer w;
+    w.u16(1); w.u16(0);
+    w.u16(16);                              // axesArrayOffset
+    w.u16(2);                               // reserved
+    w.u16(designspace.axes.size());
+    w.u16(20);                              // axisSize
+    w.u16(designspace.instances.size());
+    w.u16(4 + 4 * designspace.axes.size()); // instanceSize
+    for (const DesignAxis& axis : designspace.axes) {
+        w.tag(axis.tag);
+        w.fixed(axis.minimum);
+        w.fixed(axis.def);
+        w.fixed(axis.maximum);
+        w.u16(0);
+        w.u16(names.add(axis.name));
+    }
+    for (const Instance& instance : designspace.instances) {
+        w.u16(names.add(instance.name));
+        w.u16(0);
+        for (size_t i = 0; i < designspace.axes.size(); ++i) {
+            w.fixed(map_value(designspace.axes[i], instance.location[i], true));
+        }
+    }
+    return w.data;
+}
+
+// Each axis's map in normalized coordinates, or an empty table when no axis has one.
+std::vector<uint8_t> build_avar(const Build& build) {
+    const std::vector<DesignAxis>& axes = build.designspace.axes;
+    if (std::all_of(axes.begin(), axes.end(), [](const DesignAxis& axis) { return axis.map.empty(); })) {
+        return {};
+    }
+    Writer w;
+    w.u16(1); w.u16(0);
+    w.u16(0);                               // reserved
+    w.u16(axes.size());
+    for (const DesignAxis& axis : axes) {
+        std::map<double, double> map = { { -1, -1 }, { 0, 0 }, { 1, 1 } };
+        for (const auto& [input, output] : axis.map) {
+            map[normalize(input, axis.minimum, axis.def, axis.maximum)] = normalize_design(axis, output);
+        }
+        w.u16(map.size());
+        for (const auto& [from, to] : map) {
+            w.f2dot14(from);
+            w.f2dot14(to);
+        }
+    }
+    return w.data;
+}
+
+std::string format_value(double value) {
+    char label[32];
+    snprintf(label, sizeof(label), "%g", value);
+    return label;
+}
+
+// One design axis record per axis, with an axis value for each extreme and an elidable one for
+// the default.
+std::vector<uint8_t> build_stat(const Build& build, Names& names) {
+    const std::vector<DesignAxis>& axes = build.designspace.axes;
+    struct AxisValue { uint16_t axis; uint16_t flags; uint16_t nameID; double value; };
+    std::vector<AxisValue> values;
+    std::vector<uint16_t> axisNameIDs;
+    for (size_t i = 0; i < axes.size(); ++i) {
+        const DesignAxis& axis = axes[i];
+        axisNameIDs.push_back(names.add(axis.name));
+        if (axis.minimum < axis.def) {
+            values.push_back({ static_cast<uint16_t>(i), 0, names.add(format_value(axis.minimum)), axis.minimum });
+        }
+        values.push_back({ static_cast<uint16_t>(i), 0x2, 2, axis.def }); // ELIDABLE_AXIS_VALUE_NAME, the subfamily name
+        if (axis.maximum > axis.def) {
+            values.push_back({ static_cast<uint16_t>(i), 0, names.add(format_value(axis.maximum)), axis.maximum });
+        }
+    }
+
+    Writer w;
+    w.u16(1); w.u16(1);
+    w.u16(8);                               // designAxisSize
+    w.u16(axes.size());
+    size_t axesOffset = w.size();
+    w.u32(0);
+    w.u16(values.size());
+    size_t valuesOffset = w.size();
+    w.u32(0);
+    w.u16(2);                               // elidedFallbackNameID
+
+    w.patch32(axesOffset, w.size());
+    for (size_t i = 0; i < axes.size(); ++i) {
+        w.tag(axes[i].tag);
+        w.u16(axisNameIDs[i]);
+        w.u16(i);
+    }
+    size_t offsetsStart = w.size();
+    w.patch32(valuesOffset, offsetsStart);
+    for (size_t i = 0; i < values.size(); ++i) {
+        w.u16(0);
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+        w.patch16(offsetsStart + i * 2, w.size() - offsetsStart);
+        w.u16(1);                           // format
+        w.u16(values[i].axis);
+        w.u16(values[i].flags);
+        w.u16(values[i].nameID);
+        w.fixed(values[i].value);
+    }
+    return w.data;
+}
+
+// UTF-8 as UTF-16BE, for Windows names.
+std::vector<uint8_t> utf16be(const std::string& text) {
+    Writer w;
+    for (size_t i = 0; i < text.size();) {
+        uint8_t c = text[i];
+        int length = c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+        uint32_t code = length == 1 ? c : c & (0x3F >> (length - 1));
+        for (int j = 1; j < length && i + j < text.size(); ++j) {
+            code = code << 6 | (text[i + j] & 0x3F);
+        }
+        i += length;
+        if (code >= 0x10000) {
+            w.u16(0xD800 + ((code - 0x10000) >> 10));
+            w.u16(0xDC00 + ((code - 0x10000) & 0x3FF));
+        } else {
+            w.u16(code);
+        }
+    }
+    return w.data;
+}
+
+// The default master's names plus the added ones, as Windows English names.
+std::vector<uint8_t> build_name(const Reader& name, const Names& names) {
+    NameView view(name);
+    struct Record {
+        uint16_t platform, encoding, language, nameID;
+        std::vector<uint8_t> string;
+    };
+    std::vector<Record> records;
+    for (NameRecordView record : view.nameRecord()) {
+        Reader string = view.storage().at(record.stringOffset(), record.length());
+        records.push_back({ record.platformID(), record.encodingID(), record.languageID(), record.nameID(),
+                            std::vector<uint8_t>(string.data, string.data + string.length) });
+    }
+    for (const auto& [nameID, text] : names.added) {
+        records.push_back({ 3, 1, 0x409, nameID, utf16be(text) });
+    }
+    std::stable_sort(records.begin(), records.end(), [](const Record& a, const Record& b) {
+        return std::tie(a.platform, a.encoding, a.language, a.nameID) < std::tie(b.platform, b.encoding, b.language, b.nameID);
+    });
+
+    Writer w;
+    w.u16(0);
+    w.u16(records.size());
+    w.u16(6 + records.size() * 12);
+    Writer strings;
+    for (const Record& record : records) {
+        w.u16(record.platform);
+        w.u16(record.encoding);
+        w.u16(record.language);
+        w.u16(record.nameID);
+        w.u16(record.string.size());
+        w.u16(strings.size());
+        strings.bytes(record.string);
+    }
+    w.bytes(strings.data);
+    return w.data;
+}
+
+// Tables the masters may have from an earlier build, which this one replaces or has no use for.
+bool replaced_table(uint32_t tag) {
+    const uint32_t replaced[] = {
+        kFvarTag, kAvarTag, kGvarTag, kHvarTag, kMvarTag, sfnt_tag('S', 'T', 'A', 'T'), sfnt_tag('c', 'v', 'a', 'r'),
+        sfnt_tag('n', 'a', 'm', 'e'), sfnt_tag('D', 'S', 'I', 'G'),
+    };
+    return std::find(std::begin(replaced), std::end(replaced), tag) != std::end(replaced);
+}
+
+// Looks up every glyph's advance delta in an HVAR at each master's location, timing it; the sum
+// of the deltas lets the caller check two tables agree.
+double time_hvar_lookups(const std::vector<uint8_t>& hvar, const Build& build, uint32_t glyphCount, double* sum) {
+    Reader table{ hvar.data(), hvar.size() };
+    ItemVariationStore store(HvarView(table).itemVariationStore());
+    Reader advanceMap = HvarView(table).advanceWidthMapping();
+    std::vector<std::vector<double>> locations;
+    for (const Master& master : build.designspace.masters) {
+        std::vector<double> location;
+        for (size_t i = 0; i < build.designspace.axes.size(); ++i) {
+            location.push_back(normalize_design(build.designspace.axes[i], master.location[i]));
+        }
+        locations.push_back(location);
+    }
+    *sum = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (const std::vector<double>& location : locations) {
+        for (uint32_t glyph = 0; glyph < glyphCount; ++glyph) {
+            auto [outer, inner] = delta_set_index(advanceMap, glyph);
+            *sum += store.delta(outer, inner, location.data());
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return seconds * 1e9 / std::max<size_t>(locations.size() * glyphCount, 1);
+}
+
+void usage(const char* program) {
+    printf("Usage: %s [options] font.designspace out.ttf\n", program);
+    printf("  -j N       threads working out glyph deltas (default: one per core)\n");
+    printf("  --no-iup   keep every point delta\n");
+    printf("  --no-optimize\n");
+    printf("             write HVAR and MVAR deltas as one subtable of words over every region\n");
+    printf("  --order tag,tag,... | recommended\n");
+    printf("             tables to lay out first in the file, in this order, or in the order the\n");
+    printf("             OpenType spec recommends (default: all by tag)\n");
+}
+
+int main(int argc, char** argv) {
+    Build build;
+    FontSerializer serializer;
+    const char* designspacePath = nullptr;
+    const char* outputPath = nullptr;
+    int jobs = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            jobs = std::clamp(atoi(argv[++i]), 1, 256);
+        } else if (!strcmp(argv[i], "--no-iup")) {
+            build.iup = false;
+        } else if (!strcmp(argv[i], "--no-optimize")) {
+            build.optimize = false;
+        } else if (!strcmp(argv[i], "--order") && i + 1 < argc) {
+            std::string tags = argv[++i];
+            if (tags == "recommended") {
+                serializer.order = kRecommendedTableOrder;
+                continue;
+            }
+            for (size_t start = 0; start < tags.size();) {
+                size_t end = std::min(tags.find(',', start), tags.size());
+                serializer.order.push_back(tag_from_string(tags.substr(start, end - start)));
+                start = end + 1;
+            }
+        } else if (argv[i][0] != '-' && !designspacePath) {
+            designspacePath = argv[i];
+        } else if (argv[i][0] != '-' && !outputPath) {
+            outputPath = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!outputPath) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Designspace& designspace = build.designspace;
+    if (!parse_designspace(designspacePath, &designspace)) {
+        return 1;
+    }
+    std::vector<std::vector<double>> locations;
+    for (Master& master : designspace.masters) {
+        if (!read_file(master.path, &master.data)) {
+            printf("Could not open: %s\n", master.path.c_str());
+            return 1;
+        }
+        master.font = Reader{ master.data.data(), master.data.size() };
+        master.glyf = glyf_tables(master.font);
+        if (master.glyf.glyf.empty() || master.glyf.loca.empty()) {
+            printf("%s: no glyf outlines\n", master.path.c_str());
+            return 1;
+        }
+        // Rounded as gvar will store them, so a master's own location gets exactly its outline.
+        std::vector<double> location;
+        for (size_t i = 0; i < designspace.axes.size(); ++i) {
+            location.push_back(std::lround(normalize_design(designspace.axes[i], master.location[i]) * 16384) / 16384.0);
+        }
+        locations.push_back(location);
+    }
+    if (!build_model(locations, &build.model)) {
+        return 1;
+    }
+    build.base = build.model.order[0];
+    build.glyphCount = designspace.masters[build.base].glyf.glyphCount;
+    for (const Master& master : designspace.masters) {
+        if (master.glyf.glyphCount != build.glyphCount) {
+            printf("%s has %u glyphs, the default master %u\n", master.path.c_str(), master.glyf.glyphCount, build.glyphCount);
+            return 1;
+        }
+    }
+
+    // Glyphs are independent, so workers take the next one until they run out.
+    std::vector<GlyphVariations> glyphs(build.glyphCount);
+    std::atomic<uint32_t> next(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < jobs; ++i) {
+        workers.emplace_back([&] {
+            for (uint32_t glyphID; !failed && (glyphID = next++) < build.glyphCount;) {
+                if (!build_glyph(build, glyphID, &glyphs[glyphID])) {
+                    failed = true;
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    if (failed) {
+        return 1;
+    }
+
+    const Reader& base = designspace.masters[build.base].font;
+    Names names;
+    for (NameRecordView record : NameView(sfnt_table(base, sfnt_tag('n', 'a', 'm', 'e'))).nameRecord()) {
+        names.next = std::max<uint16_t>(names.next, record.nameID() + 1);
+    }
+    // fvar and STAT add names, so they are built here, in order, with name after them; gvar and
+    // the stores only read the build and are encoded on the serializer's threads.
+    serializer.jobs = jobs;
+    for (TableRecordView record : sfnt_directory(base).tableRecords()) {
+        if (!replaced_table(record.tableTag())) {
+            Reader table = base.at(record.offset(), record.length());
+            serializer.add(record.tableTag(), std::vector<uint8_t>(table.data, table.data + table.length));
+        }
+    }
+    serializer.add(kFvarTag, build_fvar(build, names));
+    serializer.add_encoder(kGvarTag, [&] { return build_gvar(build, glyphs); });
+    serializer.add_encoder(kHvarTag, [&] { return build_hvar(build, glyphs, build.optimize); });
+    serializer.add_encoder(kAvarTag, [&] { return build_avar(build); });
+    serializer.add_encoder(kMvarTag, [&] { return build_mvar(build, build.optimize); });
+    serializer.add(sfnt_tag('S', 'T', 'A', 'T'), build_stat(build, names));
+    serializer.add(sfnt_tag('n', 'a', 'm', 'e'), build_name(sfnt_table(base, sfnt_tag('n', 'a', 'm', 'e')), names));
+    serializer.finish();
+    if (!serializer.write_file(outputPath)) {
+        printf("Could not write: %s\n", outputPath);
+        return 1;
+    }
+    size_t deltas = 0, kept = 0, gvarSize = 0;
+    for (const GlyphVariations& glyph : glyphs) {
+        deltas += glyph.deltas;
+        kept += glyph.keptDeltas;
+        gvarSize += glyph.gvar.size();
+    }
+    printf("%s: %zu bytes, %zu axes, %zu masters, %u glyphs, %zu regions; gvar keeps %zu of %zu point deltas in %zu bytes\n",
+           outputPath, serializer.size(), designspace.axes.size(), designspace.masters.size(), build.glyphCount,
+           build.model.order.size() - 1, kept, deltas, gvarSize);
+    if (build.optimize) {
+        // What the store optimization saved, against the plain layout.
+        const std::vector<uint8_t>& hvar = *serializer.table(kHvarTag);
+        const std::vector<uint8_t>* mvar = serializer.table(kMvarTag);
+        std::vector<uint8_t> plainHvar = build_hvar(build, glyphs, false);
+        double plainSum, sum;
+        double plainTime = time_hvar_lookups(plainHvar, build, build.glyphCount, &plainSum);
+        double time = time_hvar_lookups(hvar, build, build.glyphCount, &sum);
+        if (plainSum != sum) {
+            printf("HVAR: optimized deltas differ (%g, %g)\n", sum, plainSum);
+            return 1;
+        }
+        printf("HVAR: %zu -> %zu bytes, %.1f -> %.1f ns per lookup\n", plainHvar.size(), hvar.size(), plainTime, time);
+        if (mvar) {
+            printf("MVAR: %zu -> %zu bytes\n", build_mvar(build, false).size(), mvar->size());
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,749 @@
+// Compile with
+// c++ -O2 -std=c++17 diff_fonts.cpp -o diff_fonts -pthread
+
+// Compares two font files, SFNS.ttf against a modified copy say, and reports what differs table by
+// table and, in the tables it knows, structure by structure: glyphs in glyf, hmtx, gvar and HVAR,
+// regions and metrics in HVAR and MVAR, axes in fvar, records in name. Tables are compared whole
+// first, so the rest is only looked at where they differ; glyphs are hashed on N threads (default:
+// one per core), which also finds glyphs that only moved to another glyph ID.
+//
+//   diff_fonts [-j N] [--limit N] a.ttf b.ttf
+//
+// At most --limit items (default 10) are listed per difference. Of a collection, the first font is
+// compared. Exits with 0 when the fonts are the same, 1 when they differ and 2 on trouble, as diff
+// does.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "sfnt.h"
+
+// The file mapped read-only. Fonts can be hundreds of megabytes, and only the tables that differ
+// get read past a compare. The mapping lasts as long as the process.
+bool map_file(const char* path, Reader* file) {
+    FILE* fileHandle = fopen(path, "rb");
+    if (!fileHandle) {
+        return false;
+    }
+    struct stat fileStatus;
+    void* fileMmap = MAP_FAILED;
+    if (!fstat(fileno(fileHandle), &fileStatus) && fileStatus.st_size > 0) {
+        fileMmap = mmap(nullptr, size_t(fileStatus.st_size), PROT_READ, MAP_PRIVATE, fileno(fileHandle), 0);
+    }
+    fclose(fileHandle);
+    if (fileMmap == MAP_FAILED) {
+        return false;
+    }
+    *file = Reader{ static_cast<const uint8_t*>(fileMmap), size_t(fileStatus.st_size) };
+    return true;
+}
+
+std::string tag_to_string(uint32_t tag) {
+    char buffer[5];
+    buffer[0] = (tag & 0xff000000) >> 24;
+    buffer[1] = (tag & 0xff0000) >> 16;
+    buffer[2] = (tag & 0xff00) >> 8;
+    buffer[3] = tag & 0xff;
+    buffer[4] = 0;
+    return std::string(buffer);
+}
+
+std::string format(const char* format, ...) __attribute__((format(printf, 1, 2)));
+std::string format(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    char buffer[512];
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return buffer;
+}
+
+// A 64-bit hash of some bytes, taken 8 at a time. Nothing hashed here is adversarial, so all it
+// needs is for different bytes to hash differently with high probability.
+uint64_t hash_bytes(const Reader& bytes) {
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ bytes.length;
+    size_t i = 0;
+    for (; i + 8 <= bytes.length; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes.data + i, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+    uint64_t tail = 0;
+    if (i < bytes.length) {
+        memcpy(&tail, bytes.data + i, bytes.length - i);
+    }
+    hash = (hash ^ tail) * 0xC4CEB9FE1A85EC53ull;
+    return hash ^ hash >> 29;
+}
+
+// Calls task(i) for each i below count on up to jobs threads, each taking the next i until none
+// are left.
+template <typename Task>
+void parallel_for(int jobs, size_t count, Task task) {
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min<size_t>(jobs, count); ++i) {
+        workers.emplace_back([&] {
+            for (size_t item; (item = next++) < count;) {
+                task(item);
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+struct Options {
+    int jobs = 1;
+    size_t limit = 10;
+};
+
+struct Font {
+    Reader file;
+    std::map<uint32_t, Reader> tables;
+    GlyfTables glyf;
+    std::vector<uint32_t> axisTags;
+
+    Reader table(uint32_t tag) const {
+        auto found = tables.find(tag);
+        return found == tables.end() ? Reader() : found->second;
+    }
+};
+
+bool load_font(const char* path, Font* font) {
+    if (!map_file(path, &font->file)) {
+        printf("Could not open: %s\n", path);
+        return false;
+    }
+    uint32_t version = font->file.u32(0);
+    if (version != 0x00010000 && version != sfnt_tag('t', 'r', 'u', 'e') && version != sfnt_tag('O', 'T', 'T', 'O') &&
+        version != sfnt_tag('t', 't', 'c', 'f')) {
+        printf("Not a font: %s\n", path);
+        return false;
+    }
+    for (TableRecordView record : sfnt_directory(font->file).tableRecords()) {
+        font->tables[record.tableTag()] = font->file.at(record.offset(), record.length());
+    }
+    font->glyf = glyf_tables(font->file);
+    font->axisTags = fvar_axis_tags(font->table(kFvarTag));
+    return true;
+}
+
+// "1 glyph", "2 glyphs".
+std::string count(size_t n, const char* noun) {
+    return format("%zu %s%s", n, noun, n == 1 ? "" : "s");
+}
+
+// What differs in one table, a line per difference, indented under what it's part of.
+struct Report {
+    std::vector<std::string> lines;
+
+    void add(int depth, const std::string& line) { lines.push_back(std::string(depth * 2, ' ') + line); }
+};
+
+// Lists describe(item) for up to limit items, then how many more there are.
+template <typename Describe>
+void list_items(Report* report, int depth, const Options& options, const std::vector<uint32_t>& items, Describe describe) {
+    for (size_t i = 0; i < std::min(items.size(), options.limit); ++i) {
+        report->add(depth, describe(items[i]));
+    }
+    if (items.size() > options.limit) {
+        report->add(depth, format("... and %zu more", items.size() - options.limit));
+    }
+}
+
+// The byte ranges two tables differ in, for the tables nothing better is known about.
+void diff_bytes(const Reader& a, const Reader& b, const Options& options, Report* report) {
+    std::vector<std::pair<size_t, size_t>> ranges;
+    size_t common = std::min(a.length, b.length);
+    for (size_t i = 0; i < common; ++i) {
+        if (a.data[i] != b.data[i]) {
+            if (!ranges.empty() && ranges.back().second == i) {
+                ranges.back().second = i + 1;
+            } else {
+                ranges.push_back({ i, i + 1 });
+            }
+        }
+    }
+    if (ranges.empty() && a.length != b.length) {
+        report->add(1, format("the first %zu bytes are the same", common));
+        return;
+    }
+    std::vector<uint32_t> items(ranges.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        items[i] = i;
+    }
+    report->add(1, count(ranges.size(), "byte range") + (ranges.size() == 1 ? " differs" : " differ"));
+    list_items(report, 2, options, items, [&](uint32_t i) {
+        return ranges[i].second - ranges[i].first == 1 ? format("at %zu", ranges[i].first)
+                                                       : format("at %zu..%zu", ranges[i].first, ranges[i].second - 1);
+    });
+}
+
+// Glyphs keyed on jobs threads by key(font, glyph), a hash of what a table holds for the glyph.
+// Returns the glyphs both fonts have whose keys differ and, in movedFrom, the glyph of a that each
+// of them matches in b if any: a glyph that only moved.
+template <typename Key>
+std::vector<uint32_t> differing_glyphs(const Font& a, const Font& b, const Options& options,
+                                       std::map<uint32_t, uint32_t>* movedFrom, Key key) {
+    uint32_t countA = a.glyf.glyphCount, countB = b.glyf.glyphCount;
+    std::vector<uint64_t> hashesA(countA), hashesB(countB);
+    constexpr size_t kChunk = 256;
+    size_t chunksA = (countA + kChunk - 1) / kChunk;
+    parallel_for(options.jobs, chunksA + (countB + kChunk - 1) / kChunk, [&](size_t chunk) {
+        bool inA = chunk < chunksA;
+        const Font& font = inA ? a : b;
+        std::vector<uint64_t>& hashes = inA ? hashesA : hashesB;
+        size_t first = (inA ? chunk : chunk - chunksA) * kChunk;
+        for (size_t glyph = first; glyph < std::min(first + kChunk, hashes.size()); ++glyph) {
+            hashes[glyph] = key(font, uint32_t(glyph));
+        }
+    });
+    std::vector<uint32_t> differing;
+    for (uint32_t glyph = 0; glyph < std::min(countA, countB); ++glyph) {
+        if (hashesA[glyph] != hashesB[glyph]) {
+            differing.push_back(glyph);
+        }
+    }
+    if (movedFrom && !differing.empty()) {
+        std::unordered_map<uint64_t, uint32_t> glyphOf;
+        for (uint32_t glyph = countA; glyph-- > 0;) {
+            glyphOf[hashesA[glyph]] = glyph;
+        }
+        for (uint32_t glyph : differing) {
+            auto found = glyphOf.find(hashesB[glyph]);
+            if (found != glyphOf.end()) {
+                (*movedFrom)[glyph] = found->second;
+            }
+        }
+    }
+    return differing;
+}
+
+// How a glyph's outline changed, from the outlines rather than the bytes.
+std::string describe_outline(const Font& a, const Font& b, uint32_t glyph) {
+    GlyphOutline outlineA = glyph_outline(a.glyf, glyph), outlineB = glyph_outline(b.glyf, glyph);
+    if (outlineA.components != outlineB.components) {
+        auto kind = [](const GlyphOutline& outline) {
+            return outline.components.empty() ? format("%zu contours", outline.endPoints.size())
+                                               : format("%zu components", outline.components.size());
+        };
+        return format("%s -> %s", kind(outlineA).c_str(), kind(outlineB).c_str());
+    }
+    if (outlineA.endPoints != outlineB.endPoints) {
+        size_t pointsA = outlineA.x.size() - 4, pointsB = outlineB.x.size() - 4;
+        return format("%zu contours, %zu points -> %zu contours, %zu points", outlineA.endPoints.size(), pointsA,
+                      outlineB.endPoints.size(), pointsB);
+    }
+    // The phantom points follow the metrics, which hmtx reports.
+    size_t points = outlineA.x.size() - 4, moved = 0;
+    int32_t farthest = 0;
+    for (size_t i = 0; i < points; ++i) {
+        int32_t distance = std::max(std::abs(outlineA.x[i] - outlineB.x[i]), std::abs(outlineA.y[i] - outlineB.y[i]));
+        moved += distance != 0;
+        farthest = std::max(farthest, distance);
+    }
+    std::string description;
+    if (moved) {
+        description = format("%zu of %zu %s moved, by up to %d units", moved, points,
+                             outlineA.components.empty() ? "points" : "component offsets", farthest);
+    }
+    if (outlineA.onCurve != outlineB.onCurve) {
+        description += description.empty() ? "on-curve flags differ" : ", on-curve flags differ";
+    }
+    if (description.empty()) {
+        // Instructions, or flags that don't change the outline.
+        size_t bytesA = glyph_data(a.glyf, glyph).length, bytesB = glyph_data(b.glyf, glyph).length;
+        return bytesA == bytesB ? std::string("same outline, different bytes") : format("same outline, %zu -> %zu bytes", bytesA, bytesB);
+    }
+    return description;
+}
+
+void diff_glyf(const Font& a, const Font& b, const Options& options, Report* report) {
+    if (a.glyf.glyphCount != b.glyf.glyphCount) {
+        report->add(1, format("glyphs: %u -> %u", a.glyf.glyphCount, b.glyf.glyphCount));
+    }
+    std::map<uint32_t, uint32_t> movedFrom;
+    std::vector<uint32_t> glyphs = differing_glyphs(a, b, options, &movedFrom, [](const Font& font, uint32_t glyph) {
+        return hash_bytes(glyph_data(font.glyf, glyph));
+    });
+    if (glyphs.empty()) {
+        return;
+    }
+    report->add(1, format("%zu of %u glyphs differ", glyphs.size(), std::min(a.glyf.glyphCount, b.glyf.glyphCount)));
+    list_items(report, 2, options, glyphs, [&](uint32_t glyph) {
+        auto moved = movedFrom.find(glyph);
+        if (moved != movedFrom.end()) {
+            return format("glyph %u: a's glyph %u", glyph, moved->second);
+        }
+        return format("glyph %u: %s", glyph, describe_outline(a, b, glyph).c_str());
+    });
+}
+
+void diff_hmtx(const Font& a, const Font& b, const Options& options, Report* report) {
+    std::vector<uint32_t> glyphs = differing_glyphs(a, b, options, nullptr, [](const Font& font, uint32_t glyph) {
+        auto [advance, lsb] = horizontal_metrics(font.glyf, glyph);
+        return uint64_t(advance) << 16 | uint16_t(lsb);
+    });
+    if (a.glyf.metricCount != b.glyf.metricCount) {
+        report->add(1, format("long metrics: %u -> %u", a.glyf.metricCount, b.glyf.metricCount));
+    }
+    if (glyphs.empty()) {
+        return;
+    }
+    report->add(1, "metrics of " + count(glyphs.size(), "glyph") + " differ");
+    list_items(report, 2, options, glyphs, [&](uint32_t glyph) {
+        auto [advanceA, lsbA] = horizontal_metrics(a.glyf, glyph);
+        auto [advanceB, lsbB] = horizontal_metrics(b.glyf, glyph);
+        if (advanceA != advanceB && lsbA != lsbB) {
+            return format("glyph %u: advance %u -> %u, lsb %d -> %d", glyph, advanceA, advanceB, lsbA, lsbB);
+        }
+        return advanceA != advanceB ? format("glyph %u: advance %u -> %u", glyph, advanceA, advanceB)
+                                    : format("glyph %u: lsb %d -> %d", glyph, lsbA, lsbB);
+    });
+}
+
+// A region as tag(start, peak, end) for each axis it peaks on.
+std::string describe_region(const std::vector<int16_t>& coordinates, const std::vector<uint32_t>& axisTags) {
+    std::string description;
+    for (size_t axis = 0; axis * 3 + 2 < coordinates.size(); ++axis) {
+        if (coordinates[axis * 3 + 1]) {
+            description += format("%s%s(%g, %g, %g)", description.empty() ? "" : " ",
+                                  axis < axisTags.size() ? tag_to_string(axisTags[axis]).c_str() : "?",
+                                  coordinates[axis * 3] / 16384.0, coordinates[axis * 3 + 1] / 16384.0,
+                                  coordinates[axis * 3 + 2] / 16384.0);
+        }
+    }
+    return description.empty() ? "everywhere" : description;
+}
+
+// Regions in the set of a and not of b, described.
+std::vector<std::string> regions_missing(const std::vector<std::vector<int16_t>>& a, const std::vector<std::vector<int16_t>>& b,
+                                         const std::vector<uint32_t>& axisTags) {
+    std::vector<std::string> missing;
+    for (const std::vector<int16_t>& region : a) {
+        if (std::find(b.begin(), b.end(), region) == b.end()) {
+            missing.push_back(describe_region(region, axisTags));
+        }
+    }
+    return missing;
+}
+
+void report_regions(const std::vector<std::vector<int16_t>>& a, const std::vector<std::vector<int16_t>>& b, const char* what,
+                    const std::vector<uint32_t>& axisTags, const Options& options, Report* report) {
+    std::vector<std::string> removed = regions_missing(a, b, axisTags);
+    std::vector<std::string> added = regions_missing(b, a, axisTags);
+    if (a.size() != b.size() || !removed.empty() || !added.empty()) {
+        report->add(1, format("%s: %zu -> %zu", what, a.size(), b.size()));
+    }
+    for (auto [lines, sign] : { std::pair(&removed, "-"), std::pair(&added, "+") }) {
+        std::vector<uint32_t> items(lines->size());
+        for (size_t i = 0; i < items.size(); ++i) {
+            items[i] = i;
+        }
+        list_items(report, 2, options, items, [&](uint32_t i) { return format("%s %s", sign, (*lines)[i].c_str()); });
+    }
+}
+
+std::vector<std::vector<int16_t>> gvar_shared_tuples(const Reader& gvar) {
+    GvarView table(gvar);
+    std::vector<std::vector<int16_t>> tuples;
+    Reader peaks = table.sharedTuples().reader;
+    for (size_t i = 0; i < table.sharedTupleCount(); ++i) {
+        // As regions from 0 to the peak, so they read like the others.
+        std::vector<int16_t> region;
+        for (size_t axis = 0; axis < table.axisCount(); ++axis) {
+            int16_t peak = peaks.i16((i * table.axisCount() + axis) * 2);
+            region.insert(region.end(), { std::min<int16_t>(peak, 0), peak, std::max<int16_t>(peak, 0) });
+        }
+        tuples.push_back(region);
+    }
+    return tuples;
+}
+
+void diff_gvar(const Font& a, const Font& b, const Options& options, Report* report) {
+    Reader gvarA = a.table(kGvarTag), gvarB = b.table(kGvarTag);
+    report_regions(gvar_shared_tuples(gvarA), gvar_shared_tuples(gvarB), "shared tuples", b.axisTags, options, report);
+    // Shared tuple indices make the bytes of a glyph's variations depend on the shared tuples; they
+    // are compared with the peaks they point at filled in.
+    auto key = [](const Font& font, uint32_t glyph) {
+        Reader gvar = font.table(kGvarTag);
+        uint64_t hash = hash_bytes(gvar_glyph_data(gvar, glyph));
+        for_each_gvar_tuple(gvar, glyph, [&](const GvarTuple& tuple) {
+            hash = hash * 31 + hash_bytes(tuple.peak);
+        });
+        return hash;
+    };
+    std::vector<uint32_t> glyphs = differing_glyphs(a, b, options, nullptr, key);
+    if (glyphs.empty()) {
+        return;
+    }
+    report->add(1, "variations of " + count(glyphs.size(), "glyph") + " differ");
+    list_items(report, 2, options, glyphs, [&](uint32_t glyph) {
+        size_t tuplesA = 0, tuplesB = 0;
+        for_each_gvar_tuple(gvarA, glyph, [&](const GvarTuple&) { ++tuplesA; });
+        for_each_gvar_tuple(gvarB, glyph, [&](const GvarTuple&) { ++tuplesB; });
+        return format("glyph %u: %s, %zu bytes -> %s, %zu bytes", glyph, count(tuplesA, "tuple").c_str(),
+                      gvar_glyph_data(gvarA, glyph).length, count(tuplesB, "tuple").c_str(), gvar_glyph_data(gvarB, glyph).length);
+    });
+}
+
+// Regions as their coordinates, which compare across stores however they are numbered.
+std::vector<std::vector<int16_t>> store_regions(const ItemVariationStore& store) {
+    std::vector<std::vector<int16_t>> regions;
+    for (uint16_t region = 0; region < store.regionCount; ++region) {
+        std::vector<int16_t> coordinates;
+        for (uint16_t axis = 0; axis < store.axisCount; ++axis) {
+            Reader triple = store.coordinates(region, axis).reader;
+            coordinates.insert(coordinates.end(), { triple.i16(0), triple.i16(2), triple.i16(4) });
+        }
+        regions.push_back(coordinates);
+    }
+    return regions;
+}
+
+// A row of a store as its nonzero deltas by region, which compares equal however the stores lay out
+// their regions, subtables and rows.
+using StoreRow = std::vector<std::pair<std::vector<int16_t>, int32_t>>;
+
+StoreRow store_row(const ItemVariationStore& store, const std::vector<std::vector<int16_t>>& regions, uint16_t outer,
+                   uint16_t inner) {
+    StoreRow row;
+    ItemVariationData data = store.data(outer);
+    if (inner >= data.itemCount) {
+        return row;
+    }
+    size_t offset = data.row_offset(inner);
+    for (uint16_t column = 0; column < data.regionIndexCount; ++column) {
+        int32_t delta = data.delta(offset, column);
+        uint16_t region = data.region_index(column);
+        if (delta && region < regions.size()) {
+            row.push_back({ regions[region], delta });
+        }
+    }
+    std::sort(row.begin(), row.end());
+    return row;
+}
+
+// The deltas of two rows that differ, as region a -> b.
+std::string describe_rows(const StoreRow& a, const StoreRow& b, const std::vector<uint32_t>& axisTags) {
+    std::map<std::vector<int16_t>, std::pair<int32_t, int32_t>> deltas;
+    for (const auto& [region, delta] : a) {
+        deltas[region].first += delta;
+    }
+    for (const auto& [region, delta] : b) {
+        deltas[region].second += delta;
+    }
+    std::string description;
+    for (const auto& [region, delta] : deltas) {
+        if (delta.first != delta.second) {
+            description += format("%s%s %d -> %d", description.empty() ? "" : ", ", describe_region(region, axisTags).c_str(),
+                                  delta.first, delta.second);
+        }
+    }
+    return description;
+}
+
+struct StoreTable {
+    ItemVariationStore store;
+    std::vector<std::vector<int16_t>> regions;
+
+    explicit StoreTable(const ItemVariationStoreView& view) : store(view), regions(store_regions(store)) {}
+};
+
+void diff_hvar(const Font& a, const Font& b, const Options& options, Report* report) {
+    Reader hvarA = a.table(kHvarTag), hvarB = b.table(kHvarTag);
+    StoreTable storeA(HvarView(hvarA).itemVariationStore()), storeB(HvarView(hvarB).itemVariationStore());
+    report_regions(storeA.regions, storeB.regions, "regions", b.axisTags, options, report);
+    auto row = [&](const Font& font, uint32_t glyph) {
+        const StoreTable& store = &font == &a ? storeA : storeB;
+        auto [outer, inner] = delta_set_index(HvarView(font.table(kHvarTag)).advanceWidthMapping(), glyph);
+        return store_row(store.store, store.regions, outer, inner);
+    };
+    std::vector<uint32_t> glyphs = differing_glyphs(a, b, options, nullptr, [&](const Font& font, uint32_t glyph) {
+        uint64_t hash = 0;
+        for (const auto& [region, delta] : row(font, glyph)) {
+            hash = (hash * 31 + hash_bytes(Reader{ reinterpret_cast<const uint8_t*>(region.data()), region.size() * 2 })) * 31 + delta;
+        }
+        return hash;
+    });
+    if (glyphs.empty()) {
+        report->add(1, "same advance deltas, stored differently");
+        return;
+    }
+    report->add(1, "advance deltas of " + count(glyphs.size(), "glyph") + " differ");
+    list_items(report, 2, options, glyphs, [&](uint32_t glyph) {
+        return format("glyph %u: %s", glyph, describe_rows(row(a, glyph), row(b, glyph), b.axisTags).c_str());
+    });
+}
+
+void diff_mvar(const Font& a, const Font& b, const Options& options, Report* report) {
+    std::map<uint32_t, std::pair<StoreRow, StoreRow>> metrics;
+    for (const Font* font : { &a, &b }) {
+        MvarView table(font->table(kMvarTag));
+        StoreTable store(table.itemVariationStore());
+        for (ValueRecordView record : table.valueRecords()) {
+            StoreRow row = store_row(store.store, store.regions, record.deltaSetOuterIndex(), record.deltaSetInnerIndex());
+            (font == &a ? metrics[record.valueTag()].first : metrics[record.valueTag()].second) = row;
+        }
+    }
+    std::vector<uint32_t> tags;
+    for (const auto& [tag, rows] : metrics) {
+        if (rows.first != rows.second) {
+            tags.push_back(tag);
+        }
+    }
+    if (tags.empty()) {
+        report->add(1, "same metric deltas, stored differently");
+        return;
+    }
+    report->add(1, "deltas of " + count(tags.size(), "metric") + " differ");
+    list_items(report, 2, options, tags, [&](uint32_t tag) {
+        const auto& [rowA, rowB] = metrics[tag];
+        return format("%s: %s", tag_to_string(tag).c_str(), describe_rows(rowA, rowB, b.axisTags).c_str());
+    });
+}
+
+void diff_fvar(const Font& a, const Font& b, const Options& options, Report* report) {
+    std::vector<FvarAxis> axesA = fvar_axes(a.table(kFvarTag)), axesB = fvar_axes(b.table(kFvarTag));
+    std::vector<uint32_t> tags;
+    for (const std::vector<FvarAxis>* axes : { &axesA, &axesB }) {
+        for (const FvarAxis& axis : *axes) {
+            if (std::find(tags.begin(), tags.end(), axis.tag) == tags.end()) {
+                tags.push_back(axis.tag);
+            }
+        }
+    }
+    auto describe = [](const std::vector<FvarAxis>& axes, uint32_t tag) {
+        for (size_t i = 0; i < axes.size(); ++i) {
+            if (axes[i].tag == tag) {
+                return format("axis %zu, %g %g %g", i, axes[i].minimum, axes[i].def, axes[i].maximum);
+            }
+        }
+        return std::string("none");
+    };
+    std::vector<uint32_t> changed;
+    for (uint32_t tag : tags) {
+        if (describe(axesA, tag) != describe(axesB, tag)) {
+            changed.push_back(tag);
+        }
+    }
+    list_items(report, 1, options, changed, [&](uint32_t tag) {
+        return format("%s: %s -> %s", tag_to_string(tag).c_str(), describe(axesA, tag).c_str(), describe(axesB, tag).c_str());
+    });
+    uint16_t instancesA = FvarView(a.table(kFvarTag)).instanceCount(), instancesB = FvarView(b.table(kFvarTag)).instanceCount();
+    if (instancesA != instancesB) {
+        report->add(1, format("instances: %u -> %u", instancesA, instancesB));
+    }
+}
+
+// A name's string as UTF-8: UTF-16BE on the Unicode and Windows platforms, single bytes elsewhere,
+// which is right for ASCII.
+std::string name_string(const Reader& bytes, uint16_t platformID) {
+    std::string string;
+    if (platformID != 0 && platformID != 3) {
+        for (size_t i = 0; i < bytes.length; ++i) {
+            string += char(bytes.data[i]);
+        }
+        return string;
+    }
+    for (size_t i = 0; i + 1 < bytes.length; i += 2) {
+        uint32_t c = bytes.u16(i);
+        if (c >= 0xD800 && c < 0xDC00 && i + 3 < bytes.length) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (bytes.u16(i + 2) - 0xDC00);
+            i += 2;
+        }
+        if (c < 0x80) {
+            string += char(c);
+        } else if (c < 0x800) {
+            string += { char(0xC0 | c >> 6), char(0x80 | (c & 0x3F)) };
+        } else if (c < 0x10000) {
+            string += { char(0xE0 | c >> 12), char(0x80 | (c >> 6 & 0x3F)), char(0x80 | (c & 0x3F)) };
+        } else {
+            string += { char(0xF0 | c >> 18), char(0x80 | (c >> 12 & 0x3F)), char(0x80 | (c >> 6 & 0x3F)), char(0x80 | (c & 0x3F)) };
+        }
+    }
+    return string;
+}
+
+void diff_name(const Font& a, const Font& b, const Options& options, Report* report) {
+    // Records by (platform, encoding, language, name ID), which is how they are sorted.
+    using Key = std::tuple<uint16_t, uint16_t, uint16_t, uint16_t>;
+    std::map<Key, std::pair<std::string, std::string>> names;
+    std::map<Key, std::pair<bool, bool>> present;
+    for (const Font* font : { &a, &b }) {
+        NameView table(font->table(sfnt_tag('n', 'a', 'm', 'e')));
+        for (NameRecordView record : table.nameRecord()) {
+            Key key = { record.platformID(), record.encodingID(), record.languageID(), record.nameID() };
+            std::string string = name_string(table.storage().at(record.stringOffset(), record.length()), record.platformID());
+            (font == &a ? names[key].first : names[key].second) = string;
+            (font == &a ? present[key].first : present[key].second) = true;
+        }
+    }
+    std::vector<Key> keys;
+    for (const auto& [key, strings] : names) {
+        if (strings.first != strings.second || present[key].first != present[key].second) {
+            keys.push_back(key);
+        }
+    }
+    if (keys.empty()) {
+        report->add(1, "same names, stored differently");
+        return;
+    }
+    std::vector<uint32_t> items(keys.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        items[i] = i;
+    }
+    report->add(1, count(keys.size(), "name") + (keys.size() == 1 ? " differs" : " differ"));
+    list_items(report, 2, options, items, [&](uint32_t i) {
+        auto [platformID, encodingID, languageID, nameID] = keys[i];
+        auto [inA, inB] = present[keys[i]];
+        auto quoted = [](bool present, const std::string& string) { return present ? "\"" + string + "\"" : std::string("none"); };
+        return format("name %u (%u, %u, 0x%X): %s -> %s", nameID, platformID, encodingID, languageID,
+                      quoted(inA, names[keys[i]].first).c_str(), quoted(inB, names[keys[i]].second).c_str());
+    });
+}
+
+// The tables compared by their structure; the rest are compared byte by byte.
+void diff_table(uint32_t tag, const Font& a, const Font& b, const Options& options, Report* report) {
+    if (tag == kGlyfTag && !a.glyf.loca.empty() && !b.glyf.loca.empty()) {
+        diff_glyf(a, b, options, report);
+    } else if (tag == kHmtxTag) {
+        diff_hmtx(a, b, options, report);
+    } else if (tag == kGvarTag) {
+        diff_gvar(a, b, options, report);
+    } else if (tag == kHvarTag) {
+        diff_hvar(a, b, options, report);
+    } else if (tag == kMvarTag) {
+        diff_mvar(a, b, options, report);
+    } else if (tag == kFvarTag) {
+        diff_fvar(a, b, options, report);
+    } else if (tag == sfnt_tag('n', 'a', 'm', 'e')) {
+        diff_name(a, b, options, report);
+    } else if (tag == kLocaTag && !a.table(kGlyfTag).empty() && !b.table(kGlyfTag).empty()) {
+        // Offsets follow the glyf entries, which glyf reports.
+        Reader glyfA = a.table(kGlyfTag), glyfB = b.table(kGlyfTag);
+        if (glyfA.length != glyfB.length || memcmp(glyfA.data, glyfB.data, glyfA.length)) {
+            report->add(1, "offsets into glyf, which differs");
+        }
+    }
+    if (report->lines.size() == 1) {
+        diff_bytes(a.table(tag), b.table(tag), options, report);
+    }
+}
+
+void usage(const char* program) {
+    printf("Usage: %s [options] a.ttf b.ttf\n", program);
+    printf("  -j N        threads hashing glyphs (default: one per core)\n");
+    printf("  --limit N   items listed per difference (default: 10)\n");
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    options.jobs = std::max(1u, std::thread::hardware_concurrency());
+    const char* paths[2] = {};
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            options.jobs = std::clamp(atoi(argv[++i]), 1, 256);
+        } else if (!strcmp(argv[i], "--limit") && i + 1 < argc) {
+            options.limit = std::max(atoi(argv[++i]), 0);
+        } else if (argv[i][0] != '-' && !paths[0]) {
+            paths[0] = argv[i];
+        } else if (argv[i][0] != '-' && !paths[1]) {
+            paths[1] = argv[i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!paths[1]) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    Font a, b;
+    if (!load_font(paths[0], &a) || !load_font(paths[1], &b)) {
+        return 2;
+    }
+    std::vector<uint32_t> tags;
+    for (const Font* font : { &a, &b }) {
+        for (const auto& [tag, table] : font->tables) {
+            if (std::find(tags.begin(), tags.end(), tag) == tags.end()) {
+                tags.push_back(tag);
+            }
+        }
+    }
+    std::sort(tags.begin(), tags.end());
+
+    // Whole tables first, in chunks so that one big table doesn't hold up the rest; the few that
+    // differ are then compared one at a time, each on every thread.
+    constexpr size_t kChunk = 1 << 22;
+    std::vector<std::pair<size_t, size_t>> chunks; // table, offset
+    for (size_t i = 0; i < tags.size(); ++i) {
+        Reader tableA = a.table(tags[i]), tableB = b.table(tags[i]);
+        if (tableA.length == tableB.length) {
+            for (size_t offset = 0; offset < tableA.length; offset += kChunk) {
+                chunks.push_back({ i, offset });
+            }
+        }
+    }
+    std::vector<uint8_t> chunkDiffers(chunks.size());
+    parallel_for(options.jobs, chunks.size(), [&](size_t chunk) {
+        auto [i, offset] = chunks[chunk];
+        Reader tableA = a.table(tags[i]).at(offset, kChunk), tableB = b.table(tags[i]).at(offset, kChunk);
+        chunkDiffers[chunk] = memcmp(tableA.data, tableB.data, tableA.length) != 0;
+    });
+    std::vector<bool> same(tags.size());
+    for (size_t i = 0; i < tags.size(); ++i) {
+        same[i] = a.table(tags[i]).length == b.table(tags[i]).length;
+    }
+    for (size_t chunk = 0; chunk < chunks.size(); ++chunk) {
+        if (chunkDiffers[chunk]) {
+            same[chunks[chunk].first] = false;
+        }
+    }
+    size_t differing = 0, added = 0, removed = 0;
+    for (size_t i = 0; i < tags.size(); ++i) {
+        uint32_t tag = tags[i];
+        Reader tableA = a.table(tag), tableB = b.table(tag);
+        bool inA = a.tables.count(tag), inB = b.tables.count(tag);
+        if (!inB) {
+            printf("- %s: %zu bytes\n", tag_to_string(tag).c_str(), tableA.length);
+            ++removed;
+        } else if (!inA) {
+            printf("+ %s: %zu bytes\n", tag_to_string(tag).c_str(), tableB.length);
+            ++added;
+        } else if (!same[i]) {
+            Report report;
+            report.add(0, tableA.length == tableB.length
+                              ? format("~ %s: %zu bytes", tag_to_string(tag).c_str(), tableA.length)
+                              : format("~ %s: %zu -> %zu bytes", tag_to_string(tag).c_str(), tableA.length, tableB.length));
+            diff_table(tag, a, b, options, &report);
+            for (const std::string& line : report.lines) {
+                printf("%s\n", line.c_str());
+            }
+            ++differing;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("%zu of %zu tables differ, %zu added, %zu removed (%.2f s)\n", differing, tags.size() - added - removed, added,
+           removed, seconds);
+    return differing || added || removed ? 1 : 0;
+}
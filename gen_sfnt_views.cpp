@@ -0,0 +1,470 @@
+// Compile with
+// c++ -O2 -std=c++17 gen_sfnt_views.cpp -o gen_sfnt_views
+
+// Generates view classes for OpenType tables from a schema of their fixed layouts (see
+// sfnt.schema for the format), so sfnt.h doesn't hand-write offsets.
+//
+//   gen_sfnt_views sfnt.schema sfnt_views.h
+//
+// Each record becomes a <Name>View holding a Reader. The constructor checks once that the bytes
+// hold the record's fixed fields and otherwise points the view at zeros, so field accessors read
+// straight from memory without a bounds check each, and a damaged table still reads as 0s, the
+// way Reader does. Everything is constexpr.
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct FieldType {
+    const char* name;
+    size_t size;
+    const char* cppType;
+    const char* read;    // sfnt.h function reading one from a pointer
+    const char* element; // sfnt.h type for arrays of them
+};
+
+const FieldType kFieldTypes[] = {
+    { "u8", 1, "uint8_t", "sfnt_u8", "SfntU8" },
+    { "u16", 2, "uint16_t", "sfnt_u16", "SfntU16" },
+    { "u32", 4, "uint32_t", "sfnt_u32", "SfntU32" },
+    { "i8", 1, "int8_t", "sfnt_i8", "SfntI8" },
+    { "i16", 2, "int16_t", "sfnt_i16", "SfntI16" },
+    { "i32", 4, "int32_t", "sfnt_i32", "SfntI32" },
+    { "f2dot14", 2, "double", "sfnt_f2dot14", "SfntF2Dot14" },
+    { "fixed", 4, "double", "sfnt_fixed", "SfntFixed" },
+    { "longdatetime", 8, "int64_t", "sfnt_i64", "SfntI64" },
+    { "tag", 4, "uint32_t", "sfnt_u32", "SfntU32" },
+    { "offset16", 2, "uint16_t", "sfnt_u16", "SfntU16" },
+    { "offset32", 4, "uint32_t", "sfnt_u32", "SfntU32" },
+};
+
+const FieldType* find_field_type(const std::string& name) {
+    for (const FieldType& type : kFieldTypes) {
+        if (name == type.name) {
+            return &type;
+        }
+    }
+    return nullptr;
+}
+
+struct Field {
+    const FieldType* type;
+    std::string name;
+    size_t offset;
+    uint32_t since; // version as major << 16 | minor (or a u16 version), 0 for every version
+    size_t count;   // of an inline array, 0 for one value
+};
+
+// An array, view or bytes member: something found from the fields rather than at a fixed place.
+struct Member {
+    std::string kind;
+    std::string name;
+    std::string type; // record name or field type name; none for bytes
+    std::string at;   // offset field, or empty for right after the fields
+    std::string count;
+    std::string stride;
+    int line;
+};
+
+struct Record {
+    std::string name;
+    bool versioned = false;
+    bool shortVersion = false; // a u16 version rather than majorVersion and minorVersion
+    std::vector<std::string> comment;
+    std::vector<Field> fields;
+    std::vector<Member> members;
+    size_t size = 0;    // of the fields every version has
+    size_t extent = 0;  // of all the fields
+    int line = 0;
+};
+
+struct Schema {
+    const char* path;
+    std::vector<Record> records;
+    std::map<std::string, size_t> byName;
+    bool failed = false;
+
+    void error(int line, const std::string& message) {
+        printf("%s:%d: %s\n", path, line, message.c_str());
+        failed = true;
+    }
+};
+
+std::vector<std::string> split(const std::string& line) {
+    std::vector<std::string> words;
+    std::istringstream stream(line);
+    std::string word;
+    while (stream >> word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+// major.minor, or a plain number for records with a u16 version.
+bool parse_version(const std::string& string, bool shortVersion, uint32_t* version) {
+    unsigned major, minor;
+    char end;
+    if (shortVersion) {
+        if (sscanf(string.c_str(), "%u%c", &major, &end) != 1 || major > 0xffff) {
+            return false;
+        }
+        *version = major;
+        return true;
+    }
+    if (sscanf(string.c_str(), "%u.%u%c", &major, &minor, &end) != 2 || major > 0xffff || minor > 0xffff) {
+        return false;
+    }
+    *version = major << 16 | minor;
+    return true;
+}
+
+// Reads "key value" pairs from words[first] on into member; the rest of the line after count or
+// stride, up to the next key, is an expression.
+bool parse_member_options(const std::vector<std::string>& words, size_t first, Member* member) {
+    std::string* current = nullptr;
+    for (size_t i = first; i < words.size(); ++i) {
+        // A keyword right after count or stride is a field of that name, as in "count count".
+        bool operand = current && current->empty();
+        if (operand) {
+            *current = words[i];
+        } else if (words[i] == "at" && i + 1 < words.size()) {
+            member->at = words[++i];
+            current = nullptr;
+        } else if (words[i] == "count") {
+            current = &member->count;
+        } else if (words[i] == "stride") {
+            current = &member->stride;
+        } else if (current) {
+            *current += (current->empty() ? "" : " ") + words[i];
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+void parse_schema(FILE* file, Schema* schema) {
+    char buffer[1024];
+    int line = 0;
+    std::vector<std::string> comment;
+    Record* record = nullptr;
+    while (fgets(buffer, sizeof(buffer), file)) {
+        ++line;
+        std::string text = buffer;
+        std::vector<std::string> words = split(text);
+        if (words.empty()) {
+            comment.clear();
+            continue;
+        }
+        if (words[0][0] == '#') {
+            size_t hash = text.find('#');
+            std::string rest = text.substr(hash + 1);
+            rest.erase(rest.find_last_not_of(" \r\n") + 1);
+            comment.push_back(rest.empty() || rest[0] != ' ' ? rest : rest.substr(1));
+            continue;
+        }
+
+        if (words[0] == "record") {
+            if (words.size() < 2 || words.size() > 3 || (words.size() == 3 && words[2] != "versioned")) {
+                schema->error(line, "expected: record Name [versioned]");
+                continue;
+            }
+            if (schema->byName.count(words[1])) {
+                schema->error(line, "record " + words[1] + " defined twice");
+            }
+            schema->byName[words[1]] = schema->records.size();
+            schema->records.push_back(Record());
+            record = &schema->records.back();
+            record->name = words[1];
+            record->versioned = words.size() == 3;
+            record->comment = comment;
+            record->line = line;
+            comment.clear();
+            continue;
+        }
+        comment.clear();
+        if (!record) {
+            schema->error(line, "expected a record first");
+            continue;
+        }
+
+        if (words[0] == "array" || words[0] == "view" || words[0] == "bytes") {
+            Member member;
+            member.kind = words[0];
+            member.line = line;
+            size_t options = words[0] == "bytes" ? 2 : 3;
+            if (words.size() < options) {
+                schema->error(line, "expected a name and a type");
+                continue;
+            }
+            member.name = words[1];
+            if (words[0] != "bytes") {
+                member.type = words[2];
+            }
+            if (!parse_member_options(words, options, &member)) {
+                schema->error(line, "expected at, count or stride");
+                continue;
+            }
+            if (member.kind == "array" ? member.count.empty() : member.at.empty() || !member.count.empty() || !member.stride.empty()) {
+                schema->error(line, member.kind == "array" ? "an array needs a count" : "expected: " + member.kind + " name at field");
+                continue;
+            }
+            record->members.push_back(member);
+            continue;
+        }
+
+        const FieldType* type = find_field_type(words[0]);
+        uint32_t since = 0;
+        if (!type || (words.size() != 2 && !(words.size() == 4 && words[2] == "since" &&
+                                             parse_version(words[3], record->shortVersion, &since)))) {
+            schema->error(line, "expected: type name[count] [since version]");
+            continue;
+        }
+        if (since && !record->versioned) {
+            schema->error(line, "since in a record that isn't versioned");
+        }
+        if (!since && record->extent != record->size) {
+            schema->error(line, "fields every version has go before the others");
+        }
+        std::string name = words[1];
+        size_t count = 0;
+        size_t bracket = name.find('[');
+        if (bracket != std::string::npos) {
+            count = strtoul(name.c_str() + bracket + 1, nullptr, 10);
+            name.resize(bracket);
+            if (!count || since || words[1].back() != ']') {
+                schema->error(line, "expected name[count], in fields every version has");
+                continue;
+            }
+        }
+        if (record->fields.empty() && name == "version" && type->size == 2) {
+            record->shortVersion = true;
+        }
+        record->fields.push_back({ type, name, record->extent, since, count });
+        record->extent += type->size * std::max<size_t>(count, 1);
+        if (!since) {
+            record->size = record->extent;
+        }
+    }
+
+    for (const Record& record : schema->records) {
+        bool majorMinor = record.fields.size() >= 2 && record.fields[0].name == "majorVersion" &&
+                          record.fields[1].name == "minorVersion" && record.fields[1].offset == 2;
+        if (record.versioned && !majorMinor && !record.shortVersion) {
+            schema->error(record.line, record.name + " is versioned but doesn't begin with a u16 version, or majorVersion and minorVersion");
+        }
+    }
+}
+
+const Field* find_field(const Record& record, const std::string& name) {
+    for (const Field& field : record.fields) {
+        if (field.name == name) {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+// An expression of fields, numbers, + and * as C++, in size_t so products of u16s don't overflow.
+bool translate_expression(const Record& record, const std::string& expression, std::string* cpp) {
+    cpp->clear();
+    for (size_t i = 0; i < expression.size();) {
+        char c = expression[i];
+        if (c == ' ') {
+            ++i;
+        } else if (c == '+' || c == '*') {
+            *cpp += std::string(" ") + c + " ";
+            ++i;
+        } else if (isdigit(c)) {
+            size_t end = i;
+            while (end < expression.size() && isdigit(expression[end])) {
+                ++end;
+            }
+            *cpp += expression.substr(i, end - i);
+            i = end;
+        } else if (isalpha(c)) {
+            size_t end = i;
+            while (end < expression.size() && isalnum(expression[end])) {
+                ++end;
+            }
+            std::string name = expression.substr(i, end - i);
+            if (!find_field(record, name)) {
+                return false;
+            }
+            *cpp += "size_t(" + name + "())";
+            i = end;
+        } else {
+            return false;
+        }
+    }
+    return !cpp->empty();
+}
+
+// The view type and the element type for arrays of a member's type.
+bool member_type(const Schema& schema, const Member& member, std::string* view, std::string* element) {
+    if (const FieldType* type = find_field_type(member.type)) {
+        *view = type->cppType;
+        *element = type->element;
+        return member.kind == "array";
+    }
+    if (!schema.byName.count(member.type)) {
+        return false;
+    }
+    *view = member.type + "View";
+    *element = *view;
+    return true;
+}
+
+// The bytes a member starts at, as C++.
+bool member_bytes(const Record& record, const Member& member, std::string* cpp) {
+    if (member.at.empty()) {
+        *cpp = "reader.at(kSize)";
+        return true;
+    }
+    const Field* field = find_field(record, member.at);
+    if (!field || strncmp(field->type->name, "offset", 6)) {
+        return false;
+    }
+    *cpp = member.at + "() ? reader.at(" + member.at + "()) : Reader()";
+    return true;
+}
+
+void write_record(FILE* out, Schema* schema, const Record& record) {
+    std::string view = record.name + "View";
+    fprintf(out, "\n");
+    for (const std::string& line : record.comment) {
+        fprintf(out, "//%s%s\n", line.empty() ? "" : " ", line.c_str());
+    }
+    fprintf(out, "struct %s {\n", view.c_str());
+    fprintf(out, "    static constexpr size_t kSize = %zu;\n", record.size);
+    fprintf(out, "    Reader reader;\n\n");
+    fprintf(out, "    constexpr %s() : reader(sfnt_zeros()) {}\n", view.c_str());
+    fprintf(out, "    constexpr explicit %s(const Reader& bytes) : reader(bytes.has(0, kSize) ? bytes : sfnt_zeros()) {}\n",
+            view.c_str());
+    fprintf(out, "    static constexpr %s read(const Reader& bytes) { return %s(bytes); }\n\n", view.c_str(), view.c_str());
+    fprintf(out, "    // Whether the bytes were too short for the record.\n");
+    fprintf(out, "    constexpr bool empty() const { return reader.data == kSfntZeros; }\n");
+    if (record.versioned && !record.shortVersion) {
+        fprintf(out, "    constexpr uint32_t version() const { return sfnt_u32(reader.data); }\n");
+    }
+    fprintf(out, "\n");
+
+    for (const Field& field : record.fields) {
+        if (field.count) {
+            fprintf(out, "    constexpr SfntArray<%s> %s() const { return SfntArray<%s>(reader.at(%zu, %zu), %zu); }\n",
+                    field.type->element, field.name.c_str(), field.type->element, field.offset,
+                    field.count * field.type->size, field.count);
+        } else if (!field.since) {
+            fprintf(out, "    constexpr %s %s() const { return %s(reader.data + %zu); }\n", field.type->cppType,
+                    field.name.c_str(), field.type->read, field.offset);
+        } else {
+            fprintf(out, "    constexpr %s %s() const {\n", field.type->cppType, field.name.c_str());
+            fprintf(out, "        return version() >= 0x%08x && reader.has(%zu, %zu) ? %s(reader.data + %zu) : 0;\n",
+                    field.since, field.offset, field.type->size, field.type->read, field.offset);
+            fprintf(out, "    }\n");
+        }
+    }
+
+    for (const Member& member : record.members) {
+        std::string type, element, bytes;
+        if (member.kind != "bytes" && !member_type(*schema, member, &type, &element)) {
+            schema->error(member.line, "unknown record " + member.type);
+            continue;
+        }
+        if (!member_bytes(record, member, &bytes)) {
+            schema->error(member.line, member.at + " isn't an offset field of " + record.name);
+            continue;
+        }
+        if (member.kind == "bytes") {
+            fprintf(out, "    constexpr Reader %s() const { return %s; }\n", member.name.c_str(), bytes.c_str());
+        } else if (member.kind == "view") {
+            fprintf(out, "    constexpr %s %s() const { return %s(%s); }\n", type.c_str(), member.name.c_str(), type.c_str(),
+                    bytes.c_str());
+        } else {
+            std::string count, stride;
+            if (!translate_expression(record, member.count, &count) ||
+                (!member.stride.empty() && !translate_expression(record, member.stride, &stride))) {
+                schema->error(member.line, "bad count or stride; expected fields of " + record.name + ", numbers, + and *");
+                continue;
+            }
+            fprintf(out, "    constexpr SfntArray<%s> %s() const {\n", element.c_str(), member.name.c_str());
+            fprintf(out, "        return SfntArray<%s>(%s, %s%s%s);\n", element.c_str(), bytes.c_str(), count.c_str(),
+                    stride.empty() ? "" : ", ", stride.c_str());
+            fprintf(out, "    }\n");
+        }
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "static_assert(%s::kSize <= sizeof(kSfntZeros));\n", view.c_str());
+}
+
+// Records go out after the ones their members refer to.
+void write_in_order(FILE* out, Schema* schema, size_t index, std::vector<int>* state) {
+    const Record& record = schema->records[index];
+    if ((*state)[index] == 2) {
+        return;
+    }
+    if ((*state)[index] == 1) {
+        schema->error(record.line, record.name + " contains itself");
+        return;
+    }
+    (*state)[index] = 1;
+    for (const Member& member : record.members) {
+        auto it = schema->byName.find(member.type);
+        if (it != schema->byName.end()) {
+            write_in_order(out, schema, it->second, state);
+        }
+    }
+    (*state)[index] = 2;
+    write_record(out, schema, record);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        printf("usage: %s schema output.h\n", argv[0]);
+        return 1;
+    }
+    FILE* file = fopen(argv[1], "r");
+    if (!file) {
+        printf("Could not open: %s\n", argv[1]);
+        return 1;
+    }
+    Schema schema;
+    schema.path = argv[1];
+    parse_schema(file, &schema);
+    fclose(file);
+    if (schema.failed) {
+        return 1;
+    }
+
+    // Written to a string first so a schema error doesn't leave half a header behind.
+    char* text = nullptr;
+    size_t length = 0;
+    FILE* out = open_memstream(&text, &length);
+    fprintf(out, "// Generated by gen_sfnt_views from %s; edit that instead. Included by sfnt.h, after Reader\n",
+            strrchr(argv[1], '/') ? strrchr(argv[1], '/') + 1 : argv[1]);
+    fprintf(out, "// and the Sfnt* field types.\n\n");
+    fprintf(out, "#pragma once\n");
+    std::vector<int> state(schema.records.size());
+    for (size_t i = 0; i < schema.records.size(); ++i) {
+        write_in_order(out, &schema, i, &state);
+    }
+    fclose(out);
+    if (!schema.failed) {
+        FILE* header = fopen(argv[2], "w");
+        if (!header) {
+            printf("Could not open: %s\n", argv[2]);
+        } else {
+            fwrite(text, 1, length, header);
+            fclose(header);
+        }
+        schema.failed = !header;
+    }
+    free(text);
+    return schema.failed ? 1 : 0;
+}
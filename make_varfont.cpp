@@ -0,0 +1,1042 @@
+// Compile with
+// c++ -O2 -std=c++17 make_varfont.cpp -o make_varfont -pthread
+
+// Writes synthetic variable TrueType fonts, so the variation tests and benchmarks have fixtures on
+// machines without /System/Library/Fonts/SFNS.ttf. Everything about the font is configurable and
+// the output depends only on the options and the seed.
+//
+//   make_varfont [options] out.ttf
+//
+// The font has glyf outlines made of regular polygons, an fvar with the requested axes (wght, wdth
+// and opsz have SFNS-like ranges), avar maps, gvar and HVAR deltas over a shared set of variation
+// regions, MVAR, STAT and named instances. With --static it has none of the variation tables, for
+// a static font with the same outlines.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sfnt_writer.h"
+
+uint32_t constexpr make_tag(char a, char b, char c, char d) {
+    return (((uint32_t)a << 24) | ((uint32_t)b << 16) | ((uint32_t)c << 8) | (uint32_t)d);
+}
+
+uint32_t string_to_tag(const std::string& string) {
+    char buffer[4] = { ' ', ' ', ' ', ' ' };
+    memcpy(buffer, string.data(), std::min<size_t>(string.size(), 4));
+    return make_tag(buffer[0], buffer[1], buffer[2], buffer[3]);
+}
+
+struct Axis {
+    uint32_t tag;
+    double minimum;
+    double def;
+    double maximum;
+    const char* name;
+};
+
+// Ranges follow SFNS where it has the axis.
+const Axis kKnownAxes[] = {
+    { make_tag('w', 'g', 'h', 't'), 1, 400, 1000, "Weight" },
+    { make_tag('w', 'd', 't', 'h'), 30, 100, 150, "Width" },
+    { make_tag('o', 'p', 's', 'z'), 17, 17, 96, "Optical Size" },
+    { make_tag('s', 'l', 'n', 't'), -15, 0, 0, "Slant" },
+    { make_tag('i', 't', 'a', 'l'), 0, 0, 1, "Italic" },
+    { make_tag('G', 'R', 'A', 'D'), -200, 0, 150, "Grade" },
+};
+
+struct Options {
+    std::vector<Axis> axes;
+    uint32_t glyphCount = 256;
+    uint32_t contours = 2;
+    uint32_t pointsPerContour = 8;
+    uint32_t regionCount = 0; // 0: one region per axis direction
+    double gvarDensity = 1;
+    double hvarDensity = 1;
+    uint32_t mvarRecords = 4;
+    uint32_t instanceCount = 9;
+    bool avar = true;
+    bool isStatic = false; // leave out the variation tables
+    uint64_t seed = 1;
+    const char* outputPath = nullptr;
+};
+
+std::vector<std::string> split(const char* list) {
+    std::vector<std::string> parts;
+    std::string part;
+    for (const char* c = list; ; ++c) {
+        if (*c == ',' || !*c) {
+            parts.push_back(part);
+            part.clear();
+            if (!*c) {
+                break;
+            }
+        } else {
+            part += *c;
+        }
+    }
+    return parts;
+}
+
+// --axes takes either a count, which picks that many of the known axes followed by private ones,
+// or a comma separated list of tags.
+std::vector<Axis> parse_axes(const char* spec) {
+    std::vector<Axis> axes;
+    if (isdigit(spec[0])) {
+        int count = std::clamp(atoi(spec), 1, 64);
+        for (int i = 0; i < count; ++i) {
+            if (i < static_cast<int>(std::size(kKnownAxes))) {
+                axes.push_back(kKnownAxes[i]);
+            } else {
+                char tag[5];
+                snprintf(tag, sizeof(tag), "X%03d", i);
+                axes.push_back({ string_to_tag(tag), -100, 0, 100, nullptr });
+            }
+        }
+        return axes;
+    }
+    for (const std::string& name : split(spec)) {
+        uint32_t tag = string_to_tag(name);
+        auto known = std::find_if(std::begin(kKnownAxes), std::end(kKnownAxes), [&](const Axis& a) { return a.tag == tag; });
+        axes.push_back(known != std::end(kKnownAxes) ? *known : Axis{ tag, -100, 0, 100, nullptr });
+    }
+    return axes;
+}
+
+// A variation region, in normalized coordinates, per axis.
+struct Region {
+    std::vector<double> start, peak, end;
+};
+
+struct Point {
+    int16_t x, y;
+    bool onCurve;
+};
+
+struct Glyph {
+    std::vector<Point> points;
+    std::vector<uint16_t> endPoints;
+    uint16_t advance;
+    int16_t xMin, yMin, xMax, yMax;
+};
+
+// A glyph's deltas for one region, for every outline point followed by the four phantom points.
+struct GlyphTuple {
+    uint16_t region;
+    std::vector<int16_t> dx, dy;
+};
+
+struct Font {
+    Options options;
+    std::vector<Region> regions;
+    std::vector<Glyph> glyphs;
+    std::vector<std::vector<GlyphTuple>> glyphTuples;     // per glyph
+    std::vector<std::vector<int16_t>> advanceDeltas;      // per glyph, per region; empty when the glyph has none
+    std::vector<std::pair<uint16_t, std::string>> names;
+    uint16_t firstAxisNameID;
+    uint16_t firstInstanceNameID;
+};
+
+std::vector<Region> make_regions(const Options& options, std::mt19937_64& rng) {
+    size_t axisCount = options.axes.size();
+    std::vector<Region> regions;
+    auto single = [&](size_t axis, double start, double peak, double end) {
+        Region region = { std::vector<double>(axisCount), std::vector<double>(axisCount), std::vector<double>(axisCount) };
+        region.start[axis] = start;
+        region.peak[axis] = peak;
+        region.end[axis] = end;
+        return region;
+    };
+    // The masters a designer would draw: each extreme of each axis.
+    for (size_t axis = 0; axis < axisCount; ++axis) {
+        if (options.axes[axis].maximum > options.axes[axis].def) {
+            regions.push_back(single(axis, 0, 1, 1));
+        }
+        if (options.axes[axis].minimum < options.axes[axis].def) {
+            regions.push_back(single(axis, -1, -1, 0));
+        }
+    }
+    if (options.regionCount && options.regionCount < regions.size()) {
+        regions.resize(options.regionCount);
+    }
+    // Then intermediate masters and corners where two or three axes interact.
+    std::uniform_int_distribution<size_t> pickAxis(0, axisCount - 1);
+    while (regions.size() < options.regionCount) {
+        Region region = { std::vector<double>(axisCount), std::vector<double>(axisCount), std::vector<double>(axisCount) };
+        size_t involved = 1 + rng() % std::min<size_t>(3, axisCount);
+        for (size_t i = 0; i < involved; ++i) {
+            size_t axis = pickAxis(rng);
+            bool negative = options.axes[axis].minimum < options.axes[axis].def &&
+                            (options.axes[axis].maximum == options.axes[axis].def || rng() & 1);
+            double peak = (1 + rng() % 4) / 4.0;
+            if (negative) {
+                region.start[axis] = -1;
+                region.peak[axis] = -peak;
+                region.end[axis] = 0;
+            } else {
+                region.start[axis] = 0;
+                region.peak[axis] = peak;
+                region.end[axis] = 1;
+            }
+        }
+        regions.push_back(region);
+    }
+    return regions;
+}
+
+Glyph make_glyph(const Options& options, uint32_t glyphID, std::mt19937_64& rng) {
+    Glyph glyph;
+    if (glyphID == 0) {
+        // .notdef is a plain box.
+        glyph.points = { { 50, 0, true }, { 50, 700, true }, { 450, 700, true }, { 450, 0, true } };
+        glyph.endPoints = { 3 };
+        glyph.advance = 500;
+    } else {
+        std::uniform_int_distribution<int> radius(40, 160);
+        std::uniform_int_distribution<int> center(180, 520);
+        glyph.advance = 400 + rng() % 400;
+        uint32_t pointCount = std::max<uint32_t>(options.pointsPerContour, 3);
+        for (uint32_t contour = 0; contour < options.contours; ++contour) {
+            int cx = center(rng) * glyph.advance / 700, cy = center(rng), r = radius(rng);
+            for (uint32_t i = 0; i < pointCount; ++i) {
+                // Alternate on- and off-curve points, the off-curve ones pushed outwards.
+                bool onCurve = i % 2 == 0;
+                double angle = 2 * M_PI * i / pointCount;
+                double scale = onCurve ? 1.0 : 1.2;
+                glyph.points.push_back({ static_cast<int16_t>(cx + std::lround(r * scale * std::cos(angle))),
+                                         static_cast<int16_t>(cy + std::lround(r * scale * std::sin(angle))),
+                                         onCurve });
+            }
+            glyph.endPoints.push_back(glyph.points.size() - 1);
+        }
+    }
+    glyph.xMin = glyph.yMin = INT16_MAX;
+    glyph.xMax = glyph.yMax = INT16_MIN;
+    for (const Point& point : glyph.points) {
+        glyph.xMin = std::min(glyph.xMin, point.x);
+        glyph.yMin = std::min(glyph.yMin, point.y);
+        glyph.xMax = std::max(glyph.xMax, point.x);
+        glyph.yMax = std::max(glyph.yMax, point.y);
+    }
+    return glyph;
+}
+
+// How much a region moves a glyph: heavier strokes, wider glyphs, and a shear for anything else.
+void make_glyph_variations(Font& font, uint32_t glyphID, std::mt19937_64& rng) {
+    const Options& options = font.options;
+    const Glyph& glyph = font.glyphs[glyphID];
+    std::uniform_real_distribution<double> unit(0, 1);
+    font.glyphTuples[glyphID].clear();
+
+    bool hasAdvanceDeltas = glyphID != 0 && unit(rng) < options.hvarDensity;
+    std::vector<int16_t> advanceDeltas(font.regions.size());
+    for (size_t region = 0; region < font.regions.size() && hasAdvanceDeltas; ++region) {
+        advanceDeltas[region] = static_cast<int16_t>(std::uniform_int_distribution<int>(-120, 120)(rng));
+    }
+    if (hasAdvanceDeltas) {
+        font.advanceDeltas[glyphID] = advanceDeltas;
+    }
+
+    if (glyphID == 0) {
+        return;
+    }
+    for (size_t region = 0; region < font.regions.size(); ++region) {
+        // A glyph whose advance varies in this region needs a tuple for the phantom points even
+        // when its outline doesn't move, so that gvar and HVAR agree.
+        bool movesOutline = unit(rng) < options.gvarDensity;
+        int16_t advanceDelta = hasAdvanceDeltas ? advanceDeltas[region] : 0;
+        if (!movesOutline && !advanceDelta) {
+            continue;
+        }
+        double grow = movesOutline ? std::uniform_real_distribution<double>(-0.15, 0.25)(rng) : 0;
+        double shear = movesOutline ? std::uniform_real_distribution<double>(-0.2, 0.2)(rng) : 0;
+        GlyphTuple tuple;
+        tuple.region = region;
+        double cx = (glyph.xMin + glyph.xMax) / 2.0, cy = (glyph.yMin + glyph.yMax) / 2.0;
+        for (const Point& point : glyph.points) {
+            tuple.dx.push_back(static_cast<int16_t>(std::lround((point.x - cx) * grow + (point.y - cy) * shear)));
+            tuple.dy.push_back(static_cast<int16_t>(std::lround((point.y - cy) * grow)));
+        }
+        // Phantom points: left side bearing, advance, top, bottom.
+        tuple.dx.insert(tuple.dx.end(), { 0, advanceDelta, 0, 0 });
+        tuple.dy.insert(tuple.dy.end(), { 0, 0, 0, 0 });
+        font.glyphTuples[glyphID].push_back(std::move(tuple));
+    }
+}
+
+uint16_t add_name(Font& font, uint16_t nameID, const std::string& name) {
+    font.names.push_back({ nameID, name });
+    return nameID;
+}
+
+Font make_font(const Options& options) {
+    Font font;
+    font.options = options;
+    std::mt19937_64 rng(options.seed);
+
+    font.regions = make_regions(options, rng);
+    font.glyphTuples.resize(options.glyphCount);
+    font.advanceDeltas.resize(options.glyphCount);
+    for (uint32_t glyphID = 0; glyphID < options.glyphCount; ++glyphID) {
+        font.glyphs.push_back(make_glyph(options, glyphID, rng));
+        make_glyph_variations(font, glyphID, rng);
+    }
+
+    add_name(font, 1, "Synthetic Variable");
+    add_name(font, 2, "Regular");
+    add_name(font, 3, "Synthetic Variable " + std::to_string(options.seed));
+    add_name(font, 4, "Synthetic Variable Regular");
+    add_name(font, 5, "Version 1.000");
+    add_name(font, 6, "SyntheticVariable-Regular");
+    uint16_t nameID = 256;
+    font.firstAxisNameID = nameID;
+    for (const Axis& axis : options.axes) {
+        char tag[5] = { char(axis.tag >> 24), char(axis.tag >> 16), char(axis.tag >> 8), char(axis.tag), 0 };
+        add_name(font, nameID++, axis.name ? axis.name : tag);
+    }
+    font.firstInstanceNameID = nameID;
+    for (uint32_t i = 0; i < options.instanceCount; ++i) {
+        add_name(font, nameID++, "Instance " + std::to_string(i + 1));
+    }
+    return font;
+}
+
+// Instances step along the first axis, all others at their default.
+std::vector<double> instance_coordinates(const Options& options, uint32_t instance) {
+    std::vector<double> coordinates;
+    for (const Axis& axis : options.axes) {
+        coordinates.push_back(axis.def);
+    }
+    const Axis& first = options.axes[0];
+    double t = options.instanceCount > 1 ? double(instance) / (options.instanceCount - 1) : 0;
+    coordinates[0] = first.minimum + t * (first.maximum - first.minimum);
+    return coordinates;
+}
+
+// Packed point deltas: runs of up to 64, as words when any value needs it, or as zeros.
+void write_packed_deltas(Writer& w, const std::vector<int16_t>& deltas) {
+    size_t i = 0;
+    while (i < deltas.size()) {
+        size_t run = 0;
+        if (deltas[i] == 0) {
+            while (i + run < deltas.size() && run < 64 && deltas[i + run] == 0) {
+                ++run;
+            }
+            w.u8(0x80 | (run - 1));
+        } else {
+            bool words = false;
+            while (i + run < deltas.size() && run < 64 && deltas[i + run] != 0) {
+                words |= deltas[i + run] < -128 || deltas[i + run] > 127;
+                ++run;
+            }
+            w.u8((words ? 0x40 : 0) | (run - 1));
+            for (size_t j = i; j < i + run; ++j) {
+                if (words) {
+                    w.i16(deltas[j]);
+                } else {
+                    w.u8(static_cast<uint8_t>(static_cast<int8_t>(deltas[j])));
+                }
+            }
+        }
+        i += run;
+    }
+}
+
+std::vector<uint8_t> build_glyf(const Font& font, std::vector<uint32_t>* offsets) {
+    Writer w;
+    for (const Glyph& glyph : font.glyphs) {
+        offsets->push_back(w.size());
+        w.i16(glyph.endPoints.size());
+        w.i16(glyph.xMin);
+        w.i16(glyph.yMin);
+        w.i16(glyph.xMax);
+        w.i16(glyph.yMax);
+        for (uint16_t end : glyph.endPoints) {
+            w.u16(end);
+        }
+        w.u16(0); // instructionLength
+        for (const Point& point : glyph.points) {
+            w.u8(point.onCurve ? 0x01 : 0x00);
+        }
+        int16_t last = 0;
+        for (const Point& point : glyph.points) {
+            w.i16(point.x - last);
+            last = point.x;
+        }
+        last = 0;
+        for (const Point& point : glyph.points) {
+            w.i16(point.y - last);
+            last = point.y;
+        }
+        w.pad(4);
+    }
+    offsets->push_back(w.size());
+    return w.data;
+}
+
+std::vector<uint8_t> build_loca(const std::vector<uint32_t>& offsets) {
+    Writer w;
+    for (uint32_t offset : offsets) {
+        w.u32(offset);
+    }
+    return w.data;
+}
+
+std::vector<uint8_t> build_head(const Font& font) {
+    Writer w;
+    int16_t xMin = INT16_MAX, yMin = INT16_MAX, xMax = INT16_MIN, yMax = INT16_MIN;
+    for (const Glyph& glyph : font.glyphs) {
+        xMin = std::min(xMin, glyph.xMin);
+        yMin = std::min(yMin, glyph.yMin);
+        xMax = std::max(xMax, glyph.xMax);
+        yMax = std::max(yMax, glyph.yMax);
+    }
+    w.u16(1); w.u16(0);         // version
+    w.fixed(1);                 // fontRevision
+    w.u32(0);                   // checksumAdjustment, patched once the font is assembled
+    w.u32(0x5F0F3CF5);          // magicNumber
+    w.u16(0x000B);              // flags
+    w.u16(1000);                // unitsPerEm
+    w.u32(0); w.u32(3692304000);    // created: 2021-01-01, fixed so the output is reproducible
+    w.u32(0); w.u32(3692304000);    // modified
+    w.i16(xMin); w.i16(yMin); w.i16(xMax); w.i16(yMax);
+    w.u16(0);                   // macStyle
+    w.u16(8);                   // lowestRecPPEM
+    w.i16(2);                   // fontDirectionHint
+    w.i16(1);                   // indexToLocFormat: long offsets
+    w.i16(0);                   // glyphDataFormat
+    return w.data;
+}
+
+std::vector<uint8_t> build_hhea(const Font& font) {
+    Writer w;
+    uint16_t advanceMax = 0;
+    int16_t minLsb = INT16_MAX, minRsb = INT16_MAX, xMaxExtent = INT16_MIN;
+    for (const Glyph& glyph : font.glyphs) {
+        advanceMax = std::max(advanceMax, glyph.advance);
+        minLsb = std::min(minLsb, glyph.xMin);
+        minRsb = std::min<int16_t>(minRsb, glyph.advance - glyph.xMax);
+        xMaxExtent = std::max(xMaxExtent, glyph.xMax);
+    }
+    w.u16(1); w.u16(0);
+    w.i16(800);                 // ascender
+    w.i16(-200);                // descender
+    w.i16(0);                   // lineGap
+    w.u16(advanceMax);
+    w.i16(minLsb);
+    w.i16(minRsb);
+    w.i16(xMaxExtent);
+    w.i16(1); w.i16(0);         // caretSlopeRise, caretSlopeRun
+    w.i16(0);                   // caretOffset
+    for (int i = 0; i < 4; ++i) {
+        w.i16(0);               // reserved
+    }
+    w.i16(0);                   // metricDataFormat
+    w.u16(font.glyphs.size());  // numberOfHMetrics
+    return w.data;
+}
+
+std::vector<uint8_t> build_hmtx(const Font& font) {
+    Writer w;
+    for (const Glyph& glyph : font.glyphs) {
+        w.u16(glyph.advance);
+        w.i16(glyph.xMin);
+    }
+    return w.data;
+}
+
+std::vector<uint8_t> build_maxp(const Font& font) {
+    Writer w;
+    uint16_t maxPoints = 0, maxContours = 0;
+    for (const Glyph& glyph : font.glyphs) {
+        maxPoints = std::max<uint16_t>(maxPoints, glyph.points.size());
+        maxContours = std::max<uint16_t>(maxContours, glyph.endPoints.size());
+    }
+    w.u32(0x00010000);
+    w.u16(font.glyphs.size());
+    w.u16(maxPoints);
+    w.u16(maxContours);
+    w.u16(0); w.u16(0);         // maxCompositePoints, maxCompositeContours
+    w.u16(2);                   // maxZones
+    w.u16(0); w.u16(0); w.u16(0); w.u16(0); w.u16(0);
+    w.u16(0); w.u16(0); w.u16(0);
+    return w.data;
+}
+
+// Glyph i (after .notdef) maps to the i-th code point from U+0020, skipping the surrogates.
+std::vector<std::pair<uint32_t, uint32_t>> cmap_ranges(const Font& font) {
+    std::vector<std::pair<uint32_t, uint32_t>> ranges; // first code point, first glyph
+    uint32_t mapped = font.glyphs.size() - 1;
+    const std::pair<uint32_t, uint32_t> blocks[] = { { 0x20, 0xD7FF }, { 0xE000, 0xFFFD }, { 0x10000, 0x10FFFF } };
+    uint32_t glyph = 1;
+    for (const auto& [first, last] : blocks) {
+        if (!mapped) {
+            break;
+        }
+        uint32_t count = std::min(mapped, last - first + 1);
+        ranges.push_back({ first, glyph });
+        ranges.push_back({ first + count - 1, glyph + count - 1 });
+        glyph += count;
+        mapped -= count;
+    }
+    return ranges;
+}
+
+std::vector<uint8_t> build_cmap(const Font& font) {
+    auto ranges = cmap_ranges(font);
+    Writer w;
+    w.u16(0);                   // version
+    w.u16(2);                   // numTables
+    w.u16(3); w.u16(1); w.u32(20);
+    w.u16(3); w.u16(10);
+    size_t format12Offset = w.size();
+    w.u32(0);
+
+    // Format 4 for the BMP part, one delta-mapped segment plus the required final one.
+    uint16_t first = 0, last = 0, delta = 0;
+    bool bmp = !ranges.empty() && ranges[0].first <= 0xFFFF;
+    if (bmp) {
+        first = ranges[0].first;
+        last = ranges[1].first;
+        delta = static_cast<uint16_t>(ranges[0].second - first);
+    }
+    uint16_t segments = bmp ? 2 : 1;
+    w.u16(4);
+    w.u16(16 + segments * 8);   // length
+    w.u16(0);                   // language
+    w.u16(segments * 2);
+    uint16_t searchRange = 2;
+    uint16_t entrySelector = 0;
+    while (searchRange * 2 <= segments * 2) {
+        searchRange *= 2;
+        ++entrySelector;
+    }
+    w.u16(searchRange);
+    w.u16(entrySelector);
+    w.u16(segments * 2 - searchRange);
+    if (bmp) {
+        w.u16(last);
+    }
+    w.u16(0xFFFF);
+    w.u16(0);                   // reservedPad
+    if (bmp) {
+        w.u16(first);
+    }
+    w.u16(0xFFFF);
+    if (bmp) {
+        w.u16(delta);
+    }
+    w.u16(1);
+    if (bmp) {
+        w.u16(0);
+    }
+    w.u16(0);
+
+    w.patch32(format12Offset, w.size());
+    w.u16(12);
+    w.u16(0);
+    w.u32(16 + ranges.size() / 2 * 12);
+    w.u32(0);
+    w.u32(ranges.size() / 2);
+    for (size_t i = 0; i < ranges.size(); i += 2) {
+        w.u32(ranges[i].first);
+        w.u32(ranges[i + 1].first);
+        w.u32(ranges[i].second);
+    }
+    return w.data;
+}
+
+std::vector<uint8_t> build_os2(const Font& font) {
+    Writer w;
+    uint32_t total = 0;
+    for (const Glyph& glyph : font.glyphs) {
+        total += glyph.advance;
+    }
+    auto ranges = cmap_ranges(font);
+    w.u16(4);                               // version
+    w.i16(total / font.glyphs.size());      // xAvgCharWidth
+    w.u16(400);                             // usWeightClass
+    w.u16(5);                               // usWidthClass
+    w.u16(0);                               // fsType
+    w.i16(650); w.i16(600); w.i16(0); w.i16(75);    // subscript size, offset
+    w.i16(650); w.i16(600); w.i16(0); w.i16(350);   // superscript size, offset
+    w.i16(50);                              // yStrikeoutSize
+    w.i16(300);                             // yStrikeoutPosition
+    w.i16(0);                               // sFamilyClass
+    for (int i = 0; i < 10; ++i) {
+        w.u8(0);                            // panose
+    }
+    w.u32(1); w.u32(0); w.u32(0); w.u32(0); // ulUnicodeRange
+    w.tag(make_tag('N', 'O', 'N', 'E'));    // achVendID
+    w.u16(0x40);                            // fsSelection: REGULAR
+    w.u16(ranges.empty() ? 0 : ranges.front().first);
+    w.u16(ranges.empty() ? 0 : std::min<uint32_t>(ranges.back().first, 0xFFFF));
+    w.i16(800);                             // sTypoAscender
+    w.i16(-200);                            // sTypoDescender
+    w.i16(0);                               // sTypoLineGap
+    w.u16(800);                             // usWinAscent
+    w.u16(200);                             // usWinDescent
+    w.u32(1); w.u32(0);                     // ulCodePageRange
+    w.i16(500);                             // sxHeight
+    w.i16(700);                             // sCapHeight
+    w.u16(0);                               // usDefaultChar
+    w.u16(0x20);                            // usBreakChar
+    w.u16(1);                               // usMaxContext
+    return w.data;
+}
+
+std::vector<uint8_t> build_post() {
+    Writer w;
+    w.u32(0x00030000);
+    w.fixed(0);                 // italicAngle
+    w.i16(-100);                // underlinePosition
+    w.i16(50);                  // underlineThickness
+    w.u32(0);                   // isFixedPitch
+    w.u32(0); w.u32(0); w.u32(0); w.u32(0);
+    return w.data;
+}
+
+std::vector<uint8_t> build_name(const Font& font) {
+    Writer w;
+    std::vector<std::pair<uint16_t, std::string>> names = font.names;
+    std::sort(names.begin(), names.end());
+    w.u16(0);
+    w.u16(names.size());
+    w.u16(6 + names.size() * 12);
+    Writer strings;
+    for (const auto& [nameID, name] : names) {
+        w.u16(3); w.u16(1); w.u16(0x409);
+        w.u16(nameID);
+        w.u16(name.size() * 2);
+        w.u16(strings.size());
+        for (char c : name) {
+            strings.u16(static_cast<uint8_t>(c));
+        }
+    }
+    w.bytes(strings.data);
+    return w.data;
+}
+
+std::vector<uint8_t> build_fvar(const Font& font) {
+    const Options& options = font.options;
+    Writer w;
+    w.u16(1); w.u16(0);
+    w.u16(16);                          // axesArrayOffset
+    w.u16(2);                           // reserved
+    w.u16(options.axes.size());
+    w.u16(20);                          // axisSize
+    w.u16(options.instanceCount);
+    w.u16(4 + 4 * options.axes.size()); // instanceSize
+    for (size_t i = 0; i < options.axes.size(); ++i) {
+        const Axis& axis = options.axes[i];
+        w.tag(axis.tag);
+        w.fixed(axis.minimum);
+        w.fixed(axis.def);
+        w.fixed(axis.maximum);
+        w.u16(0);
+        w.u16(font.firstAxisNameID + i);
+    }
+    for (uint32_t i = 0; i < options.instanceCount; ++i) {
+        w.u16(font.firstInstanceNameID + i);
+        w.u16(0);
+        for (double coordinate : instance_coordinates(options, i)) {
+            w.fixed(coordinate);
+        }
+    }
+    return w.data;
+}
+
+// Bends each axis so that the halfway points land off center, like a real weight axis does.
+std::vector<uint8_t> build_avar(const Font& font, std::mt19937_64& rng) {
+    Writer w;
+    w.u16(1); w.u16(0);
+    w.u16(0);                           // reserved
+    w.u16(font.options.axes.size());
+    std::uniform_real_distribution<double> bend(-0.15, 0.15);
+    for (size_t i = 0; i < font.options.axes.size(); ++i) {
+        w.u16(5);
+        double map[5][2] = { { -1, -1 }, { -0.5, -0.5 + bend(rng) }, { 0, 0 }, { 0.5, 0.5 + bend(rng) }, { 1, 1 } };
+        for (const auto& pair : map) {
+            w.f2dot14(pair[0]);
+            w.f2dot14(pair[1]);
+        }
+    }
+    return w.data;
+}
+
+// gvar numbers shared tuples and counts a glyph's tuples in 12 bits, and reaches the data past its
+// tuple headers through a 16-bit offset.
+constexpr size_t kMaxGvarRegions = 0x0FFF;
+constexpr size_t kMaxGvarHeaderBytes = 0xFFFF - 4;
+
+// Empty if a glyph's tuple headers don't fit in the offset to its data.
+std::vector<uint8_t> build_gvar(const Font& font) {
+    const Options& options = font.options;
+    Writer w;
+    w.u16(1); w.u16(0);
+    w.u16(options.axes.size());
+    w.u16(font.regions.size());             // sharedTupleCount
+    size_t sharedTuplesOffset = w.size();
+    w.u32(0);
+    w.u16(font.glyphs.size());
+    w.u16(1);                               // flags: long offsets
+    size_t dataArrayOffset = w.size();
+    w.u32(0);
+    size_t offsetsStart = w.size();
+    for (size_t i = 0; i <= font.glyphs.size(); ++i) {
+        w.u32(0);
+    }
+
+    w.patch32(sharedTuplesOffset, w.size());
+    for (const Region& region : font.regions) {
+        for (double peak : region.peak) {
+            w.f2dot14(peak);
+        }
+    }
+
+    w.pad(4);
+    size_t dataStart = w.size();
+    w.patch32(dataArrayOffset, dataStart);
+    for (size_t glyphID = 0; glyphID < font.glyphs.size(); ++glyphID) {
+        w.patch32(offsetsStart + glyphID * 4, w.size() - dataStart);
+        const std::vector<GlyphTuple>& tuples = font.glyphTuples[glyphID];
+        if (tuples.empty()) {
+            continue;
+        }
+        // Every tuple uses the shared point numbers, which say "all points".
+        Writer serialized;
+        serialized.u8(0);
+        std::vector<uint16_t> sizes;
+        for (const GlyphTuple& tuple : tuples) {
+            size_t before = serialized.size();
+            write_packed_deltas(serialized, tuple.dx);
+            write_packed_deltas(serialized, tuple.dy);
+            sizes.push_back(serialized.size() - before);
+        }
+
+        // Regions that are more than a plain peak need their intermediate start and end written out.
+        Writer headers;
+        for (size_t i = 0; i < tuples.size(); ++i) {
+            const Region& region = font.regions[tuples[i].region];
+            bool intermediate = false;
+            for (size_t axis = 0; axis < options.axes.size(); ++axis) {
+                double peak = region.peak[axis];
+                intermediate |= region.start[axis] != std::min(peak, 0.0) || region.end[axis] != std::max(peak, 0.0);
+            }
+            headers.u16(sizes[i]);
+            headers.u16(tuples[i].region | (intermediate ? 0x4000 : 0));
+            if (intermediate) {
+                for (double start : region.start) {
+                    headers.f2dot14(start);
+                }
+                for (double end : region.end) {
+                    headers.f2dot14(end);
+                }
+            }
+        }
+        if (headers.size() > kMaxGvarHeaderBytes) {
+            printf("gvar: the tuple headers of glyph %zu take %zu bytes, more than a 16-bit offset reaches\n",
+                   glyphID, headers.size());
+            return {};
+        }
+        w.u16(0x8000 | tuples.size());      // SHARED_POINT_NUMBERS
+        w.u16(4 + headers.size());          // dataOffset
+        w.bytes(headers.data);
+        w.bytes(serialized.data);
+        w.pad(2);
+    }
+    w.patch32(offsetsStart + font.glyphs.size() * 4, w.size() - dataStart);
+    return w.data;
+}
+
+// One ItemVariationData over every region, with all deltas as words.
+void write_item_variation_store(Writer& w, const Font& font, const std::vector<std::vector<int16_t>>& rows) {
+    size_t start = w.size();
+    w.u16(1);                               // format
+    size_t regionListOffset = w.size();
+    w.u32(0);
+    w.u16(1);                               // itemVariationDataCount
+    size_t dataOffset = w.size();
+    w.u32(0);
+
+    w.patch32(regionListOffset, w.size() - start);
+    w.u16(font.options.axes.size());
+    w.u16(font.regions.size());
+    for (const Region& region : font.regions) {
+        for (size_t axis = 0; axis < font.options.axes.size(); ++axis) {
+            w.f2dot14(region.start[axis]);
+            w.f2dot14(region.peak[axis]);
+            w.f2dot14(region.end[axis]);
+        }
+    }
+
+    w.patch32(dataOffset, w.size() - start);
+    w.u16(rows.size());                     // itemCount
+    w.u16(font.regions.size());             // wordDeltaCount
+    w.u16(font.regions.size());             // regionIndexCount
+    for (size_t region = 0; region < font.regions.size(); ++region) {
+        w.u16(region);
+    }
+    for (const std::vector<int16_t>& row : rows) {
+        for (int16_t delta : row) {
+            w.i16(delta);
+        }
+    }
+}
+
+std::vector<uint8_t> build_hvar(const Font& font) {
+    // Row 0 is all zeros and shared by every glyph whose advance doesn't vary.
+    std::vector<std::vector<int16_t>> rows = { std::vector<int16_t>(font.regions.size()) };
+    std::vector<uint16_t> map;
+    for (const std::vector<int16_t>& deltas : font.advanceDeltas) {
+        if (deltas.empty()) {
+            map.push_back(0);
+        } else {
+            map.push_back(rows.size());
+            rows.push_back(deltas);
+        }
+    }
+
+    Writer w;
+    w.u16(1); w.u16(0);
+    size_t storeOffset = w.size();
+    w.u32(0);
+    size_t advanceMapOffset = w.size();
+    w.u32(0);
+    w.u32(0);                               // lsbMappingOffset
+    w.u32(0);                               // rsbMappingOffset
+
+    w.patch32(advanceMapOffset, w.size());
+    w.u8(0);                                // DeltaSetIndexMap format 0
+    w.u8(0x1F);                             // 2-byte entries, 16 inner index bits
+    w.u16(map.size());
+    for (uint16_t inner : map) {
+        w.u16(inner);
+    }
+    w.pad(4);
+
+    w.patch32(storeOffset, w.size());
+    write_item_variation_store(w, font, rows);
+    return w.data;
+}
+
+std::vector<uint8_t> build_mvar(const Font& font, std::mt19937_64& rng) {
+    // Sorted by tag, as the table requires.
+    const uint32_t tags[] = {
+        make_tag('c', 'p', 'h', 't'), make_tag('h', 'a', 's', 'c'), make_tag('h', 'd', 's', 'c'),
+        make_tag('s', 't', 'r', 'o'), make_tag('s', 't', 'r', 's'), make_tag('u', 'n', 'd', 'o'),
+        make_tag('u', 'n', 'd', 's'), make_tag('x', 'h', 'g', 't'),
+    };
+    uint32_t count = std::min<uint32_t>(font.options.mvarRecords, std::size(tags));
+    std::vector<std::vector<int16_t>> rows;
+    std::uniform_int_distribution<int> delta(-40, 40);
+    for (uint32_t i = 0; i < count; ++i) {
+        std::vector<int16_t> row;
+        for (size_t region = 0; region < font.regions.size(); ++region) {
+            row.push_back(delta(rng));
+        }
+        rows.push_back(row);
+    }
+
+    Writer w;
+    w.u16(1); w.u16(0);
+    w.u16(0);                               // reserved
+    w.u16(8);                               // valueRecordSize
+    w.u16(count);
+    size_t storeOffset = w.size();
+    w.u16(0);
+    for (uint32_t i = 0; i < count; ++i) {
+        w.tag(tags[i]);
+        w.u16(0);
+        w.u16(i);
+    }
+    w.pad(4);
+    w.patch16(storeOffset, w.size());
+    write_item_variation_store(w, font, rows);
+    return w.data;
+}
+
+std::string format_value(double value) {
+    char label[32];
+    snprintf(label, sizeof(label), "%g", value);
+    return label;
+}
+
+// One design axis record per axis, with an axis value for each extreme and an elidable one for
+// the default.
+std::vector<uint8_t> build_stat(Font& font) {
+    const Options& options = font.options;
+    uint16_t nameID = font.firstInstanceNameID + options.instanceCount;
+    struct AxisValue { uint16_t axis; uint16_t flags; uint16_t nameID; double value; };
+    std::vector<AxisValue> values;
+    for (size_t i = 0; i < options.axes.size(); ++i) {
+        const Axis& axis = options.axes[i];
+        if (axis.minimum < axis.def) {
+            values.push_back({ static_cast<uint16_t>(i), 0, add_name(font, nameID++, format_value(axis.minimum)), axis.minimum });
+        }
+        values.push_back({ static_cast<uint16_t>(i), 0x2, 2, axis.def }); // ELIDABLE_AXIS_VALUE_NAME, "Regular"
+        if (axis.maximum > axis.def) {
+            values.push_back({ static_cast<uint16_t>(i), 0, add_name(font, nameID++, format_value(axis.maximum)), axis.maximum });
+        }
+    }
+
+    Writer w;
+    w.u16(1); w.u16(1);
+    w.u16(8);                               // designAxisSize
+    w.u16(options.axes.size());
+    size_t axesOffset = w.size();
+    w.u32(0);
+    w.u16(values.size());
+    size_t valuesOffset = w.size();
+    w.u32(0);
+    w.u16(2);                               // elidedFallbackNameID
+
+    w.patch32(axesOffset, w.size());
+    for (size_t i = 0; i < options.axes.size(); ++i) {
+        w.tag(options.axes[i].tag);
+        w.u16(font.firstAxisNameID + i);
+        w.u16(i);
+    }
+    size_t offsetsStart = w.size();
+    w.patch32(valuesOffset, offsetsStart);
+    for (size_t i = 0; i < values.size(); ++i) {
+        w.u16(0);
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+        w.patch16(offsetsStart + i * 2, w.size() - offsetsStart);
+        w.u16(1);                           // format
+        w.u16(values[i].axis);
+        w.u16(values[i].flags);
+        w.u16(values[i].nameID);
+        w.fixed(values[i].value);
+    }
+    return w.data;
+}
+
+// Adds the font's tables. Those that only read the font are encoded when the serializer finishes,
+// after STAT has added its names; the ones sharing the random stream, or that add names or depend
+// on those that do, are built here in order.
+void build_font(Font& font, FontSerializer* serializer) {
+    // Table contents that are random but not per glyph get their own stream, so changing one
+    // option doesn't reshuffle everything else.
+    std::mt19937_64 rng(font.options.seed ^ 0x9E3779B97F4A7C15ull);
+    std::vector<uint32_t> offsets;
+    serializer->add(make_tag('g', 'l', 'y', 'f'), build_glyf(font, &offsets));
+    serializer->add(make_tag('l', 'o', 'c', 'a'), build_loca(offsets));
+    serializer->add_encoder(make_tag('h', 'e', 'a', 'd'), [&] { return build_head(font); });
+    serializer->add_encoder(make_tag('h', 'h', 'e', 'a'), [&] { return build_hhea(font); });
+    serializer->add_encoder(make_tag('h', 'm', 't', 'x'), [&] { return build_hmtx(font); });
+    serializer->add_encoder(make_tag('m', 'a', 'x', 'p'), [&] { return build_maxp(font); });
+    serializer->add_encoder(make_tag('c', 'm', 'a', 'p'), [&] { return build_cmap(font); });
+    serializer->add_encoder(make_tag('O', 'S', '/', '2'), [&] { return build_os2(font); });
+    serializer->add(make_tag('p', 'o', 's', 't'), build_post());
+    if (font.options.isStatic) {
+        serializer->add(make_tag('n', 'a', 'm', 'e'), build_name(font));
+        return;
+    }
+    serializer->add_encoder(make_tag('f', 'v', 'a', 'r'), [&] { return build_fvar(font); });
+    serializer->add_encoder(make_tag('g', 'v', 'a', 'r'), [&] { return build_gvar(font); });
+    serializer->add_encoder(make_tag('H', 'V', 'A', 'R'), [&] { return build_hvar(font); });
+    if (font.options.avar) {
+        serializer->add(make_tag('a', 'v', 'a', 'r'), build_avar(font, rng));
+    }
+    if (font.options.mvarRecords) {
+        serializer->add(make_tag('M', 'V', 'A', 'R'), build_mvar(font, rng));
+    }
+    serializer->add(make_tag('S', 'T', 'A', 'T'), build_stat(font));
+    // Last, because STAT adds names.
+    serializer->add(make_tag('n', 'a', 'm', 'e'), build_name(font));
+}
+
+void usage(const char* program) {
+    printf("Usage: %s [options] out.ttf\n", program);
+    printf("  --axes N|tag,tag,...   axis count or tags (default wght,wdth,opsz)\n");
+    printf("  --glyphs N             glyph count, including .notdef (default 256, at most 65535)\n");
+    printf("  --contours N           contours per glyph (default 2)\n");
+    printf("  --points N             points per contour (default 8)\n");
+    printf("  --regions N            variation regions (default: one per axis direction, at most 4095)\n");
+    printf("  --gvar-density F       fraction of glyph/region pairs with outline deltas (default 1)\n");
+    printf("  --hvar-density F       fraction of glyphs with advance deltas (default 1)\n");
+    printf("  --mvar N               MVAR value records, 0 for no MVAR (default 4)\n");
+    printf("  --instances N          named instances (default 9)\n");
+    printf("  --no-avar              leave out avar\n");
+    printf("  --static               leave out fvar, gvar, HVAR, avar, MVAR and STAT, for a static font\n");
+    printf("  --seed N               (default 1)\n");
+}
+
+bool parse_options(int argc, char** argv, Options* options) {
+    options->axes = parse_axes("wght,wdth,opsz");
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--axes") && hasValue) {
+            options->axes = parse_axes(argv[++i]);
+        } else if (!strcmp(argv[i], "--glyphs") && hasValue) {
+            options->glyphCount = std::clamp(atoi(argv[++i]), 1, 65535);
+        } else if (!strcmp(argv[i], "--contours") && hasValue) {
+            options->contours = std::clamp(atoi(argv[++i]), 1, 100);
+        } else if (!strcmp(argv[i], "--points") && hasValue) {
+            options->pointsPerContour = std::clamp(atoi(argv[++i]), 3, 1000);
+        } else if (!strcmp(argv[i], "--regions") && hasValue) {
+            options->regionCount = std::clamp<int>(atoi(argv[++i]), 1, kMaxGvarRegions);
+        } else if (!strcmp(argv[i], "--gvar-density") && hasValue) {
+            options->gvarDensity = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--hvar-density") && hasValue) {
+            options->hvarDensity = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--mvar") && hasValue) {
+            options->mvarRecords = std::clamp(atoi(argv[++i]), 0, 8);
+        } else if (!strcmp(argv[i], "--instances") && hasValue) {
+            options->instanceCount = std::clamp(atoi(argv[++i]), 0, 1000);
+        } else if (!strcmp(argv[i], "--no-avar")) {
+            options->avar = false;
+        } else if (!strcmp(argv[i], "--static")) {
+            options->isStatic = true;
+        } else if (!strcmp(argv[i], "--seed") && hasValue) {
+            options->seed = strtoull(argv[++i], nullptr, 10);
+        } else if (argv[i][0] != '-' && !options->outputPath) {
+            options->outputPath = argv[i];
+        } else {
+            return false;
+        }
+    }
+    return options->outputPath && !options->axes.empty();
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Font font = make_font(options);
+    if (font.regions.size() > kMaxGvarRegions) {
+        printf("%zu regions, more than gvar can number (%zu); use fewer axes\n", font.regions.size(), kMaxGvarRegions);
+        return 1;
+    }
+    FontSerializer serializer;
+    serializer.jobs = std::max(1u, std::thread::hardware_concurrency());
+    build_font(font, &serializer);
+    serializer.finish();
+    if (!options.isStatic && !serializer.table(make_tag('g', 'v', 'a', 'r'))) {
+        return 1;
+    }
+    if (!serializer.write_file(options.outputPath)) {
+        printf("Could not write: %s\n", options.outputPath);
+        return 1;
+    }
+    if (options.isStatic) {
+        printf("%s: %zu bytes, static, %u glyphs\n", options.outputPath, serializer.size(), options.glyphCount);
+    } else {
+        printf("%s: %zu bytes, %zu axes, %u glyphs, %zu regions\n", options.outputPath, serializer.size(),
+               options.axes.size(), options.glyphCount, font.regions.size());
+    }
+    return 0;
+}
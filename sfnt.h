@@ -0,0 +1,1035 @@
+// Reading OpenType fonts: a bounds-checked big-endian Reader, the counterpart of sfnt_writer.h's
+// Writer, views of table records generated from sfnt.schema, parsers for the parts of the
+// variation tables the tests look into, and glyph outlines for the tools. Nothing here depends on
+// CoreText; uifont_opsz hands in tables from CTFontCopyTable, the tools read files.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <utility>
+#include <vector>
+
+uint32_t constexpr sfnt_tag(char a, char b, char c, char d) {
+    return (((uint32_t)a << 24) | ((uint32_t)b << 16) | ((uint32_t)c << 8) | (uint32_t)d);
+}
+
+// A view of some bytes. Reads out of range return 0 rather than failing, so a parser can read a
+// damaged table straight through; has() is for the places where a bad length would loop or
+// allocate.
+struct Reader {
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+
+    constexpr bool empty() const { return !length; }
+    constexpr bool has(size_t offset, size_t size) const { return offset <= length && size <= length - offset; }
+    constexpr uint8_t u8(size_t offset) const { return has(offset, 1) ? data[offset] : 0; }
+    constexpr uint16_t u16(size_t offset) const { return has(offset, 2) ? data[offset] << 8 | data[offset + 1] : 0; }
+    constexpr uint32_t u32(size_t offset) const { return has(offset, 4) ? uint32_t(u16(offset)) << 16 | u16(offset + 2) : 0; }
+    constexpr int8_t i8(size_t offset) const { return static_cast<int8_t>(u8(offset)); }
+    constexpr int16_t i16(size_t offset) const { return static_cast<int16_t>(u16(offset)); }
+    constexpr int32_t i32(size_t offset) const { return static_cast<int32_t>(u32(offset)); }
+    constexpr double f2dot14(size_t offset) const { return i16(offset) / 16384.0; }
+    constexpr double fixed(size_t offset) const { return i32(offset) / 65536.0; }
+
+    // The bytes from offset on, at most size of them; empty if offset is out of range.
+    constexpr Reader at(size_t offset, size_t size = SIZE_MAX) const {
+        if (offset >= length) {
+            return Reader();
+        }
+        return Reader{ data + offset, std::min(size, length - offset) };
+    }
+};
+
+// Unchecked reads, for the generated views below, which check their bytes once up front.
+constexpr uint8_t sfnt_u8(const uint8_t* p) { return p[0]; }
+constexpr uint16_t sfnt_u16(const uint8_t* p) { return uint16_t(p[0] << 8 | p[1]); }
+constexpr uint32_t sfnt_u32(const uint8_t* p) { return uint32_t(sfnt_u16(p)) << 16 | sfnt_u16(p + 2); }
+constexpr int8_t sfnt_i8(const uint8_t* p) { return static_cast<int8_t>(p[0]); }
+constexpr int16_t sfnt_i16(const uint8_t* p) { return static_cast<int16_t>(sfnt_u16(p)); }
+constexpr int32_t sfnt_i32(const uint8_t* p) { return static_cast<int32_t>(sfnt_u32(p)); }
+constexpr double sfnt_f2dot14(const uint8_t* p) { return sfnt_i16(p) / 16384.0; }
+constexpr double sfnt_fixed(const uint8_t* p) { return sfnt_i32(p) / 65536.0; }
+constexpr int64_t sfnt_i64(const uint8_t* p) { return static_cast<int64_t>(uint64_t(sfnt_u32(p)) << 32 | sfnt_u32(p + 4)); }
+
+// What a view of bytes too short for its record reads instead, so it reads 0s.
+inline constexpr uint8_t kSfntZeros[128] = {};
+
+constexpr Reader sfnt_zeros() {
+    return Reader{ kSfntZeros, sizeof(kSfntZeros) };
+}
+
+// Field types as array elements. Records' views have the same kSize and read().
+template <typename T, size_t Size, T (*Read)(const uint8_t*)>
+struct SfntField {
+    static constexpr size_t kSize = Size;
+    static constexpr T read(const Reader& bytes) { return Read(bytes.data); }
+};
+using SfntU8 = SfntField<uint8_t, 1, sfnt_u8>;
+using SfntU16 = SfntField<uint16_t, 2, sfnt_u16>;
+using SfntU32 = SfntField<uint32_t, 4, sfnt_u32>;
+using SfntI8 = SfntField<int8_t, 1, sfnt_i8>;
+using SfntI16 = SfntField<int16_t, 2, sfnt_i16>;
+using SfntI32 = SfntField<int32_t, 4, sfnt_i32>;
+using SfntF2Dot14 = SfntField<double, 2, sfnt_f2dot14>;
+using SfntFixed = SfntField<double, 4, sfnt_fixed>;
+using SfntI64 = SfntField<int64_t, 8, sfnt_i64>;
+
+// An array of Elements stride bytes apart. The count is cut down at construction to what the bytes
+// hold, so an index below size() reads without a check; one past it reads 0s.
+template <typename Element>
+struct SfntArray {
+    Reader reader;
+    size_t count = 0;
+    size_t stride = Element::kSize;
+
+    constexpr SfntArray() = default;
+    constexpr SfntArray(const Reader& bytes, size_t count, size_t stride = Element::kSize)
+        : reader(bytes)
+        , count(stride >= Element::kSize ? std::min(count, bytes.length / stride) : 0)
+        , stride(stride) {}
+
+    constexpr size_t size() const { return count; }
+    constexpr auto operator[](size_t i) const {
+        return Element::read(i < count ? Reader{ reader.data + i * stride, stride } : sfnt_zeros());
+    }
+
+    struct Iterator {
+        const SfntArray* array;
+        size_t i;
+        constexpr auto operator*() const { return (*array)[i]; }
+        constexpr Iterator& operator++() { ++i; return *this; }
+        constexpr bool operator!=(const Iterator& other) const { return i != other.i; }
+    };
+    constexpr Iterator begin() const { return { this, 0 }; }
+    constexpr Iterator end() const { return { this, count }; }
+};
+
+#include "sfnt_views.h"
+
+// The table directory of an sfnt file, or of the first font of a collection. Table offsets are from
+// the start of the file, in a collection too.
+inline TableDirectoryView sfnt_directory(const Reader& font) {
+    TtcHeaderView collection(font);
+    return TableDirectoryView(collection.ttcTag() == sfnt_tag('t', 't', 'c', 'f') ? font.at(collection.tableDirectoryOffsets()[0]) : font);
+}
+
+// A table of an sfnt file (the first font of a collection), or an empty Reader.
+inline Reader sfnt_table(const Reader& font, uint32_t tag) {
+    for (TableRecordView record : sfnt_directory(font).tableRecords()) {
+        if (record.tableTag() == tag) {
+            return font.at(record.offset(), record.length());
+        }
+    }
+    return Reader();
+}
+
+constexpr uint32_t kFvarTag = sfnt_tag('f', 'v', 'a', 'r');
+constexpr uint32_t kGvarTag = sfnt_tag('g', 'v', 'a', 'r');
+constexpr uint32_t kHvarTag = sfnt_tag('H', 'V', 'A', 'R');
+constexpr uint32_t kMvarTag = sfnt_tag('M', 'V', 'A', 'R');
+
+inline std::vector<uint32_t> fvar_axis_tags(const Reader& fvar) {
+    std::vector<uint32_t> tags;
+    for (VariationAxisRecordView axis : FvarView(fvar).axes()) {
+        tags.push_back(axis.axisTag());
+    }
+    return tags;
+}
+
+// Axis masks: bit i is axis i in fvar order. Fonts with more axes than bits have the extra axes
+// folded into the top bit, which only makes the masks more conservative.
+using AxisMask = uint64_t;
+constexpr int kMaskAxes = 64;
+constexpr AxisMask kAllAxes = ~AxisMask(0);
+
+inline AxisMask axis_bit(int axis) {
+    return AxisMask(1) << std::min(axis, kMaskAxes - 1);
+}
+
+// The axes of a gvar tuple whose peak isn't 0. An axis with a 0 peak doesn't take part in it.
+inline AxisMask peak_axes(const Reader& peaks, int axisCount) {
+    AxisMask axes = 0;
+    for (int axis = 0; axis < axisCount; ++axis) {
+        if (peaks.i16(axis * 2)) {
+            axes |= axis_bit(axis);
+        }
+    }
+    return axes;
+}
+
+// One ItemVariationData subtable: rows of deltas, one column per region it uses. The first
+// wordCount columns are 16-bit (32-bit with longWords), the rest 8-bit (16-bit).
+struct ItemVariationData {
+    Reader data;
+    SfntArray<SfntU16> regionIndexes;
+    uint16_t itemCount = 0;
+    uint16_t wordCount = 0;
+    uint16_t regionIndexCount = 0;
+    bool longWords = false;
+    size_t rowSize = 0;
+
+    ItemVariationData() = default;
+    explicit ItemVariationData(const Reader& data) : data(data) {
+        ItemVariationDataView header(data);
+        regionIndexes = header.regionIndexes();
+        itemCount = header.itemCount();
+        wordCount = std::min<uint16_t>(header.wordDeltaCount() & 0x7fff, header.regionIndexCount());
+        regionIndexCount = header.regionIndexCount();
+        longWords = header.wordDeltaCount() & 0x8000;
+        size_t wordSize = longWords ? 4 : 2;
+        rowSize = wordCount * wordSize + (regionIndexCount - wordCount) * wordSize / 2;
+    }
+
+    uint16_t region_index(uint16_t column) const { return regionIndexes[column]; }
+    size_t row_offset(uint16_t inner) const { return ItemVariationDataView::kSize + regionIndexCount * 2 + inner * rowSize; }
+    int32_t delta(size_t row, uint16_t column) const {
+        if (column < wordCount) {
+            return longWords ? data.i32(row + column * 4) : data.i16(row + column * 2);
+        }
+        size_t bytes = wordCount * (longWords ? 4 : 2);
+        return longWords ? data.i16(row + bytes + (column - wordCount) * 2) : data.i8(row + bytes + column - wordCount);
+    }
+};
+
+// An ItemVariationStore (HVAR, MVAR, GDEF...).
+struct ItemVariationStore {
+    ItemVariationStoreView store;
+    SfntArray<RegionAxisCoordinatesView> regions;
+    uint16_t axisCount = 0;
+    uint16_t regionCount = 0;
+    uint16_t dataCount = 0;
+
+    ItemVariationStore() = default;
+    explicit ItemVariationStore(const ItemVariationStoreView& store)
+        : store(store)
+        , regions(store.variationRegionList().regions())
+        , axisCount(store.variationRegionList().axisCount())
+        , regionCount(store.variationRegionList().regionCount())
+        , dataCount(store.itemVariationDataCount()) {}
+
+    // One axis of a region.
+    RegionAxisCoordinatesView coordinates(uint16_t region, uint16_t axis) const {
+        return regions[size_t(region) * axisCount + axis];
+    }
+    ItemVariationData data(uint16_t outer) const {
+        return outer < dataCount ? ItemVariationData(store.reader.at(store.itemVariationDataOffsets()[outer])) : ItemVariationData();
+    }
+
+    // The axes a region takes part in: those it doesn't peak at 0 on.
+    AxisMask region_axes(uint16_t region) const {
+        AxisMask axes = 0;
+        for (uint16_t axis = 0; axis < axisCount; ++axis) {
+            if (coordinates(region, axis).peakCoord()) {
+                axes |= axis_bit(axis);
+            }
+        }
+        return axes;
+    }
+
+    // The axes of the regions with a nonzero delta in one row.
+    AxisMask row_axes(uint16_t outer, uint16_t inner) const {
+        ItemVariationData data = this->data(outer);
+        if (inner >= data.itemCount) {
+            return 0;
+        }
+        size_t row = data.row_offset(inner);
+        AxisMask axes = 0;
+        for (uint16_t column = 0; column < data.regionIndexCount; ++column) {
+            uint16_t regionIndex = data.region_index(column);
+            if (data.delta(row, column) && regionIndex < regionCount) {
+                axes |= region_axes(regionIndex);
+            }
+        }
+        return axes;
+    }
+
+    // The delta of one row at normalized coordinates (axisCount of them), the straightforward way:
+    // every region of the subtable is visited and its scalar worked out from the table.
+    double delta(uint16_t outer, uint16_t inner, const double* coordinates) const;
+};
+
+// A DeltaSetIndexMap entry as (outer, inner). Without a map, the index is the inner index of the
+// first subtable; indices past the end of a map use its last entry.
+inline std::pair<uint16_t, uint16_t> delta_set_index(const Reader& map, uint32_t index) {
+    if (map.empty()) {
+        return { 0, uint16_t(index) };
+    }
+    DeltaSetIndexMapFormat0View format0(map);
+    DeltaSetIndexMapFormat1View format1(map);
+    uint8_t entryFormat = format0.entryFormat();
+    uint32_t mapCount = format0.format() == 0 ? format0.mapCount() : format1.mapCount();
+    size_t entries = format0.format() == 0 ? DeltaSetIndexMapFormat0View::kSize : DeltaSetIndexMapFormat1View::kSize;
+    if (!mapCount) {
+        return { 0, 0 };
+    }
+    index = std::min(index, mapCount - 1);
+    int entrySize = ((entryFormat >> 4) & 3) + 1;
+    int innerBits = (entryFormat & 0xf) + 1;
+    uint32_t entry = 0;
+    for (int i = 0; i < entrySize; ++i) {
+        entry = entry << 8 | map.u8(entries + index * entrySize + i);
+    }
+    return { uint16_t(entry >> innerBits), uint16_t(entry & ((1u << innerBits) - 1)) };
+}
+
+// For each glyph, the axes that can move its outline and its advance, and for each MVAR metric the
+// axes that can change it. Where a font doesn't say (no gvar, say, for a CFF2 font), every axis is
+// assumed to.
+struct AxisInfluence {
+    std::vector<uint32_t> axisTags; // fvar order
+    std::vector<AxisMask> outlineAxes; // per glyph
+    std::vector<AxisMask> advanceAxes; // per glyph
+    std::vector<std::pair<uint32_t, AxisMask>> metricAxes; // MVAR value tag -> axes
+    bool fromGvar = false;
+    bool fromHvar = false;
+};
+
+constexpr uint16_t kEmbeddedTuple = 0xffff;
+
+// One tuple variation header of a glyph in gvar.
+struct GvarTuple {
+    uint16_t sharedIndex; // the shared tuple holding the peak, or kEmbeddedTuple
+    Reader peak;          // axisCount F2Dot14s
+    Reader intermediate;  // axisCount starts then axisCount ends, or empty for the implied ones
+};
+
+// A glyph's GlyphVariationData, empty when it has none.
+inline Reader gvar_glyph_data(const Reader& gvar, uint32_t glyph) {
+    GvarView table(gvar);
+    if (glyph >= table.glyphCount()) {
+        return Reader();
+    }
+    bool longOffsets = table.flags() & 1;
+    uint32_t start = longOffsets ? table.longOffsets()[glyph] : table.shortOffsets()[glyph] * 2u;
+    uint32_t end = longOffsets ? table.longOffsets()[glyph + 1] : table.shortOffsets()[glyph + 1] * 2u;
+    return end > start ? gvar.at(table.glyphVariationDataArrayOffset() + start, end - start) : Reader();
+}
+
+// Calls visit(const GvarTuple&) for each tuple of glyph.
+template <typename Visit>
+void for_each_gvar_tuple(const Reader& gvar, uint32_t glyph, Visit visit) {
+    GvarView table(gvar);
+    uint16_t axisCount = table.axisCount();
+    uint16_t sharedTupleCount = table.sharedTupleCount();
+    Reader sharedTuples = table.sharedTuples().reader;
+    Reader data = gvar_glyph_data(gvar, glyph);
+    uint16_t tupleCount = GlyphVariationDataView(data).tupleVariationCount() & 0x0fff;
+    size_t header = GlyphVariationDataView::kSize;
+    for (uint16_t i = 0; i < tupleCount && data.has(header, TupleVariationHeaderView::kSize); ++i) {
+        uint16_t tupleIndex = TupleVariationHeaderView(data.at(header)).tupleIndex();
+        header += TupleVariationHeaderView::kSize;
+        GvarTuple tuple = { kEmbeddedTuple, Reader(), Reader() };
+        if (tupleIndex & 0x8000) {
+            tuple.peak = data.at(header, axisCount * 2);
+            header += axisCount * 2;
+        } else if ((tupleIndex & 0x0fff) < sharedTupleCount) {
+            tuple.sharedIndex = tupleIndex & 0x0fff;
+            tuple.peak = sharedTuples.at(tuple.sharedIndex * axisCount * 2, axisCount * 2);
+        } else {
+            continue;
+        }
+        if (tupleIndex & 0x4000) {
+            tuple.intermediate = data.at(header, axisCount * 4);
+            header += axisCount * 4;
+        }
+        visit(tuple);
+    }
+}
+
+inline AxisInfluence build_axis_influence(const Reader& fvar, const Reader& gvar, const Reader& hvar,
+                                          const Reader& mvar, uint32_t glyphCount) {
+    AxisInfluence influence;
+    influence.axisTags = fvar_axis_tags(fvar);
+    AxisMask everyAxis = influence.axisTags.empty() ? 0 : kAllAxes;
+    influence.outlineAxes.assign(glyphCount, everyAxis);
+    influence.advanceAxes.assign(glyphCount, everyAxis);
+    if (!everyAxis) {
+        return influence;
+    }
+
+    if (!gvar.empty()) {
+        influence.fromGvar = true;
+        for (uint32_t glyph = 0; glyph < glyphCount; ++glyph) {
+            AxisMask axes = 0;
+            uint16_t axisCount = GvarView(gvar).axisCount();
+            for_each_gvar_tuple(gvar, glyph, [&](const GvarTuple& tuple) { axes |= peak_axes(tuple.peak, axisCount); });
+            // Every tuple carries the phantom points too, so without HVAR the advance goes with the outline.
+            influence.outlineAxes[glyph] = axes;
+            influence.advanceAxes[glyph] = axes;
+        }
+    }
+
+    if (!hvar.empty()) {
+        influence.fromHvar = true;
+        ItemVariationStore store(HvarView(hvar).itemVariationStore());
+        Reader advanceMap = HvarView(hvar).advanceWidthMapping();
+        for (uint32_t glyph = 0; glyph < glyphCount; ++glyph) {
+            auto [outer, inner] = delta_set_index(advanceMap, glyph);
+            influence.advanceAxes[glyph] = store.row_axes(outer, inner);
+        }
+    }
+
+    if (!mvar.empty()) {
+        MvarView table(mvar);
+        ItemVariationStore store(table.itemVariationStore());
+        for (ValueRecordView record : table.valueRecords()) {
+            influence.metricAxes.emplace_back(record.valueTag(),
+                                              store.row_axes(record.deltaSetOuterIndex(), record.deltaSetInnerIndex()));
+        }
+    }
+    return influence;
+}
+
+// Evaluating variations: user coordinates to normalized ones, and region scalars.
+
+constexpr uint32_t kAvarTag = sfnt_tag('a', 'v', 'a', 'r');
+
+struct FvarAxis {
+    uint32_t tag;
+    double minimum;
+    double def;
+    double maximum;
+};
+
+inline std::vector<FvarAxis> fvar_axes(const Reader& fvar) {
+    std::vector<FvarAxis> axes;
+    for (VariationAxisRecordView axis : FvarView(fvar).axes()) {
+        axes.push_back({ axis.axisTag(), axis.minValue(), axis.defaultValue(), axis.maxValue() });
+    }
+    return axes;
+}
+
+// The scalar one axis of a region contributes at coordinate. Axes with a 0 peak, and malformed
+// ranges, don't take part and contribute 1.
+inline double axis_scalar(double start, double peak, double end, double coordinate) {
+    if (peak == 0 || start > peak || peak > end || (start < 0 && end > 0)) {
+        return 1;
+    }
+    if (coordinate == peak) {
+        return 1;
+    }
+    if (coordinate <= start || coordinate >= end) {
+        return 0;
+    }
+    return coordinate < peak ? (coordinate - start) / (peak - start) : (end - coordinate) / (end - peak);
+}
+
+// Kernels specialized for fonts with 1 to 8 axes, which is nearly all of them. With the axis count
+// a template parameter the per-axis loops unroll and the early exit on a zero scalar becomes a
+// short chain of branches; fonts with more axes take the generic loop. Kernels are picked once,
+// when a font's tables are read, and called through a pointer.
+
+constexpr int kMaxSpecializedAxes = 8;
+
+// The scalar of a region given as axisCount (start, peak, end) triples.
+using RegionScalarKernel = double (*)(const double* triples, int axisCount, const double* coordinates);
+
+inline double region_scalar_generic(const double* triples, int axisCount, const double* coordinates) {
+    double scalar = 1;
+    for (int axis = 0; axis < axisCount && scalar; ++axis, triples += 3) {
+        scalar *= axis_scalar(triples[0], triples[1], triples[2], coordinates[axis]);
+    }
+    return scalar;
+}
+
+template <int AxisCount>
+double region_scalar_fixed(const double* triples, int, const double* coordinates) {
+    double scalar = 1;
+    for (int axis = 0; axis < AxisCount; ++axis) {
+        scalar *= axis_scalar(triples[axis * 3], triples[axis * 3 + 1], triples[axis * 3 + 2], coordinates[axis]);
+        if (!scalar) {
+            return 0;
+        }
+    }
+    return scalar;
+}
+
+// User values to normalized coordinates before avar, per fvar axis.
+using NormalizeKernel = void (*)(const FvarAxis* axes, int axisCount, const double* values, double* coordinates);
+
+inline double normalize_value(const FvarAxis& axis, double value) {
+    value = std::min(std::max(value, axis.minimum), axis.maximum);
+    if (value < axis.def && axis.def > axis.minimum) {
+        return (value - axis.def) / (axis.def - axis.minimum);
+    }
+    if (value > axis.def && axis.maximum > axis.def) {
+        return (value - axis.def) / (axis.maximum - axis.def);
+    }
+    return 0;
+}
+
+inline void normalize_generic(const FvarAxis* axes, int axisCount, const double* values, double* coordinates) {
+    for (int axis = 0; axis < axisCount; ++axis) {
+        coordinates[axis] = normalize_value(axes[axis], values[axis]);
+    }
+}
+
+template <int AxisCount>
+void normalize_fixed(const FvarAxis* axes, int, const double* values, double* coordinates) {
+    for (int axis = 0; axis < AxisCount; ++axis) {
+        coordinates[axis] = normalize_value(axes[axis], values[axis]);
+    }
+}
+
+template <size_t... Counts>
+RegionScalarKernel region_scalar_kernel(int axisCount, std::index_sequence<Counts...>) {
+    static constexpr RegionScalarKernel kKernels[] = { region_scalar_fixed<Counts + 1>... };
+    return axisCount >= 1 && axisCount <= kMaxSpecializedAxes ? kKernels[axisCount - 1] : region_scalar_generic;
+}
+
+inline RegionScalarKernel region_scalar_kernel(int axisCount) {
+    return region_scalar_kernel(axisCount, std::make_index_sequence<kMaxSpecializedAxes>());
+}
+
+template <size_t... Counts>
+NormalizeKernel normalize_kernel(int axisCount, std::index_sequence<Counts...>) {
+    static constexpr NormalizeKernel kKernels[] = { normalize_fixed<Counts + 1>... };
+    return axisCount >= 1 && axisCount <= kMaxSpecializedAxes ? kKernels[axisCount - 1] : normalize_generic;
+}
+
+inline NormalizeKernel normalize_kernel(int axisCount) {
+    return normalize_kernel(axisCount, std::make_index_sequence<kMaxSpecializedAxes>());
+}
+
+// The avar part of normalization, in place.
+inline void apply_avar(const Reader& avar, size_t axisCount, double* coordinates) {
+    if (avar.empty() || AvarView(avar).axisCount() != axisCount) {
+        return;
+    }
+    size_t segmentMap = AvarView::kSize;
+    for (size_t axis = 0; axis < axisCount; ++axis) {
+        SegmentMapView map(avar.at(segmentMap));
+        SfntArray<AxisValueMapView> pairs = map.axisValueMaps();
+        for (size_t j = 1; j < pairs.size(); ++j) {
+            double fromBelow = pairs[j - 1].fromCoordinate();
+            double from = pairs[j].fromCoordinate();
+            if (coordinates[axis] <= from) {
+                double toBelow = pairs[j - 1].toCoordinate();
+                double to = pairs[j].toCoordinate();
+                coordinates[axis] = from == fromBelow ? to : toBelow + (to - toBelow) * (coordinates[axis] - fromBelow) / (from - fromBelow);
+                break;
+            }
+        }
+        segmentMap += SegmentMapView::kSize + map.positionMapCount() * AxisValueMapView::kSize;
+    }
+}
+
+// User values, one per fvar axis, to normalized coordinates: the default to 0 and the extremes to
+// ±1, then through avar, then rounded to F2Dot14 as the tables store them.
+inline void normalize_coordinates(NormalizeKernel normalize, const std::vector<FvarAxis>& axes, const Reader& avar,
+                                  const double* values, double* coordinates) {
+    normalize(axes.data(), axes.size(), values, coordinates);
+    apply_avar(avar, axes.size(), coordinates);
+    for (size_t axis = 0; axis < axes.size(); ++axis) {
+        coordinates[axis] = std::round(coordinates[axis] * 16384) / 16384;
+    }
+}
+
+inline std::vector<double> normalize_coordinates(const std::vector<FvarAxis>& axes, const Reader& avar,
+                                                 const double* values) {
+    std::vector<double> coordinates(axes.size());
+    normalize_coordinates(normalize_kernel(axes.size()), axes, avar, values, coordinates.data());
+    return coordinates;
+}
+
+inline double ItemVariationStore::delta(uint16_t outer, uint16_t inner, const double* coordinates) const {
+    ItemVariationData data = this->data(outer);
+    if (inner >= data.itemCount) {
+        return 0;
+    }
+    size_t row = data.row_offset(inner);
+    double delta = 0;
+    for (uint16_t column = 0; column < data.regionIndexCount; ++column) {
+        uint16_t region = data.region_index(column);
+        double scalar = 1;
+        for (uint16_t axis = 0; axis < axisCount && scalar; ++axis) {
+            RegionAxisCoordinatesView range = this->coordinates(region, axis);
+            scalar *= axis_scalar(range.startCoord(), range.peakCoord(), range.endCoord(), coordinates[axis]);
+        }
+        delta += scalar * data.delta(row, column);
+    }
+    return delta;
+}
+
+// The scalar of a gvar tuple, intermediate or not, worked out from the table.
+inline double gvar_tuple_scalar(const GvarTuple& tuple, int axisCount, const double* coordinates) {
+    double scalar = 1;
+    for (int axis = 0; axis < axisCount && scalar; ++axis) {
+        double peak = tuple.peak.f2dot14(axis * 2);
+        double start = tuple.intermediate.empty() ? std::min(peak, 0.0) : tuple.intermediate.f2dot14(axis * 2);
+        double end = tuple.intermediate.empty() ? std::max(peak, 0.0) : tuple.intermediate.f2dot14((axisCount + axis) * 2);
+        scalar *= axis_scalar(start, peak, end, coordinates[axis]);
+    }
+    return scalar;
+}
+
+// Regions decoded once, with an index that finds the ones active at some coordinates without
+// visiting the rest. Most regions of a big font are zero almost everywhere: a region is only
+// active where each axis it peaks on is strictly inside its range. So each region is filed under
+// the one axis with the narrowest such range, sorted by where the range starts, and a lookup only
+// looks at the regions filed under axes whose coordinate is inside their range. Regions that peak
+// on no axis are active everywhere.
+struct RegionIndex {
+    struct Filed {
+        double start;
+        double end;
+        uint32_t region;
+    };
+
+    int axisCount = 0;
+    std::vector<double> triples; // (start, peak, end) for region r, axis a at (r * axisCount + a) * 3
+    std::vector<std::vector<Filed>> byAxis;
+    std::vector<uint32_t> everywhere;
+    RegionScalarKernel kernel = region_scalar_generic;
+
+    size_t size() const { return axisCount ? triples.size() / (axisCount * 3) : 0; }
+
+    double scalar(uint32_t region, const double* coordinates) const {
+        return kernel(&triples[region * axisCount * 3], axisCount, coordinates);
+    }
+
+    // Every region's scalar, through kernel.
+    void scalars(RegionScalarKernel kernel, const double* coordinates, double* scalars) const {
+        for (size_t region = 0; region < size(); ++region) {
+            scalars[region] = kernel(&triples[region * axisCount * 3], axisCount, coordinates);
+        }
+    }
+
+    void build() {
+        kernel = region_scalar_kernel(axisCount);
+        byAxis.assign(axisCount, {});
+        everywhere.clear();
+        for (uint32_t region = 0; region < size(); ++region) {
+            const double* triple = &triples[region * axisCount * 3];
+            int narrowest = -1;
+            for (int axis = 0; axis < axisCount; ++axis) {
+                const double* t = triple + axis * 3;
+                if (axis_scalar(t[0], t[1], t[2], 0) == 1) {
+                    continue; // doesn't take part, or is 1 at the default anyway
+                }
+                if (narrowest < 0 || t[2] - t[0] < triple[narrowest * 3 + 2] - triple[narrowest * 3]) {
+                    narrowest = axis;
+                }
+            }
+            if (narrowest < 0) {
+                everywhere.push_back(region);
+            } else {
+                byAxis[narrowest].push_back({ triple[narrowest * 3], triple[narrowest * 3 + 2], region });
+            }
+        }
+        for (std::vector<Filed>& filed : byAxis) {
+            std::sort(filed.begin(), filed.end(), [](const Filed& a, const Filed& b) { return a.start < b.start; });
+        }
+    }
+
+    // The regions with a nonzero scalar at coordinates, and their scalars.
+    void active(const double* coordinates, std::vector<std::pair<uint32_t, double>>* active) const {
+        active->clear();
+        for (uint32_t region : everywhere) {
+            if (double scalar = this->scalar(region, coordinates)) {
+                active->emplace_back(region, scalar);
+            }
+        }
+        for (int axis = 0; axis < axisCount; ++axis) {
+            double coordinate = coordinates[axis];
+            if (coordinate == 0) {
+                continue; // filed regions are 0 at the default of their axis
+            }
+            // Filed ranges don't cross 0, so for a positive coordinate only those starting at or
+            // after 0 and no later than the coordinate can hold it, and for a negative one only
+            // those starting no later than it. Ranges are inclusive, as axis_scalar's are: a
+            // region peaking at the end of its range, say at an axis extreme, is 1 there.
+            const std::vector<Filed>& filed = byAxis[axis];
+            auto starts_before = [](const Filed& f, double c) { return f.start < c; };
+            auto starts_after = [](double c, const Filed& f) { return c < f.start; };
+            auto first = coordinate > 0 ? std::lower_bound(filed.begin(), filed.end(), 0.0, starts_before) : filed.begin();
+            auto last = std::upper_bound(first, filed.end(), coordinate, starts_after);
+            for (auto it = first; it != last; ++it) {
+                if (coordinate <= it->end) {
+                    if (double scalar = this->scalar(it->region, coordinates)) {
+                        active->emplace_back(it->region, scalar);
+                    }
+                }
+            }
+        }
+    }
+};
+
+inline RegionIndex ivs_region_index(const ItemVariationStore& store) {
+    RegionIndex index;
+    index.axisCount = store.axisCount;
+    for (uint16_t region = 0; region < store.regionCount; ++region) {
+        for (uint16_t axis = 0; axis < store.axisCount; ++axis) {
+            RegionAxisCoordinatesView range = store.coordinates(region, axis);
+            index.triples.insert(index.triples.end(), { range.startCoord(), range.peakCoord(), range.endCoord() });
+        }
+    }
+    index.build();
+    return index;
+}
+
+// The shared tuples of gvar as regions, with the implied ranges from 0 to the peak.
+inline RegionIndex gvar_shared_tuple_index(const Reader& gvar) {
+    RegionIndex index;
+    GvarView table(gvar);
+    index.axisCount = table.axisCount();
+    SfntArray<SfntF2Dot14> sharedTuples = table.sharedTuples();
+    for (uint16_t tuple = 0; tuple < table.sharedTupleCount(); ++tuple) {
+        for (int axis = 0; axis < index.axisCount; ++axis) {
+            double peak = sharedTuples[size_t(tuple) * index.axisCount + axis];
+            index.triples.insert(index.triples.end(), { std::min(peak, 0.0), peak, std::max(peak, 0.0) });
+        }
+    }
+    index.build();
+    return index;
+}
+
+// An ItemVariationStore evaluated through a RegionIndex: only the active regions are visited, each
+// found in a subtable through a region-to-column map made at load.
+struct SparseItemVariationStore {
+    ItemVariationStore store;
+    RegionIndex regions;
+    std::vector<ItemVariationData> data;
+    std::vector<std::vector<int32_t>> columns; // per subtable, per region: its column or -1
+
+    SparseItemVariationStore() = default;
+    explicit SparseItemVariationStore(const ItemVariationStore& store) : SparseItemVariationStore(store, ivs_region_index(store)) {}
+    // With the store's region index made elsewhere.
+    SparseItemVariationStore(const ItemVariationStore& store, RegionIndex regions) : store(store), regions(std::move(regions)) {
+        for (uint16_t outer = 0; outer < store.dataCount; ++outer) {
+            data.push_back(store.data(outer));
+            columns.emplace_back(store.regionCount, -1);
+            for (uint16_t column = 0; column < data.back().regionIndexCount; ++column) {
+                uint16_t region = data.back().region_index(column);
+                if (region < store.regionCount) {
+                    columns.back()[region] = column;
+                }
+            }
+        }
+    }
+
+    double delta(uint16_t outer, uint16_t inner, const std::vector<std::pair<uint32_t, double>>& active) const {
+        if (outer >= data.size() || inner >= data[outer].itemCount) {
+            return 0;
+        }
+        const ItemVariationData& subtable = data[outer];
+        const std::vector<int32_t>& regionColumns = columns[outer];
+        size_t row = subtable.row_offset(inner);
+        double delta = 0;
+        for (const auto& [region, scalar] : active) {
+            int32_t column = regionColumns[region];
+            if (column >= 0) {
+                delta += scalar * subtable.delta(row, column);
+            }
+        }
+        return delta;
+    }
+};
+
+// Calls visit(tuple, scalar) for each tuple of glyph with a nonzero scalar, skipping tuples on
+// inactive shared peaks without looking at them. sharedScalars holds the scalar of every shared
+// tuple at coordinates, 0 for inactive ones.
+template <typename Visit>
+void for_each_active_gvar_tuple(const Reader& gvar, uint32_t glyph, const double* coordinates,
+                                const std::vector<double>& sharedScalars, Visit visit) {
+    int axisCount = GvarView(gvar).axisCount();
+    for_each_gvar_tuple(gvar, glyph, [&](const GvarTuple& tuple) {
+        double scalar;
+        if (tuple.sharedIndex != kEmbeddedTuple && tuple.intermediate.empty()) {
+            scalar = sharedScalars[tuple.sharedIndex];
+        } else {
+            scalar = gvar_tuple_scalar(tuple, axisCount, coordinates);
+        }
+        if (scalar) {
+            visit(tuple, scalar);
+        }
+    });
+}
+
+// An array aligned for vector loads, 64 bytes, zero-filled.
+template <typename T>
+struct AlignedArray {
+    struct Free {
+        void operator()(T* data) const { free(data); }
+    };
+    std::unique_ptr<T[], Free> data;
+    size_t size = 0;
+
+    AlignedArray() = default;
+    explicit AlignedArray(size_t size) : size(size) {
+        void* memory = nullptr;
+        if (size && !posix_memalign(&memory, 64, size * sizeof(T))) {
+            memset(memory, 0, size * sizeof(T));
+            data.reset(static_cast<T*>(memory));
+        } else {
+            this->size = 0;
+        }
+    }
+    T& operator[](size_t i) { return data[i]; }
+    const T& operator[](size_t i) const { return data[i]; }
+};
+
+// An ItemVariationStore whose delta rows are expanded at load from packed big-endian rows into
+// structure-of-arrays blocks: per subtable, one aligned column of deltas per region, int16 where
+// every delta of the subtable fits and int32 where not. Evaluating every row of a subtable is then
+// a multiply-add per column over contiguous memory, which the compiler vectorizes, instead of a
+// decode per delta. Subtables are expanded in order while they fit in the byte budget; the rest
+// stay packed and are read as before.
+struct ExpandedItemVariationStore {
+    struct Subtable {
+        ItemVariationData packed;
+        bool expanded = false;
+        size_t stride = 0; // rows per column, rounded up to whole 64-byte blocks
+        AlignedArray<int16_t> narrow;
+        AlignedArray<int32_t> wide;
+    };
+
+    ItemVariationStore store;
+    std::vector<Subtable> subtables;
+    size_t packedBytes = 0;
+    size_t expandedBytes = 0;
+
+    ExpandedItemVariationStore() = default;
+    // budget is the most this store's expansion may take, in bytes.
+    ExpandedItemVariationStore(const ItemVariationStore& store, size_t budget) : store(store) {
+        for (uint16_t outer = 0; outer < store.dataCount; ++outer) {
+            Subtable subtable;
+            subtable.packed = store.data(outer);
+            const ItemVariationData& packed = subtable.packed;
+            packedBytes += packed.itemCount * packed.rowSize;
+            bool wide = false;
+            for (uint16_t inner = 0; inner < packed.itemCount && !wide; ++inner) {
+                size_t row = packed.row_offset(inner);
+                for (uint16_t column = 0; column < packed.wordCount && packed.longWords && !wide; ++column) {
+                    int32_t delta = packed.delta(row, column);
+                    wide = delta < INT16_MIN || delta > INT16_MAX;
+                }
+            }
+            size_t deltaSize = wide ? 4 : 2;
+            size_t rowsPerBlock = 64 / deltaSize;
+            subtable.stride = (packed.itemCount + rowsPerBlock - 1) / rowsPerBlock * rowsPerBlock;
+            size_t bytes = subtable.stride * packed.regionIndexCount * deltaSize;
+            if (packed.itemCount && expandedBytes + bytes <= budget) {
+                subtable.expanded = true;
+                expandedBytes += bytes;
+                if (wide) {
+                    subtable.wide = AlignedArray<int32_t>(subtable.stride * packed.regionIndexCount);
+                } else {
+                    subtable.narrow = AlignedArray<int16_t>(subtable.stride * packed.regionIndexCount);
+                }
+                for (uint16_t inner = 0; inner < packed.itemCount; ++inner) {
+                    size_t row = packed.row_offset(inner);
+                    for (uint16_t column = 0; column < packed.regionIndexCount; ++column) {
+                        int32_t delta = packed.delta(row, column);
+                        if (wide) {
+                            subtable.wide[column * subtable.stride + inner] = delta;
+                        } else {
+                            subtable.narrow[column * subtable.stride + inner] = delta;
+                        }
+                    }
+                }
+            }
+            subtables.push_back(std::move(subtable));
+        }
+    }
+
+    // The deltas of every row of one subtable. regionScalars has the scalar of every region of the
+    // store, 0 for inactive ones; deltas is resized to the subtable's row count.
+    void deltas(uint16_t outer, const double* regionScalars, std::vector<double>* deltas) const {
+        if (outer >= subtables.size()) {
+            deltas->clear();
+            return;
+        }
+        const Subtable& subtable = subtables[outer];
+        const ItemVariationData& packed = subtable.packed;
+        deltas->assign(packed.itemCount, 0);
+        double* out = deltas->data();
+        for (uint16_t column = 0; column < packed.regionIndexCount; ++column) {
+            uint16_t region = packed.region_index(column);
+            double scalar = region < store.regionCount ? regionScalars[region] : 0;
+            if (!scalar) {
+                continue;
+            }
+            if (!subtable.expanded) {
+                for (uint16_t inner = 0; inner < packed.itemCount; ++inner) {
+                    out[inner] += scalar * packed.delta(packed.row_offset(inner), column);
+                }
+            } else if (subtable.wide.size) {
+                const int32_t* in = &subtable.wide[column * subtable.stride];
+                for (uint16_t inner = 0; inner < packed.itemCount; ++inner) {
+                    out[inner] += scalar * in[inner];
+                }
+            } else {
+                const int16_t* in = &subtable.narrow[column * subtable.stride];
+                for (uint16_t inner = 0; inner < packed.itemCount; ++inner) {
+                    out[inner] += scalar * in[inner];
+                }
+            }
+        }
+    }
+
+    // One row, for lookups that don't want a whole subtable.
+    double delta(uint16_t outer, uint16_t inner, const double* regionScalars) const {
+        if (outer >= subtables.size() || inner >= subtables[outer].packed.itemCount) {
+            return 0;
+        }
+        const Subtable& subtable = subtables[outer];
+        const ItemVariationData& packed = subtable.packed;
+        size_t row = packed.row_offset(inner);
+        double delta = 0;
+        for (uint16_t column = 0; column < packed.regionIndexCount; ++column) {
+            uint16_t region = packed.region_index(column);
+            double scalar = region < store.regionCount ? regionScalars[region] : 0;
+            if (!scalar) {
+                continue;
+            }
+            size_t at = column * subtable.stride + inner;
+            delta += scalar * (!subtable.expanded ? packed.delta(row, column) : subtable.wide.size ? subtable.wide[at] : subtable.narrow[at]);
+        }
+        return delta;
+    }
+};
+
+// Glyph outlines as gvar numbers their points, for the tools that build and compare fonts.
+
+constexpr uint32_t kGlyfTag = sfnt_tag('g', 'l', 'y', 'f');
+constexpr uint32_t kHeadTag = sfnt_tag('h', 'e', 'a', 'd');
+constexpr uint32_t kHheaTag = sfnt_tag('h', 'h', 'e', 'a');
+constexpr uint32_t kHmtxTag = sfnt_tag('h', 'm', 't', 'x');
+constexpr uint32_t kLocaTag = sfnt_tag('l', 'o', 'c', 'a');
+constexpr uint32_t kMaxpTag = sfnt_tag('m', 'a', 'x', 'p');
+
+// The tables a glyph's outline and metrics are read from.
+struct GlyfTables {
+    Reader glyf, loca, hmtx;
+    bool longOffsets = false;
+    uint16_t glyphCount = 0;
+    uint16_t metricCount = 0;
+};
+
+inline GlyfTables glyf_tables(const Reader& font) {
+    GlyfTables tables;
+    tables.glyf = sfnt_table(font, kGlyfTag);
+    tables.loca = sfnt_table(font, kLocaTag);
+    tables.hmtx = sfnt_table(font, kHmtxTag);
+    tables.longOffsets = HeadView(sfnt_table(font, kHeadTag)).indexToLocFormat() == 1;
+    tables.glyphCount = MaxpView(sfnt_table(font, kMaxpTag)).numGlyphs();
+    tables.metricCount = HheaView(sfnt_table(font, kHheaTag)).numberOfHMetrics();
+    return tables;
+}
+
+// A glyph's points: a simple glyph's outline points, or a composite's component offsets, one per
+// component, then the four phantom points for the left side bearing, the advance, the top and the
+// bottom. Without vmtx, which nothing here reads, the last two are at 0.
+struct GlyphOutline {
+    std::vector<int32_t> x, y;
+    std::vector<uint16_t> endPoints;  // the last point of each contour, a component being one of its own
+    std::vector<uint16_t> components; // a composite's component glyphs, empty for a simple glyph
+    std::vector<bool> onCurve;        // per outline point of a simple glyph
+    uint16_t advance = 0;
+};
+
+// A glyph's advance width and left side bearing. Glyphs past the last long metric share its advance
+// and have only a side bearing.
+inline std::pair<uint16_t, int16_t> horizontal_metrics(const GlyfTables& tables, uint16_t glyphID) {
+    uint16_t metric = std::min<uint16_t>(glyphID, std::max<uint16_t>(tables.metricCount, 1) - 1);
+    LongHorMetricView longMetric(tables.hmtx.at(metric * 4));
+    int16_t lsb = glyphID < tables.metricCount ? longMetric.lsb()
+                                               : tables.hmtx.i16(tables.metricCount * 4 + (glyphID - tables.metricCount) * 2);
+    return { longMetric.advanceWidth(), lsb };
+}
+
+// A glyph's glyf entry, empty for a glyph without an outline.
+inline Reader glyph_data(const GlyfTables& tables, uint16_t glyphID) {
+    size_t start, end;
+    if (tables.longOffsets) {
+        start = tables.loca.u32(glyphID * 4);
+        end = tables.loca.u32(glyphID * 4 + 4);
+    } else {
+        start = tables.loca.u16(glyphID * 2) * size_t(2);
+        end = tables.loca.u16(glyphID * 2 + 2) * size_t(2);
+    }
+    return end > start ? tables.glyf.at(start, end - start) : Reader();
+}
+
+inline GlyphOutline glyph_outline(const GlyfTables& tables, uint16_t glyphID) {
+    GlyphOutline outline;
+    Reader glyph = glyph_data(tables, glyphID);
+    GlyphHeaderView header(glyph);
+
+    if (header.numberOfContours() > 0) {
+        SfntArray<SfntU16> endPoints = header.endPtsOfContours();
+        if (endPoints.size() != size_t(header.numberOfContours())) {
+            endPoints = SfntArray<SfntU16>();
+        }
+        for (uint16_t endPoint : endPoints) {
+            outline.endPoints.push_back(endPoint);
+        }
+        size_t pointCount = outline.endPoints.empty() ? 0 : outline.endPoints.back() + size_t(1);
+        size_t p = GlyphHeaderView::kSize + endPoints.size() * 2;
+        p += 2 + glyph.u16(p); // instructions
+        std::vector<uint8_t> flags;
+        while (flags.size() < pointCount && p < glyph.length) {
+            uint8_t flag = glyph.u8(p++);
+            size_t repeat = flag & 0x08 ? 1 + glyph.u8(p++) : 1;
+            flags.insert(flags.end(), std::min(repeat, pointCount - flags.size()), flag);
+        }
+        flags.resize(pointCount);
+        // Coordinates are deltas from the previous point: a byte with its sign in the flags, a
+        // repeat of the previous value, or a signed word.
+        auto read_coordinates = [&](uint8_t shortBit, uint8_t sameBit, std::vector<int32_t>* coordinates) {
+            int32_t value = 0;
+            for (uint8_t flag : flags) {
+                if (flag & shortBit) {
+                    value += flag & sameBit ? glyph.u8(p) : -glyph.u8(p);
+                    p += 1;
+                } else if (!(flag & sameBit)) {
+                    value += glyph.i16(p);
+                    p += 2;
+                }
+                coordinates->push_back(value);
+            }
+        };
+        read_coordinates(0x02, 0x10, &outline.x);
+        read_coordinates(0x04, 0x20, &outline.y);
+        for (uint8_t flag : flags) {
+            outline.onCurve.push_back(flag & 0x01);
+        }
+    } else if (header.numberOfContours() < 0) {
+        size_t p = GlyphHeaderView::kSize;
+        uint16_t flags;
+        do {
+            flags = glyph.u16(p);
+            outline.components.push_back(glyph.u16(p + 2));
+            int32_t dx, dy;
+            if (flags & 0x0001) { // ARG_1_AND_2_ARE_WORDS
+                dx = glyph.i16(p + 4);
+                dy = glyph.i16(p + 6);
+                p += 8;
+            } else {
+                dx = glyph.i8(p + 4);
+                dy = glyph.i8(p + 5);
+                p += 6;
+            }
+            // Components placed by matching points have no offset to vary.
+            bool offset = flags & 0x0002; // ARGS_ARE_XY_VALUES
+            outline.x.push_back(offset ? dx : 0);
+            outline.y.push_back(offset ? dy : 0);
+            outline.endPoints.push_back(outline.x.size() - 1);
+            p += flags & 0x0008 ? 2 : flags & 0x0040 ? 4 : flags & 0x0080 ? 8 : 0; // the transform
+        } while (flags & 0x0020 && glyph.has(p, 4)); // MORE_COMPONENTS
+    }
+
+    auto [advance, lsb] = horizontal_metrics(tables, glyphID);
+    outline.advance = advance;
+    int32_t left = header.xMin() - lsb;
+    outline.x.insert(outline.x.end(), { left, left + outline.advance, 0, 0 });
+    outline.y.insert(outline.y.end(), { 0, 0, 0, 0 });
+    return outline;
+}
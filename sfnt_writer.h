@@ -0,0 +1,241 @@
+// Writing OpenType fonts: the big-endian Writer the tools build tables with, table checksums, and
+// FontSerializer, which encodes a font's tables on threads, lays them out in a file and writes it.
+// Like sfnt.h this doesn't depend on CoreText, nor on sfnt.h, so a tool can use either alone.
+
+#pragma once
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Big-endian table builder.
+struct Writer {
+    std::vector<uint8_t> data;
+
+    size_t size() const { return data.size(); }
+    void u8(uint8_t v) { data.push_back(v); }
+    void u16(uint16_t v) { u8(v >> 8); u8(v); }
+    void u32(uint32_t v) { u16(v >> 16); u16(v); }
+    void i16(int16_t v) { u16(static_cast<uint16_t>(v)); }
+    void fixed(double v) { u32(static_cast<uint32_t>(static_cast<int32_t>(std::lround(v * 65536)))); }
+    void f2dot14(double v) { i16(static_cast<int16_t>(std::lround(v * 16384))); }
+    void tag(uint32_t v) { u32(v); }
+    void bytes(const std::vector<uint8_t>& v) { data.insert(data.end(), v.begin(), v.end()); }
+    void pad(size_t alignment) {
+        while (data.size() % alignment) {
+            u8(0);
+        }
+    }
+    void patch16(size_t offset, uint16_t v) {
+        data[offset] = v >> 8;
+        data[offset + 1] = v;
+    }
+    void patch32(size_t offset, uint32_t v) {
+        patch16(offset, v >> 16);
+        patch16(offset + 2, v);
+    }
+};
+
+// The OpenType checksum: the sum of the bytes as big-endian u32s, the last one padded with 0s.
+// Rather than assembling words, each byte is added to the sum of its position in a word, 16
+// positions at a time, which the compiler turns into vector adds; the four sums are shifted into
+// place at the end. The 16 u32 sums hold 2^24 blocks before they could overflow.
+inline uint32_t sfnt_checksum(const uint8_t* data, size_t length) {
+    uint64_t lanes[4] = {};
+    size_t i = 0;
+    while (length - i >= 16) {
+        uint32_t sums[16] = {};
+        size_t end = i + std::min((length - i) / 16, size_t(1) << 24) * 16;
+        for (; i < end; i += 16) {
+            for (int j = 0; j < 16; ++j) {
+                sums[j] += data[i + j];
+            }
+        }
+        for (int j = 0; j < 16; ++j) {
+            lanes[j % 4] += sums[j];
+        }
+    }
+    for (; i < length; ++i) {
+        lanes[i % 4] += data[i];
+    }
+    return uint32_t((lanes[0] << 24) + (lanes[1] << 16) + (lanes[2] << 8) + lanes[3]);
+}
+
+inline uint32_t sfnt_checksum(const std::vector<uint8_t>& data) {
+    return sfnt_checksum(data.data(), data.size());
+}
+
+// A font file from its tables. Tables are added as bytes or as encoders, which finish() runs on up
+// to jobs threads, checksumming each table as it's done; tables that come out empty are left out.
+// The directory lists tables by tag, as it must, but they are laid out in the file with those in
+// order first, in that order, then the rest by tag. The file's checksum is the header's plus the
+// tables', so the font is never summed, or even put together, as a whole: write_file() writes the
+// tables from where they are with pwritev, and write() copies them into a buffer of size().
+struct FontSerializer {
+    int jobs = 1;
+    std::vector<uint32_t> order;
+    uint32_t sfntVersion = 0x00010000;
+
+    struct Table {
+        uint32_t tag = 0;
+        std::vector<uint8_t> data;
+        std::function<std::vector<uint8_t>()> encode;
+        uint32_t checksum = 0;
+        size_t offset = 0;
+    };
+    std::vector<Table> tables;      // by tag once finished
+    std::vector<size_t> layout;     // tables in file order
+    std::vector<uint8_t> header;    // the table directory
+    size_t fileSize = 0;
+
+    void add(uint32_t tag, std::vector<uint8_t> data) { tables.push_back({ tag, std::move(data), nullptr }); }
+    void add_encoder(uint32_t tag, std::function<std::vector<uint8_t>()> encode) { tables.push_back({ tag, {}, std::move(encode) }); }
+
+    void finish() {
+        constexpr uint32_t kHeadTag = 0x68656164;
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < std::min<size_t>(std::max(jobs, 1), tables.size()); ++i) {
+            workers.emplace_back([&] {
+                for (size_t i; (i = next++) < tables.size();) {
+                    Table& table = tables[i];
+                    if (table.encode) {
+                        table.data = table.encode();
+                        table.encode = nullptr;
+                    }
+                    if (table.tag == kHeadTag && table.data.size() >= 12) {
+                        // checksumAdjustment counts as 0 while summing.
+                        memset(table.data.data() + 8, 0, 4);
+                    }
+                    table.checksum = sfnt_checksum(table.data);
+                }
+            });
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        tables.erase(std::remove_if(tables.begin(), tables.end(), [](const Table& table) { return table.data.empty(); }),
+                     tables.end());
+        std::sort(tables.begin(), tables.end(), [](const Table& a, const Table& b) { return a.tag < b.tag; });
+
+        auto rank = [&](const Table& table) {
+            return size_t(std::find(order.begin(), order.end(), table.tag) - order.begin());
+        };
+        layout.clear();
+        for (size_t i = 0; i < tables.size(); ++i) {
+            layout.push_back(i);
+        }
+        std::stable_sort(layout.begin(), layout.end(), [&](size_t a, size_t b) { return rank(tables[a]) < rank(tables[b]); });
+        size_t offset = 12 + tables.size() * 16;
+        for (size_t i : layout) {
+            tables[i].offset = offset;
+            offset += (tables[i].data.size() + 3) & ~size_t(3);
+        }
+        fileSize = offset;
+
+        Writer w;
+        uint16_t numTables = tables.size();
+        uint16_t searchRange = 1, entrySelector = 0;
+        while (searchRange * 2 <= numTables) {
+            searchRange *= 2;
+            ++entrySelector;
+        }
+        w.u32(sfntVersion);
+        w.u16(numTables);
+        w.u16(searchRange * 16);
+        w.u16(entrySelector);
+        w.u16(numTables * 16 - searchRange * 16);
+        uint32_t sum = 0;
+        Table* head = nullptr;
+        for (Table& table : tables) {
+            w.tag(table.tag);
+            w.u32(table.checksum);
+            w.u32(table.offset);
+            w.u32(table.data.size());
+            sum += table.checksum;
+            if (table.tag == kHeadTag && table.data.size() >= 12) {
+                head = &table;
+            }
+        }
+        header = std::move(w.data);
+        if (head) {
+            uint32_t adjustment = 0xB1B0AFBA - (sum + sfnt_checksum(header));
+            for (int i = 0; i < 4; ++i) {
+                head->data[8 + i] = adjustment >> (24 - i * 8);
+            }
+        }
+    }
+
+    size_t size() const { return fileSize; }
+
+    // A finished table's bytes, or null if the font doesn't have it.
+    const std::vector<uint8_t>* table(uint32_t tag) const {
+        for (const Table& table : tables) {
+            if (table.tag == tag) {
+                return &table.data;
+            }
+        }
+        return nullptr;
+    }
+
+    void write(uint8_t* buffer) const {
+        memcpy(buffer, header.data(), header.size());
+        for (size_t i : layout) {
+            const Table& table = tables[i];
+            memcpy(buffer + table.offset, table.data.data(), table.data.size());
+            memset(buffer + table.offset + table.data.size(), 0, (4 - table.data.size() % 4) % 4);
+        }
+    }
+
+    std::vector<uint8_t> data() const {
+        std::vector<uint8_t> data(size());
+        write(data.data());
+        return data;
+    }
+
+    // One pwritev, or a few for fonts with more tables than an iovec array takes, or when the
+    // system writes less than asked.
+    bool write_file(const char* path) const {
+        static const uint8_t kPadding[3] = {};
+        std::vector<iovec> parts = { { const_cast<uint8_t*>(header.data()), header.size() } };
+        for (size_t i : layout) {
+            const Table& table = tables[i];
+            parts.push_back({ const_cast<uint8_t*>(table.data.data()), table.data.size() });
+            parts.push_back({ const_cast<uint8_t*>(kPadding), (4 - table.data.size() % 4) % 4 });
+        }
+        int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file < 0) {
+            return false;
+        }
+        off_t offset = 0;
+        size_t part = 0;
+        bool written = true;
+        while (part < parts.size()) {
+            ssize_t length = pwritev(file, &parts[part], std::min<size_t>(parts.size() - part, IOV_MAX), offset);
+            if (length <= 0) {
+                written = false;
+                break;
+            }
+            offset += length;
+            // Past what was written, which can end partway through a part.
+            for (; part < parts.size() && size_t(length) >= parts[part].iov_len; ++part) {
+                length -= parts[part].iov_len;
+            }
+            if (part < parts.size()) {
+                parts[part].iov_base = static_cast<uint8_t*>(parts[part].iov_base) + length;
+                parts[part].iov_len -= length;
+            }
+        }
+        return close(file) == 0 && written;
+    }
+};
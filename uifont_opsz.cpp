@@ -12,31 +12,144 @@
 // results in the variation not being set, but the resulting copy correctly compares equal to the original.
 
 #include <ApplicationServices/ApplicationServices.h>
+#include <malloc/malloc.h>
 
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "sfnt.h"
+#include "sfnt_writer.h"
+
+#include <algorithm>
+#include <functional>
 #include <initializer_list>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <filesystem>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <random>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
-CTFontRef make_ctfont_from_file(const char* file, CGFloat size) {
+// Which pages of a font file CoreText reads, and in what order. The file is mapped with no access,
+// so the first read of each page faults; the handler notes the page, makes it readable and lets the
+// read go on. Faults elsewhere put the previous handlers back and fault again, to crash as before.
+// Reads the kernel makes on CoreText's behalf (a buffer passed to a system call) aren't seen.
+struct PageTrace {
+    uintptr_t begin = 0;
+    uintptr_t end = 0;
+    size_t pageSize = 0;
+    std::vector<uint32_t> pages; // sized up front, as the handler can't allocate
+    std::atomic<size_t> count{0};
+    bool active = false; // between start() and stop()
+
+    void start(void* mapping, size_t length);
+    // The pages read, in the order they were first read; none if the trace never started.
+    std::vector<uint32_t> stop();
+};
+
+PageTrace* gPageTrace;
+struct sigaction gPreviousSegv, gPreviousBus;
+
+void page_trace_handler(int, siginfo_t* info, void*) {
+    PageTrace* trace = gPageTrace;
+    uintptr_t address = reinterpret_cast<uintptr_t>(info->si_addr);
+    if (!trace || address < trace->begin || address >= trace->end) {
+        sigaction(SIGSEGV, &gPreviousSegv, nullptr);
+        sigaction(SIGBUS, &gPreviousBus, nullptr);
+        return;
+    }
+    size_t page = (address - trace->begin) / trace->pageSize;
+    size_t i = trace->count++;
+    if (i < trace->pages.size()) {
+        trace->pages[i] = page;
+    }
+    mprotect(reinterpret_cast<void*>(trace->begin + page * trace->pageSize), trace->pageSize, PROT_READ);
+}
+
+void PageTrace::start(void* mapping, size_t length) {
+    pageSize = sysconf(_SC_PAGESIZE);
+    begin = reinterpret_cast<uintptr_t>(mapping);
+    end = begin + length;
+    // Two threads can fault on a page at once, so a page can be noted twice.
+    pages.assign((length + pageSize - 1) / pageSize * 2, 0);
+    count = 0;
+    active = true;
+    gPageTrace = this;
+    struct sigaction action = {};
+    action.sa_sigaction = page_trace_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &gPreviousSegv);
+    sigaction(SIGBUS, &action, &gPreviousBus);
+}
+
+std::vector<uint32_t> PageTrace::stop() {
+    // The file may not have been mapped, in which case there are no handlers to restore.
+    if (!active) {
+        return {};
+    }
+    active = false;
+    gPageTrace = nullptr;
+    mprotect(reinterpret_cast<void*>(begin), end - begin, PROT_READ);
+    sigaction(SIGSEGV, &gPreviousSegv, nullptr);
+    sigaction(SIGBUS, &gPreviousBus, nullptr);
+    std::vector<uint32_t> firstReads;
+    std::vector<bool> seen((end - begin + pageSize - 1) / pageSize);
+    for (size_t i = 0; i < std::min(count.load(), pages.size()); ++i) {
+        if (!seen[pages[i]]) {
+            seen[pages[i]] = true;
+            firstReads.push_back(pages[i]);
+        }
+    }
+    return firstReads;
+}
+
+// With a trace, the file's pages are traced from when it's mapped until trace->stop(). A file that
+// can't be opened or mapped is reported on stderr, so that when sweep workers open fonts the report
+// doesn't land in the middle of the cell-ordered output on stdout.
+CTFontRef make_ctfont_from_file(const char* file, CGFloat size, PageTrace* trace = nullptr) {
     struct Data { void* addr; size_t length; };
 
     FILE* fileHandle = fopen(file, "rb");
     if (!fileHandle) {
-        printf("Could not open: %s\n", file);
+        fprintf(stderr, "Could not open: %s\n", file);
         return nullptr;
     }
     int fileDescriptor = fileno(fileHandle);
     struct stat fileStatus;
     int err = fstat(fileDescriptor, &fileStatus);
     size_t fileSize = static_cast<size_t>(fileStatus.st_size);
-    void* fileMmap = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    void* fileMmap = mmap(nullptr, fileSize, trace ? PROT_NONE : PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
     fclose(fileHandle);
+    if (fileMmap == MAP_FAILED) {
+        fprintf(stderr, "Could not map: %s\n", file);
+        return nullptr;
+    }
+    if (trace) {
+        trace->start(fileMmap, fileSize);
+    }
     Data* info = new Data{fileMmap, fileSize};
     CFAllocatorContext ctx = {
         0, // CFIndex version
@@ -58,6 +171,11 @@ CTFontRef make_ctfont_from_file(const char* file, CGFloat size) {
     CFRelease(alloc);
 
     CTFontDescriptorRef desc = CTFontManagerCreateFontDescriptorFromData(fileData);
+    if (!desc) {
+        printf("Not a font: %s\n", file);
+        CFRelease(fileData);
+        return nullptr;
+    }
     CTFontRef ctFont = CTFontCreateWithFontDescriptor(desc, size, nullptr);
     CFRelease(fileData);
     CFRelease(desc);
@@ -70,6 +188,31 @@ CTFontRef make_ctfont_from_uifont(CGFloat size) {
     return CTFontCreateUIFontForLanguage(kCTFontUIFontSystem, size, nullptr);
 }
 
+// A read-only mapping of a whole file, unmapped when it goes.
+struct MappedFile {
+    void* mapping = MAP_FAILED;
+    size_t length = 0;
+
+    explicit MappedFile(const char* path) {
+        int file = open(path, O_RDONLY);
+        struct stat status;
+        if (file >= 0 && !fstat(file, &status) && status.st_size > 0) {
+            length = status.st_size;
+            mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, file, 0);
+        }
+        if (file >= 0) {
+            close(file);
+        }
+    }
+    ~MappedFile() {
+        if (mapping != MAP_FAILED) {
+            munmap(mapping, length);
+        }
+    }
+    bool ok() const { return mapping != MAP_FAILED; }
+    Reader reader() const { return ok() ? Reader{ static_cast<const uint8_t*>(mapping), length } : Reader(); }
+};
+
 std::string tag_to_string(uint32_t tag) {
     char buffer[5];
     buffer[0] = (tag & 0xff000000) >> 24;
@@ -84,221 +227,3207 @@ uint32_t constexpr make_tag(char a, char b, char c, char d) {
     return (((uint32_t)a << 24) | ((uint32_t)b << 16) | ((uint32_t)c << 8) | (uint32_t)d);
 }
 
-int main() {
-  struct TestCase {
-      CTFontRef font;
-      const char* name;
-      ~TestCase() { CFRelease(font); }
-  } testCases[] = {
-      { make_ctfont_from_uifont(24), "SystemUI size 24" },
-      { make_ctfont_from_file("/System/Library/Fonts/SFNS.ttf", 24), "/System/Library/Fonts/SFNS.ttf" },
-      //{ make_ctfont_from_file("SFNS#1.ttf", 24), "/System/Library/Fonts/SFNS.ttf" },
- 
-      { make_ctfont_from_uifont(17.00), "SystemUI size 17.00" },
-      { make_ctfont_from_uifont(17.01), "SystemUI size 17.01" },
-      { make_ctfont_from_uifont(95.99), "SystemUI size 95.99" },
-      { make_ctfont_from_uifont(96.00), "SystemUI size 96.00" },
-  };
+constexpr uint32_t kOpszTag = make_tag('o', 'p', 's', 'z');
+constexpr uint32_t kWdthTag = make_tag('w', 'd', 't', 'h');
+constexpr uint32_t kWghtTag = make_tag('w', 'g', 'h', 't');
+
+// The sweep visits every (omit_opsz, axis_to_bump, wghtValue) combination for each test case.
+// The order is fixed, so a cell index always names the same request.
+constexpr bool kOmitOpszValues[] = { false, true };
+constexpr uint32_t kAxisToBumpValues[] = { 0u, kOpszTag, kWdthTag };
+constexpr CGFloat kWghtValues[] = { 100, 200, 300, 400, 500, 600, 700, 800, 900 };
+constexpr uint32_t kCellsPerCase = std::size(kOmitOpszValues) * std::size(kAxisToBumpValues) * std::size(kWghtValues);
+
+struct SweepCell {
+    uint32_t caseIndex;
+    bool omitOpsz;
+    uint32_t axisToBump;
+    CGFloat wghtValue;
+};
+
+SweepCell sweep_cell(uint32_t cell) {
+    uint32_t inCase = cell % kCellsPerCase;
+    uint32_t wghtIndex = inCase % std::size(kWghtValues);
+    uint32_t bumpIndex = inCase / std::size(kWghtValues) % std::size(kAxisToBumpValues);
+    uint32_t omitIndex = inCase / std::size(kWghtValues) / std::size(kAxisToBumpValues);
+    return { cell / kCellsPerCase, kOmitOpszValues[omitIndex], kAxisToBumpValues[bumpIndex], kWghtValues[wghtIndex] };
+}
+
+// Axes a SweepRecord holds. Fonts can have more; their records hold the first kMaxAxes and are
+// flagged kAxesTruncated.
+constexpr int kMaxAxes = 8;
+// Axes read from a font, and driven in requests and instance keys; AxisMask has a bit for each.
+constexpr int kMaxFontAxes = 64;
+
+enum : uint8_t {
+    kVariationEqual = 1 << 0,
+    kFontEqual = 1 << 1,
+    kWorkerCrashed = 1 << 2,
+    kCopyWithAttributes = 1 << 3,
+    kAxesTruncated = 1 << 4,
+    kFontNotLoaded = 1 << 5,
+};
+
+// One fixed-size record per sweep cell, in native byte order with no padding, so a results file
+// can be mapped straight into NumPy. README.md has the matching dtype.
+struct SweepRecord {
+    uint32_t cell;
+    uint16_t caseIndex;
+    uint8_t omitOpsz;
+    uint8_t flags;
+    uint32_t axisToBump;
+    uint32_t axisCount;
+    uint32_t tags[kMaxAxes];
+    double original[kMaxAxes];
+    double requested[kMaxAxes]; // NaN for axes left out of the request
+    double result[kMaxAxes];    // NaN for axes the result font doesn't have
+};
+static_assert(sizeof(SweepRecord) == 240, "SweepRecord is the on-disk results format");
+
+struct AxisValues {
+    int count = 0;
+    int fontAxisCount = 0; // more than count if the font has more than kMaxFontAxes
+    uint32_t tags[kMaxFontAxes];
+    double values[kMaxFontAxes];
+    double minimums[kMaxFontAxes];
+    double defaults[kMaxFontAxes];
+    double maximums[kMaxFontAxes];
+
+    double find(uint32_t tag) const {
+        for (int i = 0; i < count; ++i) {
+            if (tags[i] == tag) {
+                return values[i];
+            }
+        }
+        return NAN;
+    }
+};
+
+// The value of every axis of font, in axis order. Axes without an explicit variation use their default.
+AxisValues read_axis_values(CTFontRef font) {
+    AxisValues axisValues;
+    CFArrayRef axes = CTFontCopyVariationAxes(font);
+    if (!axes) {
+        return axisValues;
+    }
+    CFIndex axisCount = CFArrayGetCount(axes);
+    CFDictionaryRef variation = CTFontCopyVariation(font);
+
+    axisValues.fontAxisCount = axisCount;
+    for (int i = 0; i < axisCount && axisValues.count < kMaxFontAxes; ++i) {
+        CFDictionaryRef axis = static_cast<CFDictionaryRef>(CFArrayGetValueAtIndex(axes, i));
+
+        long tagLong;
+        CFNumberRef tagNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(axis, kCTFontVariationAxisIdentifierKey));
+        CFNumberGetValue(tagNumber, kCFNumberLongType, &tagLong);
+
+        double defDouble;
+        CFNumberRef defNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(axis, kCTFontVariationAxisDefaultValueKey));
+        CFNumberGetValue(defNumber, kCFNumberDoubleType, &defDouble);
+
+        double minDouble;
+        CFNumberRef minNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(axis, kCTFontVariationAxisMinimumValueKey));
+        CFNumberGetValue(minNumber, kCFNumberDoubleType, &minDouble);
+
+        double maxDouble;
+        CFNumberRef maxNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(axis, kCTFontVariationAxisMaximumValueKey));
+        CFNumberGetValue(maxNumber, kCFNumberDoubleType, &maxDouble);
+
+        double valueDouble = defDouble;
+
+        CFNumberRef currentNumber = variation ? static_cast<CFNumberRef>(CFDictionaryGetValue(variation, tagNumber)) : nullptr;
+        if (currentNumber) {
+            double currentDouble;
+            CFNumberGetValue(currentNumber, kCFNumberDoubleType, &currentDouble);
+            valueDouble = currentDouble;
+        }
+
+        axisValues.tags[axisValues.count] = tagLong;
+        axisValues.values[axisValues.count] = valueDouble;
+        axisValues.minimums[axisValues.count] = minDouble;
+        axisValues.defaults[axisValues.count] = defDouble;
+        axisValues.maximums[axisValues.count] = maxDouble;
+        ++axisValues.count;
+    }
+
+    if (variation) {
+        CFRelease(variation);
+    }
+    CFRelease(axes);
+    return axisValues;
+}
+
+// A table of a font as CoreText hands it back, kept alive as long as its Reader is in use. Empty
+// if the font doesn't have the table.
+struct CopiedTable {
+    CFDataRef data;
+    Reader reader;
+
+    CopiedTable(CTFontRef font, uint32_t tag) : data(CTFontCopyTable(font, tag, kCTFontTableOptionNoOptions)) {
+        if (data) {
+            reader = { CFDataGetBytePtr(data), static_cast<size_t>(CFDataGetLength(data)) };
+        }
+    }
+    CopiedTable(const CopiedTable&) = delete;
+    CopiedTable& operator=(const CopiedTable&) = delete;
+    ~CopiedTable() {
+        if (data) {
+            CFRelease(data);
+        }
+    }
+};
+
+// The most memory FontVariations may spend on expanding a font's delta rows (HVAR, then MVAR, then
+// GDEF) into ExpandedItemVariationStores; set with --delta-budget. 0 keeps every row packed.
+size_t gDeltaExpansionBudget = 16 << 20;
+
+constexpr uint32_t kGdefTag = make_tag('G', 'D', 'E', 'F');
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Sidecar files: what FontVariations builds from a font's tables rather than reads, which is which
+// axes move each glyph and metric and the HVAR and gvar region indexes, saved in a directory given
+// with --sidecars so that the next process to open the font maps them in instead. A sidecar is
+// named by its key and by kSidecarVersion, so it's found from the font wherever the font lives,
+// and a change to how they're built just makes new files. The key costs the same for any size of
+// font: it hashes the glyph count, the head table, whose checksumAdjustment covers the whole file,
+// and the lengths of the tables the sidecar is built from. That finds the file, but a font whose
+// tables changed without a change to any of those would find a stale one, so the header also holds
+// a hash of those tables' content, which loading checks. --trust-sidecars skips that check, and
+// with it a read of every byte of the tables, for fonts known to be rebuilt properly. The file is a
+// header then arrays, native-endian and 8-byte aligned: loading is a bounds check, a hash of the
+// file and a copy per array. --catalog writes them.
+
+const char* gSidecarDirectory = nullptr;
+bool gTrustSidecars = false;
+
+// Bump when the file layout, the key, or what AxisInfluence or RegionIndex hold, changes.
+constexpr uint32_t kSidecarVersion = 2;
+constexpr uint32_t kSidecarMagic = make_tag('U', 'O', 'S', 'C');
+constexpr uint32_t kSidecarByteOrder = 0x01020304;
+
+enum SidecarArray {
+    kSidecarAxisTags,
+    kSidecarOutlineAxes,
+    kSidecarAdvanceAxes,
+    kSidecarMetricAxes,
+    // Each RegionIndex is four arrays, in the order of RegionIndexArray.
+    kSidecarAdvanceRegions,
+    kSidecarSharedTuples = kSidecarAdvanceRegions + 4,
+    kSidecarArrayCount = kSidecarSharedTuples + 4,
+};
+
+enum RegionIndexArray {
+    kRegionTriples,
+    kRegionFiled,      // every axis's, one after another
+    kRegionFiledCount, // per axis
+    kRegionEverywhere,
+};
+
+struct SidecarHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t glyphCount;
+    uint64_t key;
+    uint64_t payloadHash; // content_hash of everything after the header
+    uint64_t tablesHash;  // sidecar_tables_hash of the font
+    uint8_t fromGvar;
+    uint8_t fromHvar;
+    uint8_t reserved[6];
+    struct {
+        uint64_t offset;
+        uint64_t count;
+    } arrays[kSidecarArrayCount];
+};
+static_assert(sizeof(SidecarHeader) % 8 == 0, "arrays start 8-byte aligned");
+
+// AxisInfluence::metricAxes and RegionIndex::Filed entries, without padding of unknown value.
+struct SidecarMetricAxes {
+    uint32_t tag;
+    uint32_t reserved;
+    AxisMask axes;
+};
 
-  constexpr uint32_t kOpszTag = make_tag('o', 'p', 's', 'z');
-  constexpr uint32_t kWdthTag = make_tag('w', 'd', 't', 'h');
-  constexpr uint32_t kWghtTag = make_tag('w', 'g', 'h', 't');
+struct SidecarFiled {
+    double start;
+    double end;
+    uint32_t region;
+    uint32_t reserved;
+};
 
-  for (const TestCase& testCase : testCases) {
-      CTFontRef originalFont = testCase.font;
-      CTFontDescriptorRef originalDescriptor = CTFontCopyFontDescriptor(originalFont);
-      CFArrayRef originalAxes = CTFontCopyVariationAxes(originalFont);
-      CFIndex originalAxisCount = CFArrayGetCount(originalAxes);
-      CFDictionaryRef originalVariation = CTFontCopyVariation(originalFont);
+// A 64-bit hash of bytes, 32 at a time in four independent lanes so it runs at about memory speed.
+// Good for telling fonts apart, not against someone making them collide.
+uint64_t content_hash(const uint8_t* data, size_t length) {
+    constexpr uint64_t kPrime1 = 0x9e3779b185ebca87ull, kPrime2 = 0xc2b2ae3d27d4eb4full;
+    uint64_t lanes[4] = { kPrime1 + kPrime2, kPrime2, 0, 0 - kPrime1 };
+    size_t i = 0;
+    for (; length - i >= 32; i += 32) {
+        for (int lane = 0; lane < 4; ++lane) {
+            uint64_t word;
+            memcpy(&word, data + i + lane * 8, 8);
+            lanes[lane] += word * kPrime2;
+            lanes[lane] = (lanes[lane] << 31 | lanes[lane] >> 33) * kPrime1;
+        }
+    }
+    uint64_t hash = fnv1a(0xcbf29ce484222325ull, lanes, sizeof(lanes));
+    hash = fnv1a(hash, data + i, length - i);
+    return fnv1a(hash, &length, sizeof(length));
+}
+
+uint64_t sidecar_key(const Reader& head, std::initializer_list<Reader> tables, uint32_t glyphCount) {
+    uint64_t key = fnv1a(0xcbf29ce484222325ull, &glyphCount, sizeof(glyphCount));
+    key = fnv1a(key, head.data, head.length);
+    for (const Reader& table : tables) {
+        uint64_t length = table.length;
+        key = fnv1a(key, &length, sizeof(length));
+    }
+    return key;
+}
+
+uint64_t sidecar_tables_hash(std::initializer_list<Reader> tables) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const Reader& table : tables) {
+        uint64_t tableHash = content_hash(table.data, table.length);
+        hash = fnv1a(hash, &tableHash, sizeof(tableHash));
+    }
+    return hash;
+}
+
+std::string sidecar_path(uint64_t key) {
+    char name[64];
+    snprintf(name, sizeof(name), "/%016llx.v%u.sidecar", (unsigned long long)key, kSidecarVersion);
+    return gSidecarDirectory + std::string(name);
+}
+
+// Written under a temporary name and renamed, so that catalog workers sweeping copies of one font
+// never read each other's half-written files.
+bool write_sidecar(uint64_t key, uint64_t tablesHash, const AxisInfluence& influence, const RegionIndex& advanceRegions,
+                   const RegionIndex& sharedTuples) {
+    SidecarHeader header = {};
+    header.magic = kSidecarMagic;
+    header.version = kSidecarVersion;
+    header.byteOrder = kSidecarByteOrder;
+    header.glyphCount = influence.outlineAxes.size();
+    header.key = key;
+    header.tablesHash = tablesHash;
+    header.fromGvar = influence.fromGvar;
+    header.fromHvar = influence.fromHvar;
+    std::vector<uint8_t> payload;
+    auto add = [&](int array, const auto& values) {
+        payload.resize((payload.size() + 7) & ~size_t(7));
+        header.arrays[array] = { sizeof(header) + payload.size(), values.size() };
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(values.data());
+        payload.insert(payload.end(), bytes, bytes + values.size() * sizeof(values[0]));
+    };
+    add(kSidecarAxisTags, influence.axisTags);
+    add(kSidecarOutlineAxes, influence.outlineAxes);
+    add(kSidecarAdvanceAxes, influence.advanceAxes);
+    std::vector<SidecarMetricAxes> metricAxes;
+    for (const auto& [tag, axes] : influence.metricAxes) {
+        metricAxes.push_back({ tag, 0, axes });
+    }
+    add(kSidecarMetricAxes, metricAxes);
+    for (const auto& [first, index] : { std::make_pair(kSidecarAdvanceRegions, &advanceRegions),
+                                        std::make_pair(kSidecarSharedTuples, &sharedTuples) }) {
+        std::vector<SidecarFiled> filed;
+        std::vector<uint32_t> filedCounts;
+        for (const std::vector<RegionIndex::Filed>& axisFiled : index->byAxis) {
+            for (const RegionIndex::Filed& f : axisFiled) {
+                filed.push_back({ f.start, f.end, f.region, 0 });
+            }
+            filedCounts.push_back(axisFiled.size());
+        }
+        add(first + kRegionTriples, index->triples);
+        add(first + kRegionFiled, filed);
+        add(first + kRegionFiledCount, filedCounts);
+        add(first + kRegionEverywhere, index->everywhere);
+    }
+    header.payloadHash = content_hash(payload.data(), payload.size());
+
+    std::string path = sidecar_path(key);
+    std::string temporaryPath = path + "." + std::to_string(getpid());
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+    written = !fclose(file) && written && !rename(temporaryPath.c_str(), path.c_str());
+    if (!written) {
+        unlink(temporaryPath.c_str());
+    }
+    return written;
+}
+
+// What the font's tables say a sidecar's structures must look like. A sidecar that doesn't fit was
+// built from other tables, and its regions could index past the font's.
+struct SidecarShape {
+    uint32_t glyphCount = 0;
+    std::vector<uint32_t> axisTags; // fvar's
+    int advanceAxisCount = 0;       // HVAR's store's
+    size_t advanceRegionCount = 0;
+    int sharedTupleAxisCount = 0;   // gvar's
+    size_t sharedTupleCount = 0;
+};
+
+// Fills in what the font's sidecar holds, if it has a valid one. Anything off (another version or
+// byte order, a hash that doesn't match, an array out of bounds, a region out of range, or axis or
+// region counts other than the font's) makes it invalid, and the caller builds the structures as
+// if there were no sidecar. tablesHash, if not null, must match the one the sidecar was written
+// with.
+bool read_sidecar(uint64_t key, const uint64_t* tablesHash, const SidecarShape& shape, AxisInfluence* influence,
+                  RegionIndex* advanceRegions, RegionIndex* sharedTuples) {
+    MappedFile file(sidecar_path(key).c_str());
+    if (!file.ok() || file.length < sizeof(SidecarHeader)) {
+        return false;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(file.mapping);
+    SidecarHeader header;
+    memcpy(&header, bytes, sizeof(header));
+    if (header.magic != kSidecarMagic || header.version != kSidecarVersion || header.byteOrder != kSidecarByteOrder ||
+        header.key != key || header.glyphCount != shape.glyphCount || (tablesHash && header.tablesHash != *tablesHash) ||
+        header.payloadHash != content_hash(bytes + sizeof(header), file.length - sizeof(header))) {
+        return false;
+    }
+    auto read = [&](int array, auto* values) {
+        using Value = typename std::remove_pointer_t<decltype(values)>::value_type;
+        uint64_t offset = header.arrays[array].offset, count = header.arrays[array].count;
+        if (offset % 8 || offset > file.length || count > (file.length - offset) / sizeof(Value)) {
+            return false;
+        }
+        const Value* first = reinterpret_cast<const Value*>(bytes + offset);
+        values->assign(first, first + count);
+        return true;
+    };
+
+    std::vector<SidecarMetricAxes> metricAxes;
+    if (!read(kSidecarAxisTags, &influence->axisTags) || !read(kSidecarOutlineAxes, &influence->outlineAxes) ||
+        !read(kSidecarAdvanceAxes, &influence->advanceAxes) || !read(kSidecarMetricAxes, &metricAxes) ||
+        influence->axisTags != shape.axisTags || influence->outlineAxes.size() != shape.glyphCount ||
+        influence->advanceAxes.size() != shape.glyphCount) {
+        return false;
+    }
+    influence->metricAxes.clear();
+    for (const SidecarMetricAxes& metric : metricAxes) {
+        influence->metricAxes.emplace_back(metric.tag, metric.axes);
+    }
+    influence->fromGvar = header.fromGvar;
+    influence->fromHvar = header.fromHvar;
+
+    struct Expected {
+        int first;
+        RegionIndex* index;
+        int axisCount;
+        size_t regionCount;
+    };
+    for (const auto& [first, index, axisCount, regionCount] :
+         { Expected{ kSidecarAdvanceRegions, advanceRegions, shape.advanceAxisCount, shape.advanceRegionCount },
+           Expected{ kSidecarSharedTuples, sharedTuples, shape.sharedTupleAxisCount, shape.sharedTupleCount } }) {
+        std::vector<SidecarFiled> filed;
+        std::vector<uint32_t> filedCounts;
+        if (!read(first + kRegionTriples, &index->triples) || !read(first + kRegionFiled, &filed) ||
+            !read(first + kRegionFiledCount, &filedCounts) || !read(first + kRegionEverywhere, &index->everywhere)) {
+            return false;
+        }
+        index->axisCount = filedCounts.size();
+        if (index->axisCount ? index->triples.size() % (index->axisCount * 3) : !index->triples.empty()) {
+            return false;
+        }
+        if (index->axisCount != axisCount || index->size() != regionCount) {
+            return false;
+        }
+        index->kernel = region_scalar_kernel(index->axisCount);
+        index->byAxis.assign(index->axisCount, {});
+        size_t next = 0;
+        for (int axis = 0; axis < index->axisCount; ++axis) {
+            for (uint32_t i = 0; i < filedCounts[axis]; ++i, ++next) {
+                if (next >= filed.size() || filed[next].region >= index->size()) {
+                    return false;
+                }
+                index->byAxis[axis].push_back({ filed[next].start, filed[next].end, filed[next].region });
+            }
+        }
+        if (next != filed.size() || std::any_of(index->everywhere.begin(), index->everywhere.end(),
+                                                [&](uint32_t region) { return region >= index->size(); })) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// What the variation tables of a font say, parsed once, the first time something asks.
+struct FontVariations {
+    CopiedTable fvar;
+    CopiedTable avar;
+    CopiedTable gvar;
+    CopiedTable hvar;
+    CopiedTable mvar;
+    CopiedTable gdef;
+    std::vector<FvarAxis> axes;
+    AxisInfluence influence;
+    ItemVariationStore advanceStore; // HVAR's
+    Reader advanceMap;
+    SparseItemVariationStore sparseAdvanceStore;
+    RegionIndex sharedTuples; // gvar's
+    ExpandedItemVariationStore expandedAdvanceStore;
+    ExpandedItemVariationStore expandedMetricStore; // MVAR's
+    ExpandedItemVariationStore expandedGdefStore;
+    NormalizeKernel normalizeKernel; // for the font's axis count
+    uint64_t sidecarKey = 0;         // set with --sidecars
+    uint64_t sidecarTablesHash = 0;  // set with --sidecars, unless read from a trusted sidecar
+    bool fromSidecar = false;
+    double acceleratorSeconds = 0;   // influence and the region indexes, built or read from the sidecar
+
+    explicit FontVariations(CTFontRef font)
+        : fvar(font, kFvarTag)
+        , avar(font, kAvarTag)
+        , gvar(font, kGvarTag)
+        , hvar(font, kHvarTag)
+        , mvar(font, kMvarTag)
+        , gdef(font, kGdefTag)
+        , axes(fvar_axes(fvar.reader))
+        , advanceStore(HvarView(hvar.reader).itemVariationStore())
+        , advanceMap(HvarView(hvar.reader).advanceWidthMapping())
+        , normalizeKernel(normalize_kernel(axes.size())) {
+        auto begin = std::chrono::steady_clock::now();
+        uint32_t glyphCount = CTFontGetGlyphCount(font);
+        RegionIndex advanceRegions;
+        if (gSidecarDirectory) {
+            CopiedTable head(font, kHeadTag);
+            sidecarKey = sidecar_key(head.reader, { fvar.reader, gvar.reader, hvar.reader, mvar.reader }, glyphCount);
+            if (!gTrustSidecars) {
+                sidecarTablesHash = sidecar_tables_hash({ fvar.reader, gvar.reader, hvar.reader, mvar.reader });
+            }
+            SidecarShape shape;
+            shape.glyphCount = glyphCount;
+            shape.axisTags = fvar_axis_tags(fvar.reader);
+            // As ivs_region_index and gvar_shared_tuple_index would build them: no axes, no regions.
+            shape.advanceAxisCount = advanceStore.axisCount;
+            shape.advanceRegionCount = advanceStore.axisCount ? advanceStore.regionCount : 0;
+            GvarView gvarTable(gvar.reader);
+            shape.sharedTupleAxisCount = gvarTable.axisCount();
+            shape.sharedTupleCount = gvarTable.axisCount() ? gvarTable.sharedTupleCount() : 0;
+            fromSidecar = read_sidecar(sidecarKey, gTrustSidecars ? nullptr : &sidecarTablesHash, shape,
+                                       &influence, &advanceRegions, &sharedTuples);
+        }
+        if (!fromSidecar) {
+            if (gSidecarDirectory && gTrustSidecars) {
+                // Building reads every table anyway; the hash goes into the sidecar written for it.
+                sidecarTablesHash = sidecar_tables_hash({ fvar.reader, gvar.reader, hvar.reader, mvar.reader });
+            }
+            influence = build_axis_influence(fvar.reader, gvar.reader, hvar.reader, mvar.reader, glyphCount);
+            advanceRegions = ivs_region_index(advanceStore);
+            sharedTuples = gvar_shared_tuple_index(gvar.reader);
+        }
+        sparseAdvanceStore = SparseItemVariationStore(advanceStore, std::move(advanceRegions));
+        acceleratorSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
 
-      CFMutableDictionaryRef originalResolvedVariation = 
+        size_t budget = gDeltaExpansionBudget;
+        expandedAdvanceStore = ExpandedItemVariationStore(advanceStore, budget);
+        budget -= expandedAdvanceStore.expandedBytes;
+        expandedMetricStore = ExpandedItemVariationStore(ItemVariationStore(MvarView(mvar.reader).itemVariationStore()), budget);
+        budget -= expandedMetricStore.expandedBytes;
+        expandedGdefStore = ExpandedItemVariationStore(ItemVariationStore(GdefView(gdef.reader).itemVarStore()), budget);
+    }
+
+    // A variation as CoreText reports it, in fvar order.
+    std::vector<double> fvar_values(const AxisValues& values) const {
+        std::vector<double> fvarValues;
+        for (const FvarAxis& axis : axes) {
+            double value = values.find(axis.tag);
+            fvarValues.push_back(std::isnan(value) ? axis.def : value);
+        }
+        return fvarValues;
+    }
+
+    // Its normalized coordinates.
+    std::vector<double> normalize(const AxisValues& values) const {
+        std::vector<double> coordinates(axes.size());
+        normalize_coordinates(normalizeKernel, axes, avar.reader, fvar_values(values).data(), coordinates.data());
+        return coordinates;
+    }
+};
+
+// Test cases are described rather than created up front, so that no CoreText call happens before
+// the sharded runner forks its workers. --font replaces the defaults below.
+struct TestCase {
+    const char* file; // nullptr for the system UI font
+    CGFloat size;
+    const char* name;
+};
+
+std::vector<TestCase> gTestCases = {
+    { nullptr, 24, "SystemUI size 24" },
+    { "/System/Library/Fonts/SFNS.ttf", 24, "/System/Library/Fonts/SFNS.ttf" },
+    //{ "SFNS#1.ttf", 24, "/System/Library/Fonts/SFNS.ttf" },
+
+    { nullptr, 17.00, "SystemUI size 17.00" },
+    { nullptr, 17.01, "SystemUI size 17.01" },
+    { nullptr, 95.99, "SystemUI size 95.99" },
+    { nullptr, 96.00, "SystemUI size 96.00" },
+};
+
+uint32_t cell_count() {
+    return gTestCases.size() * kCellsPerCase;
+}
+
+CTFontRef make_test_font(const TestCase& testCase) {
+    return testCase.file ? make_ctfont_from_file(testCase.file, testCase.size)
+                         : make_ctfont_from_uifont(testCase.size);
+}
+
+struct CaseState {
+    CTFontRef originalFont;
+    CTFontDescriptorRef originalDescriptor;
+    AxisValues originalResolvedVariation;
+    bool isStatic; // no variation axes, so every request is for the original font
+    mutable std::once_flag variationsOnce;
+    mutable std::unique_ptr<FontVariations> originalVariations;
+
+    // Takes ownership of font.
+    explicit CaseState(CTFontRef font)
+        : originalFont(font)
+        , originalDescriptor(CTFontCopyFontDescriptor(font))
+        , originalResolvedVariation(read_axis_values(font))
+        , isStatic(!originalResolvedVariation.count) {
+        // To stderr, which the sharded runner's workers share, so stdout stays that of one process.
+        if (originalResolvedVariation.fontAxisCount > kMaxFontAxes) {
+            fprintf(stderr, "A font has %d axes; only the first %d are requested and compared\n",
+                    originalResolvedVariation.fontAxisCount, kMaxFontAxes);
+        }
+    }
+    ~CaseState() {
+        CFRelease(originalDescriptor);
+        CFRelease(originalFont);
+    }
+
+    const FontVariations& variations() const {
+        std::call_once(variationsOnce, [this]() { originalVariations.reset(new FontVariations(originalFont)); });
+        return *originalVariations;
+    }
+};
+
+void add_axis_value(CFMutableDictionaryRef variation, uint32_t tag, double valueDouble) {
+    long tagLong = tag;
+    CFNumberRef tagNumber = CFNumberCreate(kCFAllocatorDefault, kCFNumberLongType, &tagLong);
+    CFNumberRef valueNumber = CFNumberCreate(kCFAllocatorDefault, kCFNumberDoubleType, &valueDouble);
+    CFDictionaryAddValue(variation, tagNumber, valueNumber);
+    CFRelease(valueNumber);
+    CFRelease(tagNumber);
+}
+
+// The two ways of making the copy described at the top of the file. The descriptor copy is the
+// default; --copy-with-attributes selects CTFontCreateCopyWithAttributes.
+bool gCopyWithAttributes = false;
+
+CTFontRef create_font_with_variation(const CaseState& state, CFDictionaryRef requestedVariation) {
+    CFMutableDictionaryRef requestedAttributes =
               CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
                                         &kCFTypeDictionaryKeyCallBacks,
                                         &kCFTypeDictionaryValueCallBacks);
+    CFDictionaryAddValue(requestedAttributes, kCTFontVariationAttribute, requestedVariation);
+    CTFontRef resultFont;
+    if (gCopyWithAttributes) {
+        CTFontDescriptorRef requestedDescriptor = CTFontDescriptorCreateWithAttributes(requestedAttributes);
+        fflush(stdout);
+        //CFShow(requestedDescriptor);
+        resultFont = CTFontCreateCopyWithAttributes(state.originalFont, 0, nullptr, requestedDescriptor);
+        CFRelease(requestedDescriptor);
+    } else {
+        // This gives somewhat different results.
+        // The variation isn't applied unless opsz changes, but the result makes CFEqual correct.
+        CGFloat size = CTFontGetSize(state.originalFont);
+        CTFontDescriptorRef resultDescriptor = CTFontDescriptorCreateCopyWithAttributes(state.originalDescriptor, requestedAttributes);
+        fflush(stdout);
+        //CFShow(resultDescriptor);
+        resultFont = CTFontCreateWithFontDescriptor(resultDescriptor, size, nullptr);
+        CFRelease(resultDescriptor);
+    }
+    CFRelease(requestedAttributes);
+    return resultFont;
+}
 
-      printf("--------------------------\n");
-      printf("Case: %s\n", testCase.name);
-      printf("Original: ");
-      for (int i = 0; i < originalAxisCount; ++i) {
-          CFDictionaryRef originalAxis = static_cast<CFDictionaryRef>(CFArrayGetValueAtIndex(originalAxes, i));
+// The font to use for a variation request, which the caller releases. A static font has nothing to
+// vary, so it is handed back as it is, without making an instance or looking at the request.
+CTFontRef font_for_variation(const CaseState& state, CFDictionaryRef requestedVariation) {
+    if (state.isStatic) {
+        return static_cast<CTFontRef>(CFRetain(state.originalFont));
+    }
+    return create_font_with_variation(state, requestedVariation);
+}
 
-          long tagLong;
-          CFNumberRef tagNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(originalAxis, kCTFontVariationAxisIdentifierKey));
-          CFNumberGetValue(tagNumber, kCFNumberLongType, &tagLong);
+// Whether two fonts' variations are CFEqual. A font with no axes has no variation, for which
+// CTFontCopyVariation returns null, and matches only another such font.
+bool same_variation(CTFontRef a, CTFontRef b) {
+    CFDictionaryRef variationA = CTFontCopyVariation(a);
+    CFDictionaryRef variationB = CTFontCopyVariation(b);
+    bool same = variationA && variationB ? CFEqual(variationA, variationB) : variationA == variationB;
+    if (variationA) {
+        CFRelease(variationA);
+    }
+    if (variationB) {
+        CFRelease(variationB);
+    }
+    return same;
+}
 
-          double defDouble;
-          CFNumberRef defNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(originalAxis, kCTFontVariationAxisDefaultValueKey));
-          CFNumberGetValue(defNumber, kCFNumberDoubleType, &defDouble);
+// If resultFontOut is given, the result font is handed back to the caller, who releases it.
+SweepRecord run_cell(const CaseState& state, uint32_t cell, CTFontRef* resultFontOut = nullptr) {
+    SweepCell sweepCell = sweep_cell(cell);
+    const AxisValues& resolved = state.originalResolvedVariation;
 
-          double valueDouble = defDouble;
+    SweepRecord record = {};
+    record.cell = cell;
+    record.caseIndex = sweepCell.caseIndex;
+    record.omitOpsz = sweepCell.omitOpsz;
+    record.axisToBump = sweepCell.axisToBump;
+    record.axisCount = std::min(resolved.count, kMaxAxes);
+    if (resolved.fontAxisCount > kMaxAxes) {
+        record.flags |= kAxesTruncated;
+    }
+    if (gCopyWithAttributes) {
+        record.flags |= kCopyWithAttributes;
+    }
 
-          CFNumberRef currentNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(originalVariation, tagNumber));
-          if (currentNumber) {
-              double currentDouble;
-              CFNumberGetValue(currentNumber, kCFNumberDoubleType, &currentDouble);
-              valueDouble = currentDouble;
-          }
+    CFMutableDictionaryRef requestedVariation = 
+            CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+                                      &kCFTypeDictionaryKeyCallBacks,
+                                      &kCFTypeDictionaryValueCallBacks);
+    // Every axis is requested; only the first kMaxAxes are recorded.
+    for (int i = 0; i < resolved.count; ++i) {
+        uint32_t tag = resolved.tags[i];
+        double valueDouble = resolved.values[i];
+        bool recorded = i < kMaxAxes;
+        if (recorded) {
+            record.tags[i] = tag;
+        }
 
-          printf("(%s: %f) ", tag_to_string(tagLong).c_str(), valueDouble);
+        if (tag == kOpszTag && sweepCell.omitOpsz) {
+            if (recorded) {
+                record.requested[i] = NAN;
+            }
+            continue;
+        }
+        if (tag == sweepCell.axisToBump) {
+            valueDouble += 0.0001f;
+        }
+        if (tag == kWghtTag) {
+            valueDouble = sweepCell.wghtValue;
+        }
+        if (recorded) {
+            record.requested[i] = valueDouble;
+        }
+        add_axis_value(requestedVariation, tag, valueDouble);
+    }
 
-          CFNumberRef valueNumber = CFNumberCreate(kCFAllocatorDefault, kCFNumberDoubleType, &valueDouble);
-          CFDictionaryAddValue(originalResolvedVariation, tagNumber, valueNumber);
-          CFRelease(valueNumber);
-      }
-      printf("\n\n");
-
-      long opszLong = kOpszTag;
-      CFNumberRef opszNumber = CFNumberCreate(kCFAllocatorDefault, kCFNumberLongType, &opszLong);
-
-      for (bool omit_opsz : {false, true}) {
-      for (uint32_t axis_to_bump : { 0u, kOpszTag, kWdthTag }) {
-      for (CGFloat wghtValue : {100, 200, 300, 400, 500, 600, 700, 800, 900}) {
-          CFMutableDictionaryRef requestedVariation = 
-                  CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
-                                            &kCFTypeDictionaryKeyCallBacks,
-                                            &kCFTypeDictionaryValueCallBacks);
-          printf("Request : ");
-          for (int i = 0; i < originalAxisCount; ++i) {
-              CFDictionaryRef originalAxis = static_cast<CFDictionaryRef>(CFArrayGetValueAtIndex(originalAxes, i));
-
-              long tagLong;
-              CFNumberRef tagNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(originalAxis, kCTFontVariationAxisIdentifierKey));
-              CFNumberGetValue(tagNumber, kCFNumberLongType, &tagLong);
-
-              CFNumberRef currentNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(originalResolvedVariation, tagNumber));
-              assert(currentNumber);
-              double currentDouble;
-              CFNumberGetValue(currentNumber, kCFNumberDoubleType, &currentDouble);
-              double valueDouble = currentDouble;
- 
-              if (tagLong == kOpszTag && omit_opsz) {
-                  printf("#%s: %f# ", tag_to_string(tagLong).c_str(), valueDouble);
-                  continue;
-              }
-              if (tagLong == axis_to_bump) {
-                  valueDouble += 0.0001f;
-              }
-              if (tagLong == kWghtTag) {
-                  valueDouble = wghtValue;
-              }
+    CTFontRef resultFont = create_font_with_variation(state, requestedVariation);
 
-              printf("(%s: %f) ", tag_to_string(tagLong).c_str(), valueDouble);
+    // Read the original back for every cell, so that a change to it would show up too.
+    AxisValues resultValues = read_axis_values(resultFont);
+    AxisValues originalValues = read_axis_values(state.originalFont);
+    for (uint32_t i = 0; i < record.axisCount; ++i) {
+        record.result[i] = resultValues.find(resolved.tags[i]);
+        record.original[i] = originalValues.find(resolved.tags[i]);
+    }
 
-              CFNumberRef valueNumber = CFNumberCreate(kCFAllocatorDefault, kCFNumberDoubleType, &valueDouble);
-              CFDictionaryAddValue(requestedVariation, tagNumber, valueNumber);
-              CFRelease(valueNumber);
-          }
-          printf("\n");
+    if (same_variation(resultFont, state.originalFont)) {
+        record.flags |= kVariationEqual;
+    }
 
-          CFMutableDictionaryRef requestedAttributes =
-                    CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
-                                              &kCFTypeDictionaryKeyCallBacks,
-                                              &kCFTypeDictionaryValueCallBacks);
-          CFDictionaryAddValue(requestedAttributes, kCTFontVariationAttribute, requestedVariation);
-#if 0
-          CTFontDescriptorRef requestedDescriptor = CTFontDescriptorCreateWithAttributes(requestedAttributes);
-          fflush(stdout);
-          CFShow(requestedDescriptor);
-          CTFontRef resultFont = CTFontCreateCopyWithAttributes(originalFont, 0, nullptr, requestedDescriptor);
-          CFRelease(requestedDescriptor);
-#else
-          // This gives somewhat different results.
-          // The variation isn't applied unless opsz changes, but the result makes CFEqual correct.
-          CGFloat size = CTFontGetSize(originalFont);
-          CTFontDescriptorRef resultDescriptor = CTFontDescriptorCreateCopyWithAttributes(originalDescriptor, requestedAttributes);
-          fflush(stdout);
-          //CFShow(resultDescriptor);
-          CTFontRef resultFont = CTFontCreateWithFontDescriptor(resultDescriptor, size, nullptr);
-          CFRelease(resultDescriptor);
-#endif
-
-          CFArrayRef resultAxes = CTFontCopyVariationAxes(resultFont);
-          CFIndex resultAxisCount = CFArrayGetCount(resultAxes);
-          CFDictionaryRef resultVariation = CTFontCopyVariation(resultFont);
-
-          printf("Result  : ");
-          for (int i = 0; i < resultAxisCount; ++i) {
-              CFDictionaryRef resultAxis = static_cast<CFDictionaryRef>(CFArrayGetValueAtIndex(resultAxes, i));
-    
-              long tagLong;
-              CFNumberRef tagNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(resultAxis, kCTFontVariationAxisIdentifierKey));
-              CFNumberGetValue(tagNumber, kCFNumberLongType, &tagLong);
-    
-              double defDouble;
-              CFNumberRef defNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(resultAxis, kCTFontVariationAxisDefaultValueKey));
-              CFNumberGetValue(defNumber, kCFNumberDoubleType, &defDouble);
-    
-              double valueDouble = defDouble;
-    
-              CFNumberRef currentNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(resultVariation, tagNumber));
-              if (currentNumber) {
-                  double currentDouble;
-                  CFNumberGetValue(currentNumber, kCFNumberDoubleType, &currentDouble);
-                  valueDouble = currentDouble;
-              }
-    
-              printf("(%s: %f) ", tag_to_string(tagLong).c_str(), valueDouble);
-          }
-          printf("\n");
-
-
-          CFArrayRef originalAxes = CTFontCopyVariationAxes(testCase.font);
-          CFIndex originalAxisCount = CFArrayGetCount(originalAxes);
-          CFDictionaryRef originalVariation = CTFontCopyVariation(testCase.font);
-    
-          printf("Original: ");
-          for (int i = 0; i < originalAxisCount; ++i) {
-              CFDictionaryRef originalAxis = static_cast<CFDictionaryRef>(CFArrayGetValueAtIndex(originalAxes, i));
-    
-              long tagLong;
-              CFNumberRef tagNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(originalAxis, kCTFontVariationAxisIdentifierKey));
-              CFNumberGetValue(tagNumber, kCFNumberLongType, &tagLong);
-    
-              double defDouble;
-              CFNumberRef defNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(originalAxis, kCTFontVariationAxisDefaultValueKey));
-              CFNumberGetValue(defNumber, kCFNumberDoubleType, &defDouble);
-    
-              double valueDouble = defDouble;
-    
-              CFNumberRef currentNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(originalVariation, tagNumber));
-              if (currentNumber) {
-                  double currentDouble;
-                  CFNumberGetValue(currentNumber, kCFNumberDoubleType, &currentDouble);
-                  valueDouble = currentDouble;
+    // This shows the issue.
+    // The variation has changed, but if opsz didn't change then it is still equal.
+    // If variationEqual is false then fontEqual should also be false.
+    if (CFEqual(resultFont, state.originalFont)) {
+        record.flags |= kFontEqual;
+    }
+    //CFShow(resultFont);
+    //CFShow(originalFont);
+
+    if (resultFontOut) {
+        *resultFontOut = resultFont;
+    } else {
+        CFRelease(resultFont);
+    }
+    CFRelease(requestedVariation);
+    return record;
+}
+
+void print_axis_values(const SweepRecord& record, const double* values) {
+    for (uint32_t i = 0; i < record.axisCount; ++i) {
+        if (!std::isnan(values[i])) {
+            printf("(%s: %f) ", tag_to_string(record.tags[i]).c_str(), values[i]);
+        }
+    }
+}
+
+void print_case_header(const char* name, const SweepRecord& record) {
+    printf("--------------------------\n");
+    printf("Case: %s\n", name);
+    printf("Original: ");
+    print_axis_values(record, record.original);
+    if (record.flags & kAxesTruncated) {
+        printf("(more axes, not recorded)");
+    }
+    printf("\n\n");
+}
+
+void print_record(const SweepRecord& record) {
+    if (record.flags & kWorkerCrashed) {
+        printf("Worker crashed on this cell\n\n");
+        fflush(stdout);
+        return;
+    }
+    if (record.flags & kFontNotLoaded) {
+        printf("The font could not be loaded\n\n");
+        fflush(stdout);
+        return;
+    }
+    printf("Request : ");
+    for (uint32_t i = 0; i < record.axisCount; ++i) {
+        if (std::isnan(record.requested[i])) {
+            printf("#%s: %f# ", tag_to_string(record.tags[i]).c_str(), record.original[i]);
+        } else {
+            printf("(%s: %f) ", tag_to_string(record.tags[i]).c_str(), record.requested[i]);
+        }
+    }
+    printf("\n");
+    printf("Result  : ");
+    print_axis_values(record, record.result);
+    printf("\n");
+    printf("Original: ");
+    print_axis_values(record, record.original);
+    printf("\n");
+
+    bool variationEqual = record.flags & kVariationEqual;
+    printf("CFEqual(resultVariation, originalVariation): %s\n", variationEqual ? "true" : "false");
+    bool fontEqual = record.flags & kFontEqual;
+    printf("CFEqual(resultFont, originalFont): %s\n", fontEqual ? "true" : "false");
+    printf("\n");
+    fflush(stdout);
+}
+
+// Property checking: random requests against a set of invariants, with failures shrunk to a
+// minimal request that still breaks the same invariant.
+
+// A request for any subset of the axes of one test case.
+struct CheckRequest {
+    uint32_t caseIndex;
+    int count;
+    uint32_t tags[kMaxFontAxes];
+    double values[kMaxFontAxes];
+};
+
+struct CheckOutcome {
+    bool variationEqual;
+    bool fontEqual;
+    bool repeatEqual;      // the same request a second time gives a CFEqual font
+    bool symmetricEqual;   // CFEqual(result, original) == CFEqual(original, result)
+    AxisValues result;
+};
+
+CheckOutcome evaluate_request(const CaseState& state, const CheckRequest& request) {
+    CFMutableDictionaryRef requestedVariation =
+            CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+                                      &kCFTypeDictionaryKeyCallBacks,
+                                      &kCFTypeDictionaryValueCallBacks);
+    for (int i = 0; i < request.count; ++i) {
+        add_axis_value(requestedVariation, request.tags[i], request.values[i]);
+    }
+    CTFontRef resultFont = create_font_with_variation(state, requestedVariation);
+    CTFontRef repeatFont = create_font_with_variation(state, requestedVariation);
+
+    CheckOutcome outcome;
+    outcome.variationEqual = same_variation(resultFont, state.originalFont);
+    outcome.fontEqual = CFEqual(resultFont, state.originalFont);
+    outcome.repeatEqual = CFEqual(resultFont, repeatFont);
+    outcome.symmetricEqual = outcome.fontEqual == CFEqual(state.originalFont, resultFont);
+    outcome.result = read_axis_values(resultFont);
+
+    CFRelease(repeatFont);
+    CFRelease(resultFont);
+    CFRelease(requestedVariation);
+    return outcome;
+}
+
+struct Invariant {
+    const char* name;
+    bool (*holds)(const CaseState& state, const CheckOutcome& outcome);
+};
+
+const Invariant kInvariants[] = {
+    // The one this file is about.
+    { "variation differs => font differs",
+      [](const CaseState&, const CheckOutcome& outcome) {
+          return outcome.variationEqual || !outcome.fontEqual;
+      } },
+    { "result axes within their range",
+      [](const CaseState&, const CheckOutcome& outcome) {
+          const AxisValues& result = outcome.result;
+          for (int i = 0; i < result.count; ++i) {
+              if (result.values[i] < result.minimums[i] || result.values[i] > result.maximums[i]) {
+                  return false;
               }
-    
-              printf("(%s: %f) ", tag_to_string(tagLong).c_str(), valueDouble);
           }
-          printf("\n");
-
-          bool variationEqual = CFEqual(resultVariation, originalVariation);
-          printf("CFEqual(resultVariation, originalVariation): %s\n", variationEqual ? "true" : "false");
-          //CFShow(resultVariation);
-          //CFShow(originalVariation);
-
-          // This shows the issue.
-          // The variation has changed, but if opsz didn't change then it is still equal.
-          // If variationEqual is false then fontEqual should also be false.
-          bool fontEqual = CFEqual(resultFont, testCase.font);
-          printf("CFEqual(resultFont, originalFont): %s\n", fontEqual ? "true" : "false");
-          fflush(stdout);
-          //CFShow(resultFont);
-          //CFShow(originalFont);
-          
-          printf("\n");
-
-          CFRelease(originalVariation);
-          CFRelease(originalAxes);
-          CFRelease(resultVariation);
-          CFRelease(resultAxes);
-          CFRelease(resultFont);
-          CFRelease(requestedAttributes);
-          CFRelease(requestedVariation);
-      }}}
-      CFRelease(opszNumber);
-      CFRelease(originalResolvedVariation);
-      CFRelease(originalVariation);
-      CFRelease(originalAxes);
-      CFRelease(originalDescriptor);
+          return true;
+      } },
+    { "same request => equal fonts",
+      [](const CaseState&, const CheckOutcome& outcome) { return outcome.repeatEqual; } },
+    { "CFEqual is symmetric",
+      [](const CaseState&, const CheckOutcome& outcome) { return outcome.symmetricEqual; } },
+};
+
+// Values are drawn where rounding and clamping decide the outcome: the axis extremes (and just
+// past them), the F2Dot14 rounding boundaries of the normalized coordinate, tiny nudges like the
+// sweep's 0.0001 bump, and anywhere in range.
+double random_axis_value(std::mt19937_64& rng, const AxisValues& axes, int i) {
+    double minimum = axes.minimums[i], def = axes.defaults[i], maximum = axes.maximums[i];
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::uniform_int_distribution<int> nudgeIndex(0, 4);
+    const double nudges[] = { 0, 0.0001f, 0.01, 1e-9, 0.5 / 16384 };
+    double nudge = nudges[nudgeIndex(rng)] * (rng() & 1 ? 1 : -1);
+    switch (rng() % 5) {
+    case 0:
+        return (rng() & 1 ? minimum : maximum) + nudge;
+    case 1: {
+        // Halfway between two representable F2Dot14 values, on one side of the default.
+        bool above = rng() & 1;
+        double normalized = (std::uniform_int_distribution<int>(0, 16383)(rng) + 0.5) / 16384;
+        double extent = above ? maximum - def : def - minimum;
+        return def + (above ? 1 : -1) * normalized * extent + nudge * extent;
+    }
+    case 2:
+        return axes.values[i] + nudge;
+    case 3:
+        return def + nudge;
+    default:
+        return minimum + unit(rng) * (maximum - minimum);
+    }
+}
+
+CheckRequest random_request(std::mt19937_64& rng, uint32_t caseIndex, const AxisValues& axes) {
+    CheckRequest request = {};
+    request.caseIndex = caseIndex;
+    for (int i = 0; i < axes.count; ++i) {
+        if (rng() % 3 == 0) {
+            continue;
+        }
+        request.tags[request.count] = axes.tags[i];
+        request.values[request.count] = random_axis_value(rng, axes, i);
+        ++request.count;
+    }
+    return request;
+}
+
+// How far a request is from the plain original font; shrinking only ever accepts smaller requests.
+double request_size(const CheckRequest& request, const AxisValues& original) {
+    double size = request.count * 1e6;
+    for (int i = 0; i < request.count; ++i) {
+        double value = request.values[i];
+        size += std::fabs(value - original.find(request.tags[i]));
+        if (value != std::round(value)) {
+            size += 0.5;
+        }
+    }
+    return size;
+}
+
+CheckRequest shrink_request(const CaseState& state, CheckRequest failing, const Invariant& invariant) {
+    const AxisValues& original = state.originalResolvedVariation;
+    auto still_fails = [&](const CheckRequest& candidate) {
+        return !invariant.holds(state, evaluate_request(state, candidate));
+    };
+    auto try_candidate = [&](const CheckRequest& candidate) {
+        if (request_size(candidate, original) < request_size(failing, original) && still_fails(candidate)) {
+            failing = candidate;
+            return true;
+        }
+        return false;
+    };
+
+    constexpr int kMaxShrinkSteps = 200;
+    bool progress = true;
+    for (int step = 0; progress && step < kMaxShrinkSteps; ++step) {
+        progress = false;
+        for (int i = 0; i < failing.count && !progress; ++i) {
+            CheckRequest candidate = failing;
+            std::copy(candidate.tags + i + 1, candidate.tags + candidate.count, candidate.tags + i);
+            std::copy(candidate.values + i + 1, candidate.values + candidate.count, candidate.values + i);
+            --candidate.count;
+            progress = try_candidate(candidate);
+        }
+        for (int i = 0; i < failing.count && !progress; ++i) {
+            double target = original.find(failing.tags[i]);
+            double current = failing.values[i];
+            // Halving stops at the scale of the sweep's own 0.0001 bump.
+            double halfway = std::fabs(current - target) > 0.0001 ? (current + target) / 2 : current;
+            for (double value : { target, std::round(current), std::round(current * 100) / 100, halfway }) {
+                CheckRequest candidate = failing;
+                candidate.values[i] = value;
+                if ((progress = try_candidate(candidate))) {
+                    break;
+                }
+            }
+        }
+    }
+    return failing;
+}
+
+void print_check_request(const CheckRequest& request) {
+    printf("Case: %s\n", gTestCases[request.caseIndex].name);
+    printf("Request : ");
+    for (int i = 0; i < request.count; ++i) {
+        printf("(%s: %.9g) ", tag_to_string(request.tags[i]).c_str(), request.values[i]);
+    }
+    printf("\n");
+}
+
+// The sparse region index against visiting every region, at the corners where ranges end: each
+// axis alone at -1 and +1, and every axis at -1, 0 and +1 together. Compares each HVAR advance
+// delta, and each gvar shared tuple scalar. Returns the number of mismatches.
+uint64_t check_sparse_regions(const CaseState& state) {
+    const FontVariations& variations = state.variations();
+    size_t axisCount = variations.axes.size();
+    std::vector<std::vector<double>> points;
+    for (double value : { -1.0, 0.0, 1.0 }) {
+        points.emplace_back(axisCount, value);
+    }
+    for (size_t axis = 0; axis < axisCount; ++axis) {
+        for (double value : { -1.0, 1.0 }) {
+            points.emplace_back(axisCount, 0.0);
+            points.back()[axis] = value;
+        }
+    }
+    auto differ = [](double a, double b) { return std::fabs(a - b) > 1e-9 * std::max(1.0, std::fabs(a)); };
+    uint64_t mismatches = 0;
+    std::vector<std::pair<uint32_t, double>> active;
+    for (const std::vector<double>& coordinates : points) {
+        if (!variations.hvar.reader.empty()) {
+            variations.sparseAdvanceStore.regions.active(coordinates.data(), &active);
+            for (CFIndex glyph = 0; glyph < CTFontGetGlyphCount(state.originalFont); ++glyph) {
+                auto [outer, inner] = delta_set_index(variations.advanceMap, glyph);
+                mismatches += differ(variations.advanceStore.delta(outer, inner, coordinates.data()),
+                                     variations.sparseAdvanceStore.delta(outer, inner, active));
+            }
+        }
+        const RegionIndex& tuples = variations.sharedTuples;
+        std::vector<double> naive(tuples.size()), sparse(tuples.size());
+        tuples.scalars(region_scalar_generic, coordinates.data(), naive.data());
+        tuples.active(coordinates.data(), &active);
+        for (const auto& [tuple, scalar] : active) {
+            sparse[tuple] = scalar;
+        }
+        for (size_t tuple = 0; tuple < tuples.size(); ++tuple) {
+            mismatches += differ(naive[tuple], sparse[tuple]);
+        }
+    }
+    return mismatches;
+}
+
+int run_checks(uint64_t checkCount, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<std::unique_ptr<CaseState>> states;
+    std::vector<uint32_t> caseIndices;
+    for (uint32_t caseIndex = 0; caseIndex < gTestCases.size(); ++caseIndex) {
+        if (CTFontRef font = make_test_font(gTestCases[caseIndex])) {
+            states.emplace_back(new CaseState(font));
+            caseIndices.push_back(caseIndex);
+        }
+    }
+    if (states.empty()) {
+        printf("No test case fonts could be created\n");
+        return 1;
+    }
+    uint64_t failures[std::size(kInvariants)] = {};
+
+    uint64_t regionMismatches = 0;
+    for (size_t i = 0; i < states.size(); ++i) {
+        if (uint64_t mismatches = states[i]->isStatic ? 0 : check_sparse_regions(*states[i])) {
+            printf("Sparse region index disagrees with every region in %llu places: %s\n",
+                   (unsigned long long)mismatches, gTestCases[caseIndices[i]].name);
+            regionMismatches += mismatches;
+        }
+    }
+
+    for (uint64_t check = 0; check < checkCount; ++check) {
+        size_t stateIndex = rng() % states.size();
+        uint32_t caseIndex = caseIndices[stateIndex];
+        const std::unique_ptr<CaseState>& state = states[stateIndex];
+        CheckRequest request = random_request(rng, caseIndex, state->originalResolvedVariation);
+        CheckOutcome outcome = evaluate_request(*state, request);
+
+        for (size_t i = 0; i < std::size(kInvariants); ++i) {
+            if (kInvariants[i].holds(*state, outcome)) {
+                continue;
+            }
+            // Only the first failure of each invariant is shrunk and printed; the rest are counted.
+            if (failures[i]++ == 0) {
+                printf("--------------------------\n");
+                printf("Invariant failed: %s (check %llu, seed %llu)\n", kInvariants[i].name,
+                       (unsigned long long)check, (unsigned long long)seed);
+                print_check_request(request);
+                printf("Shrunk to:\n");
+                print_check_request(shrink_request(*state, request, kInvariants[i]));
+                printf("\n");
+                fflush(stdout);
+            }
+        }
+    }
+
+    printf("--------------------------\n");
+    printf("%llu checks\n", (unsigned long long)checkCount);
+    printf("%8llu mismatches: sparse region index against every region at -1, 0 and +1\n",
+           (unsigned long long)regionMismatches);
+    bool allHeld = regionMismatches == 0;
+    for (size_t i = 0; i < std::size(kInvariants); ++i) {
+        printf("%8llu failures: %s\n", (unsigned long long)failures[i], kInvariants[i].name);
+        allHeld &= failures[i] == 0;
+    }
+    return allHeld ? 0 : 1;
+}
+
+// Differential mode: compares two results files cell by cell, e.g. the two copy methods, or runs
+// on two macOS versions. Both files are streamed, so their size doesn't matter.
+
+struct AxisDifferenceStats {
+    uint32_t tag;
+    uint64_t cells;
+    double sum;
+    double largest;
+};
+
+struct CellDifference {
+    double magnitude;
+    uint32_t cell;
+    uint32_t tag;
+    double a;
+    double b;
+
+    // Larger magnitudes first, then earlier cells.
+    bool operator>(const CellDifference& other) const {
+        return magnitude != other.magnitude ? magnitude > other.magnitude : cell < other.cell;
+    }
+};
+
+const char* copy_method(const SweepRecord& record) {
+    return record.flags & kCopyWithAttributes ? "copy with attributes" : "descriptor copy";
+}
+
+const char* case_name(uint32_t caseIndex) {
+    return caseIndex < gTestCases.size() ? gTestCases[caseIndex].name : "unknown case";
+}
+
+int diff_results(const char* pathA, const char* pathB) {
+    FILE* fileA = fopen(pathA, "rb");
+    FILE* fileB = fopen(pathB, "rb");
+    if (!fileA || !fileB) {
+        printf("Could not open: %s\n", fileA ? pathB : pathA);
+        return 1;
+    }
+
+    constexpr size_t kLargestShown = 20;
+    constexpr size_t kDisagreementsShown = 20;
+    uint64_t compared = 0, onlyA = 0, onlyB = 0;
+    uint64_t variationDisagreements = 0, fontDisagreements = 0, disagreeingCells = 0;
+    std::vector<AxisDifferenceStats> axisStats;
+    std::vector<std::pair<SweepRecord, SweepRecord>> disagreements;
+    // Min-heap of the largest differences seen so far.
+    std::priority_queue<CellDifference, std::vector<CellDifference>, std::greater<CellDifference>> largest;
+    const char* methodA = nullptr;
+    const char* methodB = nullptr;
+
+    SweepRecord a, b;
+    bool haveA = fread(&a, sizeof(a), 1, fileA) == 1;
+    bool haveB = fread(&b, sizeof(b), 1, fileB) == 1;
+    while (haveA || haveB) {
+        if (!haveB || (haveA && a.cell < b.cell)) {
+            ++onlyA;
+            haveA = fread(&a, sizeof(a), 1, fileA) == 1;
+            continue;
+        }
+        if (!haveA || b.cell < a.cell) {
+            ++onlyB;
+            haveB = fread(&b, sizeof(b), 1, fileB) == 1;
+            continue;
+        }
+
+        ++compared;
+        methodA = copy_method(a);
+        methodB = copy_method(b);
+        bool variationDiffers = (a.flags & kVariationEqual) != (b.flags & kVariationEqual);
+        bool fontDiffers = (a.flags & kFontEqual) != (b.flags & kFontEqual);
+        variationDisagreements += variationDiffers;
+        fontDisagreements += fontDiffers;
+        disagreeingCells += variationDiffers || fontDiffers;
+        if ((variationDiffers || fontDiffers) && disagreements.size() < kDisagreementsShown) {
+            disagreements.emplace_back(a, b);
+        }
+
+        for (uint32_t i = 0; i < std::min<uint32_t>(a.axisCount, kMaxAxes); ++i) {
+            // NaN (axis missing from the result) only matches NaN.
+            double valueB = NAN;
+            for (uint32_t j = 0; j < std::min<uint32_t>(b.axisCount, kMaxAxes); ++j) {
+                if (b.tags[j] == a.tags[i]) {
+                    valueB = b.result[j];
+                }
+            }
+            double valueA = a.result[i];
+            if (valueA == valueB || (std::isnan(valueA) && std::isnan(valueB))) {
+                continue;
+            }
+            double magnitude = std::isnan(valueA) || std::isnan(valueB) ? INFINITY : std::fabs(valueA - valueB);
+
+            auto stats = std::find_if(axisStats.begin(), axisStats.end(),
+                                      [&](const AxisDifferenceStats& s) { return s.tag == a.tags[i]; });
+            if (stats == axisStats.end()) {
+                stats = axisStats.insert(axisStats.end(), { a.tags[i], 0, 0, 0 });
+            }
+            ++stats->cells;
+            stats->sum += magnitude;
+            stats->largest = std::max(stats->largest, magnitude);
+
+            largest.push({ magnitude, a.cell, a.tags[i], valueA, valueB });
+            if (largest.size() > kLargestShown) {
+                largest.pop();
+            }
+        }
+
+        haveA = fread(&a, sizeof(a), 1, fileA) == 1;
+        haveB = fread(&b, sizeof(b), 1, fileB) == 1;
+    }
+    fclose(fileA);
+    fclose(fileB);
+
+    printf("--------------------------\n");
+    printf("Diff: %s (%s) vs %s (%s)\n", pathA, methodA ? methodA : "empty", pathB, methodB ? methodB : "empty");
+    printf("Cells compared: %llu, only in first: %llu, only in second: %llu\n",
+           (unsigned long long)compared, (unsigned long long)onlyA, (unsigned long long)onlyB);
+    printf("CFEqual(resultVariation, originalVariation) disagrees: %llu\n", (unsigned long long)variationDisagreements);
+    printf("CFEqual(resultFont, originalFont) disagrees: %llu\n", (unsigned long long)fontDisagreements);
+    printf("\n");
+
+    printf("Result differences by axis:\n");
+    for (const AxisDifferenceStats& stats : axisStats) {
+        printf("  %s: %llu cells, largest %f, mean %f\n", tag_to_string(stats.tag).c_str(),
+               (unsigned long long)stats.cells, stats.largest, stats.sum / stats.cells);
+    }
+    printf("\n");
+
+    std::vector<CellDifference> sorted;
+    for (; !largest.empty(); largest.pop()) {
+        sorted.push_back(largest.top());
+    }
+    printf("Largest differences:\n");
+    for (auto difference = sorted.rbegin(); difference != sorted.rend(); ++difference) {
+        printf("  cell %u (%s) %s: %f vs %f\n", difference->cell, case_name(sweep_cell(difference->cell).caseIndex),
+               tag_to_string(difference->tag).c_str(), difference->a, difference->b);
+    }
+    printf("\n");
+
+    printf("Equality disagreements:\n");
+    for (const auto& [recordA, recordB] : disagreements) {
+        printf("  cell %u (%s): variation %s vs %s, font %s vs %s\n", recordA.cell, case_name(recordA.caseIndex),
+               recordA.flags & kVariationEqual ? "true" : "false", recordB.flags & kVariationEqual ? "true" : "false",
+               recordA.flags & kFontEqual ? "true" : "false", recordB.flags & kFontEqual ? "true" : "false");
+    }
+    if (disagreeingCells > disagreements.size()) {
+        printf("  ...\n");
+    }
+    fflush(stdout);
+    return 0;
+}
+
+// Equivalence classes: every font the sweep produces, plus the originals, grouped two ways in one
+// pass. Once by CFEqual (through a CFDictionary, so by CFHash and CFEqual) and once by a
+// fingerprint of what the font actually is. A CFEqual class holding several fingerprints is the
+// bug in this file, generalized: fonts that compare equal but aren't.
+
+// Size, resolved variation and the advances of the first glyphs.
+uint64_t font_fingerprint(CTFontRef font) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    CGFloat size = CTFontGetSize(font);
+    hash = fnv1a(hash, &size, sizeof(size));
+    AxisValues values = read_axis_values(font);
+    hash = fnv1a(hash, values.tags, values.count * sizeof(values.tags[0]));
+    hash = fnv1a(hash, values.values, values.count * sizeof(values.values[0]));
+
+    constexpr CFIndex kFingerprintGlyphs = 256;
+    CGGlyph glyphs[kFingerprintGlyphs];
+    CGSize advances[kFingerprintGlyphs];
+    CFIndex glyphCount = std::min(CTFontGetGlyphCount(font), kFingerprintGlyphs);
+    for (CFIndex glyph = 0; glyph < glyphCount; ++glyph) {
+        glyphs[glyph] = glyph;
+    }
+    CTFontGetAdvancesForGlyphs(font, kCTFontOrientationDefault, glyphs, advances, glyphCount);
+    for (CFIndex glyph = 0; glyph < glyphCount; ++glyph) {
+        hash = fnv1a(hash, &advances[glyph].width, sizeof(advances[glyph].width));
+    }
+    return hash;
+}
+
+constexpr uint32_t kOriginalFont = UINT32_MAX;
+
+struct ClassMember {
+    uint32_t caseIndex;
+    uint32_t cell; // kOriginalFont for the case's original font
+};
+
+struct EquivalenceClasses {
+    // Holds one representative font per CFEqual class, mapped to the class index.
+    CFMutableDictionaryRef canonical;
+    std::vector<uint32_t> canonicalSizes;
+    std::unordered_map<uint64_t, uint32_t> fingerprintClasses;
+    std::vector<uint32_t> fingerprintSizes;
+    // (canonical class, fingerprint class) -> fonts in both, and the first of them.
+    std::unordered_map<uint64_t, std::pair<uint32_t, ClassMember>> pairs;
+    uint64_t fontCount = 0;
+
+    EquivalenceClasses()
+        : canonical(CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+                                              &kCFTypeDictionaryKeyCallBacks,
+                                              &kCFTypeDictionaryValueCallBacks)) {}
+    ~EquivalenceClasses() { CFRelease(canonical); }
+
+    void add(CTFontRef font, ClassMember member) {
+        ++fontCount;
+        uint32_t canonicalClass;
+        CFNumberRef classNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(canonical, font));
+        if (classNumber) {
+            CFNumberGetValue(classNumber, kCFNumberSInt32Type, &canonicalClass);
+        } else {
+            canonicalClass = canonicalSizes.size();
+            canonicalSizes.push_back(0);
+            classNumber = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &canonicalClass);
+            CFDictionaryAddValue(canonical, font, classNumber);
+            CFRelease(classNumber);
+        }
+        ++canonicalSizes[canonicalClass];
+
+        auto [fingerprint, isNew] = fingerprintClasses.emplace(font_fingerprint(font), fingerprintSizes.size());
+        if (isNew) {
+            fingerprintSizes.push_back(0);
+        }
+        uint32_t fingerprintClass = fingerprint->second;
+        ++fingerprintSizes[fingerprintClass];
+
+        auto& pair = pairs.emplace(uint64_t(canonicalClass) << 32 | fingerprintClass, std::make_pair(0u, member)).first->second;
+        ++pair.first;
+    }
+};
+
+void print_class_sizes(const char* label, const std::vector<uint32_t>& sizes) {
+    std::map<uint32_t, uint32_t> histogram;
+    for (uint32_t size : sizes) {
+        ++histogram[size];
+    }
+    printf("%s: %zu classes; sizes (size x count):", label, sizes.size());
+    for (const auto& [size, count] : histogram) {
+        printf(" %ux%u", size, count);
+    }
+    printf("\n");
+}
+
+void print_class_member(const ClassMember& member) {
+    if (member.cell == kOriginalFont) {
+        printf("the original font of %s", gTestCases[member.caseIndex].name);
+    } else {
+        printf("cell %u of %s", member.cell, gTestCases[member.caseIndex].name);
+    }
+}
+
+// Lists the classes of one grouping that contain more than one class of the other.
+void print_disagreements(const EquivalenceClasses& classes, bool byCanonical) {
+    std::map<uint32_t, std::vector<std::pair<uint32_t, ClassMember>>> split;
+    for (const auto& [key, pair] : classes.pairs) {
+        uint32_t canonicalClass = key >> 32;
+        uint32_t fingerprintClass = key & 0xffffffff;
+        split[byCanonical ? canonicalClass : fingerprintClass].push_back(pair);
+    }
+    uint32_t count = 0;
+    for (const auto& [index, parts] : split) {
+        count += parts.size() > 1;
+    }
+    printf("%s classes that %s: %u\n", byCanonical ? "CFEqual" : "Fingerprint",
+           byCanonical ? "mix fingerprints" : "span CFEqual classes", count);
+
+    constexpr uint32_t kClassesShown = 10;
+    uint32_t shown = 0;
+    for (auto& [index, parts] : split) {
+        if (parts.size() < 2 || shown++ == kClassesShown) {
+            continue;
+        }
+        std::sort(parts.begin(), parts.end(), [](const auto& a, const auto& b) {
+            return std::make_pair(a.second.caseIndex, a.second.cell) < std::make_pair(b.second.caseIndex, b.second.cell);
+        });
+        printf("  class %u, %zu parts:\n", index, parts.size());
+        for (const auto& [size, example] : parts) {
+            printf("    %u font%s, e.g. ", size, size == 1 ? "" : "s");
+            print_class_member(example);
+            printf("\n");
+        }
+    }
+}
+
+int run_equivalence_classes() {
+    EquivalenceClasses classes;
+    for (uint32_t caseIndex = 0; caseIndex < gTestCases.size(); ++caseIndex) {
+        CTFontRef font = make_test_font(gTestCases[caseIndex]);
+        if (!font) {
+            continue;
+        }
+        CaseState state(font);
+        classes.add(state.originalFont, { caseIndex, kOriginalFont });
+        for (uint32_t cell = caseIndex * kCellsPerCase; cell < (caseIndex + 1) * kCellsPerCase; ++cell) {
+            CTFontRef resultFont;
+            run_cell(state, cell, &resultFont);
+            classes.add(resultFont, { caseIndex, cell });
+            CFRelease(resultFont);
+        }
+    }
+
+    printf("--------------------------\n");
+    printf("Equivalence classes over %llu fonts\n", (unsigned long long)classes.fontCount);
+    print_class_sizes("CFEqual", classes.canonicalSizes);
+    print_class_sizes("Fingerprint", classes.fingerprintSizes);
+    printf("\n");
+    print_disagreements(classes, true);
+    printf("\n");
+    print_disagreements(classes, false);
+    fflush(stdout);
+    return 0;
+}
+
+// Boundary search: instead of probing a single 0.0001 bump, find where along an axis (or along
+// the font size) the outcome of a request changes, to within a tolerance, by bisection.
+
+enum : uint8_t {
+    kBoundaryVariationEqual = 1 << 0,
+    kBoundaryFontEqual = 1 << 1,
+    kBoundaryValueAdjusted = 1 << 2, // the result doesn't have the requested value, e.g. it was clamped
+};
+
+std::string describe_boundary_outcome(uint8_t outcome) {
+    std::string description = outcome & kBoundaryVariationEqual ? "variation equal" : "variation differs";
+    description += outcome & kBoundaryFontEqual ? ", font equal" : ", font differs";
+    description += outcome & kBoundaryValueAdjusted ? ", value adjusted" : ", value kept";
+    return description;
+}
+
+// The outcome of requesting the original variation with one axis changed to value.
+uint8_t boundary_outcome(const CaseState& state, uint32_t tag, double value) {
+    const AxisValues& original = state.originalResolvedVariation;
+    CheckRequest request = {};
+    for (int i = 0; i < original.count; ++i) {
+        request.tags[request.count] = original.tags[i];
+        request.values[request.count] = original.tags[i] == tag ? value : original.values[i];
+        ++request.count;
+    }
+    CheckOutcome outcome = evaluate_request(state, request);
+    uint8_t bits = 0;
+    if (outcome.variationEqual) {
+        bits |= kBoundaryVariationEqual;
+    }
+    if (outcome.fontEqual) {
+        bits |= kBoundaryFontEqual;
+    }
+    if (outcome.result.find(tag) != value) {
+        bits |= kBoundaryValueAdjusted;
+    }
+    return bits;
+}
+
+struct Flip {
+    double below; // last value seen with the outcome `before`
+    double above; // first value seen with the outcome `after`
+    uint8_t before;
+    uint8_t after;
+};
+
+// Samples outcome at each of the sorted samples, then bisects every interval whose ends differ
+// until it is narrower than tolerance. Flips closer together than the sampling can cancel out and
+// be missed, which is why samples are packed densely around the interesting values.
+template <typename Outcome>
+std::vector<Flip> find_flips(Outcome outcome, const std::vector<double>& samples, double tolerance, int* evaluations) {
+    std::vector<uint8_t> outcomes;
+    for (double sample : samples) {
+        outcomes.push_back(outcome(sample));
+    }
+    *evaluations += samples.size();
+
+    std::vector<Flip> flips;
+    for (size_t i = 0; i + 1 < samples.size(); ++i) {
+        if (outcomes[i] == outcomes[i + 1]) {
+            continue;
+        }
+        Flip flip = { samples[i], samples[i + 1], outcomes[i], outcomes[i + 1] };
+        while (flip.above - flip.below > tolerance) {
+            double middle = (flip.below + flip.above) / 2;
+            if (middle <= flip.below || middle >= flip.above) {
+                break; // out of double precision
+            }
+            uint8_t middleOutcome = outcome(middle);
+            ++*evaluations;
+            if (middleOutcome == flip.before) {
+                flip.below = middle;
+            } else if (middleOutcome == flip.after) {
+                flip.above = middle;
+            } else {
+                // A third outcome in between: keep the half that still ends in `after`, the other
+                // flip will show up when the rest of the interval is searched.
+                flips.push_back({ flip.below, middle, flip.before, middleOutcome });
+                flip.below = middle;
+                flip.before = middleOutcome;
+            }
+        }
+        flips.push_back(flip);
+    }
+    return flips;
+}
+
+// A linear grid over [minimum, maximum], plus points at every power of ten away from each of the
+// centers, down to tolerance.
+std::vector<double> boundary_samples(double minimum, double maximum, std::initializer_list<double> centers, double tolerance) {
+    constexpr int kLinearSamples = 32;
+    std::vector<double> samples;
+    for (int i = 0; i <= kLinearSamples; ++i) {
+        samples.push_back(minimum + (maximum - minimum) * i / kLinearSamples);
+    }
+    for (double center : centers) {
+        samples.push_back(center);
+        for (double offset = tolerance * 10; offset < maximum - minimum; offset *= 10) {
+            samples.push_back(center - offset);
+            samples.push_back(center + offset);
+        }
+    }
+    samples.erase(std::remove_if(samples.begin(), samples.end(), [&](double sample) { return sample < minimum || sample > maximum; }),
+                  samples.end());
+    std::sort(samples.begin(), samples.end());
+    samples.erase(std::unique(samples.begin(), samples.end()), samples.end());
+    return samples;
+}
+
+void print_flips(const std::vector<Flip>& flips) {
+    for (const Flip& flip : flips) {
+        printf("  (%.9f, %.9f]: %s -> %s\n", flip.below, flip.above,
+               describe_boundary_outcome(flip.before).c_str(), describe_boundary_outcome(flip.after).c_str());
+    }
+}
+
+int run_boundary_search(double tolerance) {
+    for (const TestCase& testCase : gTestCases) {
+        CTFontRef font = make_test_font(testCase);
+        if (!font) {
+            continue;
+        }
+        CaseState state(font);
+        const AxisValues& original = state.originalResolvedVariation;
+        printf("--------------------------\n");
+        printf("Case: %s\n", testCase.name);
+
+        for (int i = 0; i < original.count; ++i) {
+            // Search a little past each end so the clamping shows up as a flip.
+            double extent = original.maximums[i] - original.minimums[i];
+            double minimum = original.minimums[i] - extent / 100, maximum = original.maximums[i] + extent / 100;
+            std::vector<double> samples = boundary_samples(minimum, maximum,
+                    { original.values[i], original.minimums[i], original.defaults[i], original.maximums[i] }, tolerance);
+            int evaluations = 0;
+            uint32_t tag = original.tags[i];
+            std::vector<Flip> flips = find_flips([&](double value) { return boundary_outcome(state, tag, value); },
+                                                 samples, tolerance, &evaluations);
+            printf("%s [%f, %f], original %f: %zu flips in %d evaluations (a grid at this tolerance would need %.0f)\n",
+                   tag_to_string(tag).c_str(), original.minimums[i], original.maximums[i], original.values[i],
+                   flips.size(), evaluations, (maximum - minimum) / tolerance);
+            print_flips(flips);
+        }
+
+        // The size decides opsz when it isn't requested, which is where the 17.00 / 17.01 and
+        // 95.99 / 96.00 cases come from. Request wght 700 and keep everything else as resolved.
+        double wghtValue = 700;
+        auto size_outcome = [&](double size) {
+            CTFontRef sizedFont = make_test_font({ testCase.file, size, testCase.name });
+            if (!sizedFont) {
+                return uint8_t(0xff);
+            }
+            CaseState sized(sizedFont);
+            return boundary_outcome(sized, kWghtTag, wghtValue);
+        };
+        int evaluations = 0;
+        std::vector<Flip> flips = find_flips(size_outcome, boundary_samples(6, 200, { 17, 96, testCase.size }, tolerance),
+                                             tolerance, &evaluations);
+        printf("size [6, 200] with wght %g: %zu flips in %d evaluations\n", wghtValue, flips.size(), evaluations);
+        print_flips(flips);
+        printf("\n");
+        fflush(stdout);
+    }
+    return 0;
+}
+
+// Instance cache: instances keyed by font and variation request, shared between threads.
+// Concurrent misses on one key are coalesced (single flight): the first thread creates the
+// instance and the others wait for it, rather than each creating their own.
+//
+// Eviction is GreedyDual-Size: each entry's priority is the cache's inflation value at its last
+// use plus its benefit, and the lowest priority goes first, raising the inflation value to it. With
+// the benefit taken as creation time per byte, cheap or bulky instances go before expensive,
+// compact ones; with a benefit of 1 for every entry, this is exactly LRU. With a frequency sketch,
+// a new instance is only admitted to a full cache if it has been requested more often than the
+// one it would evict (TinyLFU), so a sweep of one-off variations can't flush the hot ones.
+
+// A request as it was given, in the font's axis order: the value asked for on each axis, out of
+// range or not, and which axes it left out. Only requests in a different axis order share a key;
+// CoreText can treat an omitted or out-of-range axis differently from the value it would resolve
+// to, and the cache mustn't hide that.
+struct InstanceKey {
+    const CaseState* state = nullptr;
+    int count = 0;
+    double values[kMaxFontAxes]; // 0 for omitted axes
+    uint64_t omitted = 0;        // a bit per axis
+    // Whether the request asked for the original variation, value for value on every axis. Not
+    // part of the key: it only lets the cache hand back the original font without a lookup.
+    bool original = false;
+
+    bool operator==(const InstanceKey& other) const {
+        return state == other.state && count == other.count && omitted == other.omitted &&
+               std::equal(values, values + count, other.values);
+    }
+};
+
+struct InstanceKeyHash {
+    size_t operator()(const InstanceKey& key) const {
+        uint64_t hash = fnv1a(0xcbf29ce484222325ull, &key.state, sizeof(key.state));
+        hash = fnv1a(hash, &key.omitted, sizeof(key.omitted));
+        return fnv1a(hash, key.values, key.count * sizeof(key.values[0]));
+    }
+};
+
+// A null variation is the key of the original font, with every axis at its original value.
+InstanceKey instance_key(const CaseState& state, CFDictionaryRef variation) {
+    const AxisValues& axes = state.originalResolvedVariation;
+    InstanceKey key;
+    key.state = &state;
+    key.count = axes.count;
+    // A request can't be told apart from the original on axes past kMaxFontAxes.
+    key.original = !variation || axes.fontAxisCount <= axes.count;
+    for (int i = 0; i < axes.count; ++i) {
+        double value = axes.values[i];
+        if (variation) {
+            long tagLong = axes.tags[i];
+            CFNumberRef tagNumber = CFNumberCreate(kCFAllocatorDefault, kCFNumberLongType, &tagLong);
+            CFNumberRef valueNumber = static_cast<CFNumberRef>(CFDictionaryGetValue(variation, tagNumber));
+            CFRelease(tagNumber);
+            if (valueNumber) {
+                CFNumberGetValue(valueNumber, kCFNumberDoubleType, &value);
+            } else {
+                key.omitted |= uint64_t(1) << i;
+                value = 0;
+            }
+        }
+        key.original = key.original && !(key.omitted >> i & 1) && value == axes.values[i];
+        // Adding 0 turns -0 into 0, which compares equal but hashes differently.
+        key.values[i] = value + 0.0;
+    }
+    return key;
+}
+
+// Frequency sketch for TinyLFU admission: a count-min sketch with four rows of `width` counters.
+// Counters saturate at 15, as 4-bit counters would. After every 10 × width additions all counters
+// are halved, so old popularity fades and a once-hot instance can be displaced.
+struct FrequencySketch {
+    static constexpr int kRows = 4;
+    static constexpr uint8_t kMaxCount = 15;
+    size_t width; // a power of two
+    std::vector<uint8_t> counters;
+    uint64_t additions = 0;
+
+    explicit FrequencySketch(size_t minimumWidth) : width(1) {
+        while (width < minimumWidth) {
+            width *= 2;
+        }
+        counters.resize(kRows * width);
+    }
+
+    size_t index(uint64_t hash, int row) const {
+        static constexpr uint64_t kSeeds[kRows] = {
+            0x9e3779b97f4a7c15ull, 0xbf58476d1ce4e5b9ull, 0x94d049bb133111ebull, 0xd6e8feb86659fd93ull,
+        };
+        uint64_t mixed = hash * kSeeds[row];
+        return row * width + ((mixed ^ (mixed >> 32)) & (width - 1));
+    }
+
+    void add(uint64_t hash) {
+        for (int row = 0; row < kRows; ++row) {
+            uint8_t& counter = counters[index(hash, row)];
+            counter += counter < kMaxCount;
+        }
+        if (++additions == 10 * width) {
+            for (uint8_t& counter : counters) {
+                counter >>= 1;
+            }
+            additions /= 2;
+        }
+    }
+
+    uint8_t estimate(uint64_t hash) const {
+        uint8_t count = kMaxCount;
+        for (int row = 0; row < kRows; ++row) {
+            count = std::min(count, counters[index(hash, row)]);
+        }
+        return count;
+    }
+};
+
+constexpr std::chrono::milliseconds kInstanceWaitTimeout(1000);
+
+// Heap growth is a noisy measure of an instance's footprint: allocations by other threads land in
+// it, and memory CoreText frees at the same time hides it. Every instance is counted as at least this.
+constexpr size_t kMinimumInstanceBytes = 1024;
+
+size_t heap_bytes_in_use() {
+    malloc_statistics_t statistics;
+    malloc_zone_statistics(nullptr, &statistics);
+    return statistics.size_in_use;
+}
+
+struct InstanceCache {
+    // One creation in progress. Waiters hold a reference, so it outlives its entry in flights.
+    struct Flight {
+        bool done = false;
+        CTFontRef font = nullptr; // null if creation failed
+        ~Flight() {
+            if (font) {
+                CFRelease(font);
+            }
+        }
+    };
+    struct Entry {
+        CTFontRef font;
+        double seconds; // to create and realize the instance
+        size_t bytes;   // heap growth across creation
+        std::multimap<double, InstanceKey>::iterator priority;
+    };
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;    // each one created an instance
+        uint64_t coalesced = 0; // misses that waited on another thread's creation instead
+        uint64_t timeouts = 0;  // waits that gave up and created their own instance
+        uint64_t failures = 0;
+        uint64_t evictions = 0;
+        uint64_t rejections = 0; // created but not admitted
+        double createSeconds = 0;
+        size_t peakBytes = 0;
+    };
+
+    size_t capacity;
+    size_t byteBudget; // 0 for none
+    bool costAware;    // GreedyDual-Size by creation time per byte, rather than LRU
+    bool coalesce;
+    std::chrono::milliseconds timeout;
+    std::mutex mutex;
+    std::condition_variable flightDone;
+    std::unordered_map<InstanceKey, Entry, InstanceKeyHash> entries;
+    std::multimap<double, InstanceKey> evictionOrder; // lowest priority first; ties in order of last use
+    double inflation = 0;
+    size_t bytes = 0;
+    std::unordered_map<InstanceKey, std::shared_ptr<Flight>, InstanceKeyHash> flights;
+    std::unique_ptr<FrequencySketch> sketch; // null for no admission filter
+    Stats stats;
+
+    struct Config {
+        size_t capacity = 64;
+        size_t byteBudget = 0;
+        bool costAware = false;
+        bool coalesce = true;
+        std::chrono::milliseconds timeout = kInstanceWaitTimeout;
+        size_t sketchWidth = 0; // counters per row of the admission sketch, 0 for none
+    };
+
+    explicit InstanceCache(const Config& config)
+        : capacity(config.capacity), byteBudget(config.byteBudget), costAware(config.costAware)
+        , coalesce(config.coalesce), timeout(config.timeout)
+        , sketch(config.sketchWidth ? new FrequencySketch(config.sketchWidth) : nullptr) {}
+    ~InstanceCache() {
+        for (auto& [key, entry] : entries) {
+            CFRelease(entry.font);
+        }
+    }
+
+    // Returns the instance for key, which the caller releases, or nullptr if it couldn't be
+    // created. If another thread is already creating it, waits for that thread and shares its
+    // result, failure included. A wait longer than the timeout is abandoned and the instance
+    // created here instead, so one stuck creation can't hold up every thread that wants it.
+    CTFontRef get(const InstanceKey& key) {
+        // Requests for the original variation, which is every request to a static font, get the
+        // original font without touching the sketch, the lock or the map.
+        if (key.original) {
+            return static_cast<CTFontRef>(CFRetain(key.state->originalFont));
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        if (sketch) {
+            sketch->add(InstanceKeyHash()(key));
+        }
+        auto entry = entries.find(key);
+        if (entry != entries.end()) {
+            ++stats.hits;
+            evictionOrder.erase(entry->second.priority);
+            entry->second.priority = evictionOrder.emplace(priority(entry->second), key);
+            return static_cast<CTFontRef>(CFRetain(entry->second.font));
+        }
+        if (coalesce) {
+            auto flight = flights.find(key);
+            if (flight != flights.end()) {
+                std::shared_ptr<Flight> waiting = flight->second;
+                if (flightDone.wait_for(lock, timeout, [&]() { return waiting->done; })) {
+                    ++stats.coalesced;
+                    return waiting->font ? static_cast<CTFontRef>(CFRetain(waiting->font)) : nullptr;
+                }
+                ++stats.timeouts;
+            }
+        }
+
+        ++stats.misses;
+        std::shared_ptr<Flight> flight = std::make_shared<Flight>();
+        if (coalesce) {
+            flights.emplace(key, flight);
+        }
+        lock.unlock();
+        Entry created = create(key);
+        lock.lock();
+        stats.createSeconds += created.seconds;
+        flight->font = created.font;
+        flight->done = true;
+        auto registered = flights.find(key);
+        if (registered != flights.end() && registered->second == flight) {
+            flights.erase(registered);
+        }
+        if (created.font) {
+            insert(key, created);
+        } else {
+            // Failures aren't cached; the next request for the key tries again.
+            ++stats.failures;
+        }
+        lock.unlock();
+        flightDone.notify_all();
+        return created.font ? static_cast<CTFontRef>(CFRetain(created.font)) : nullptr;
+    }
+
+    static Entry create(const InstanceKey& key) {
+        const AxisValues& axes = key.state->originalResolvedVariation;
+        CFMutableDictionaryRef variation =
+                CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+                                          &kCFTypeDictionaryKeyCallBacks,
+                                          &kCFTypeDictionaryValueCallBacks);
+        for (int i = 0; i < key.count; ++i) {
+            if (!(key.omitted >> i & 1)) {
+                add_axis_value(variation, axes.tags[i], key.values[i]);
+            }
+        }
+        size_t heapBefore = heap_bytes_in_use();
+        auto begin = std::chrono::steady_clock::now();
+        Entry entry = {};
+        entry.font = create_font_with_variation(*key.state, variation);
+        if (entry.font) {
+            // Make sure the instance is actually realized, not just described.
+            CGGlyph glyph = 0;
+            CTFontGetAdvancesForGlyphs(entry.font, kCTFontOrientationDefault, &glyph, nullptr, 1);
+        }
+        entry.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        size_t heapAfter = heap_bytes_in_use();
+        entry.bytes = std::max(heapAfter > heapBefore ? heapAfter - heapBefore : 0, kMinimumInstanceBytes);
+        CFRelease(variation);
+        return entry;
+    }
+
+    // GreedyDual-Size priority as of now.
+    double priority(const Entry& entry) const {
+        return inflation + (costAware ? entry.seconds / entry.bytes : 1);
+    }
+
+    bool over_budget() const {
+        return entries.size() > capacity || (byteBudget && bytes > byteBudget);
+    }
+
+    // Called with the lock held.
+    void insert(const InstanceKey& key, const Entry& created) {
+        if (entries.count(key)) {
+            // Created concurrently without coalescing, or by a thread whose wait timed out.
+            return;
+        }
+        if (sketch && !entries.empty() &&
+            (entries.size() >= capacity || (byteBudget && bytes + created.bytes > byteBudget)) &&
+            sketch->estimate(InstanceKeyHash()(key)) <= sketch->estimate(InstanceKeyHash()(evictionOrder.begin()->second))) {
+            ++stats.rejections;
+            return;
+        }
+        Entry& entry = entries.emplace(key, created).first->second;
+        CFRetain(entry.font);
+        entry.priority = evictionOrder.emplace(priority(entry), key);
+        bytes += entry.bytes;
+        while (over_budget() && !evictionOrder.empty()) {
+            ++stats.evictions;
+            auto victim = entries.find(evictionOrder.begin()->second);
+            inflation = evictionOrder.begin()->first;
+            evictionOrder.erase(evictionOrder.begin());
+            bytes -= victim->second.bytes;
+            CFRelease(victim->second.font);
+            entries.erase(victim);
+        }
+        stats.peakBytes = std::max(stats.peakBytes, bytes);
+    }
+};
+
+// Affected glyphs: which glyphs an axis can change at all, from the font's gvar and HVAR. Going
+// from one instance to a neighbor that differs in a few axes, as the sweep's bumps do, the
+// advances of every other glyph carry over and needn't be asked for again.
+
+// The fvar axes on which two instances of a font differ.
+AxisMask changed_axes(const CaseState& state, const InstanceKey& a, const InstanceKey& b) {
+    const std::vector<uint32_t>& fvarTags = state.variations().influence.axisTags;
+    const AxisValues& axes = state.originalResolvedVariation;
+    AxisMask changed = 0;
+    for (int i = 0; i < std::min(a.count, b.count); ++i) {
+        if (a.values[i] != b.values[i] || (a.omitted ^ b.omitted) >> i & 1) {
+            auto fvarAxis = std::find(fvarTags.begin(), fvarTags.end(), axes.tags[i]);
+            // An axis CoreText reports but fvar doesn't have can't be placed, so it could be any.
+            changed |= fvarAxis != fvarTags.end() ? axis_bit(fvarAxis - fvarTags.begin()) : kAllAxes;
+        }
+    }
+    return changed;
+}
+
+// Fills in the advances of glyphs in font from those of a neighboring instance, asking CoreText
+// only for the glyphs whose advance depends on a changed axis. Returns how many it asked for.
+size_t advances_from_neighbor(const CaseState& state, AxisMask changed, CTFontRef font,
+                              const std::vector<CGGlyph>& glyphs, const CGSize* neighborAdvances, CGSize* advances) {
+    const std::vector<AxisMask>& advanceAxes = state.variations().influence.advanceAxes;
+    thread_local std::vector<CGGlyph> affectedGlyphs;
+    thread_local std::vector<size_t> affectedIndices;
+    thread_local std::vector<CGSize> affectedAdvances;
+    affectedGlyphs.clear();
+    affectedIndices.clear();
+    for (size_t i = 0; i < glyphs.size(); ++i) {
+        if (glyphs[i] >= advanceAxes.size() || advanceAxes[glyphs[i]] & changed) {
+            affectedGlyphs.push_back(glyphs[i]);
+            affectedIndices.push_back(i);
+        } else {
+            advances[i] = neighborAdvances[i];
+        }
+    }
+    affectedAdvances.resize(affectedGlyphs.size());
+    CTFontGetAdvancesForGlyphs(font, kCTFontOrientationDefault, affectedGlyphs.data(), affectedAdvances.data(),
+                               affectedGlyphs.size());
+    for (size_t i = 0; i < affectedIndices.size(); ++i) {
+        advances[affectedIndices[i]] = affectedAdvances[i];
+    }
+    return affectedGlyphs.size();
+}
+
+std::string describe_axes(const std::vector<uint32_t>& fvarTags, AxisMask axes) {
+    std::string description;
+    for (size_t axis = 0; axis < fvarTags.size(); ++axis) {
+        if (axes & axis_bit(axis)) {
+            description += description.empty() ? "" : ",";
+            description += tag_to_string(fvarTags[axis]);
+        }
+    }
+    return description.empty() ? "none" : description;
+}
+
+int run_affected_report() {
+    for (const TestCase& testCase : gTestCases) {
+        CTFontRef font = make_test_font(testCase);
+        if (!font) {
+            continue;
+        }
+        CaseState state(font);
+        const AxisInfluence& influence = state.variations().influence;
+        printf("%s: %zu fvar axes, %zu glyphs, outlines from %s, advances from %s\n", testCase.name,
+               influence.axisTags.size(), influence.outlineAxes.size(), influence.fromGvar ? "gvar" : "nothing (all assumed)",
+               influence.fromHvar ? "HVAR" : influence.fromGvar ? "gvar" : "nothing (all assumed)");
+        for (size_t axis = 0; axis < influence.axisTags.size(); ++axis) {
+            AxisMask bit = axis_bit(axis);
+            size_t outlines = std::count_if(influence.outlineAxes.begin(), influence.outlineAxes.end(),
+                                            [&](AxisMask axes) { return axes & bit; });
+            size_t advances = std::count_if(influence.advanceAxes.begin(), influence.advanceAxes.end(),
+                                            [&](AxisMask axes) { return axes & bit; });
+            std::string metrics;
+            for (const auto& [tag, axes] : influence.metricAxes) {
+                if (axes & bit) {
+                    metrics += " " + tag_to_string(tag);
+                }
+            }
+            printf("  %s: outlines of %zu glyphs, advances of %zu glyphs, metrics:%s\n",
+                   tag_to_string(influence.axisTags[axis]).c_str(), outlines, advances,
+                   metrics.empty() ? " none" : metrics.c_str());
+        }
+        size_t unaffected = std::count(influence.outlineAxes.begin(), influence.outlineAxes.end(), 0);
+        printf("  glyphs no axis changes: %zu\n", unaffected);
+        const FontVariations& variations = state.variations();
+        printf("  axis influence and region indexes: %s in %.3f ms\n",
+               variations.fromSidecar ? "read from the sidecar" : "built", variations.acceleratorSeconds * 1e3);
+        for (const auto& [name, store] : { std::make_pair("HVAR", &variations.expandedAdvanceStore),
+                                           std::make_pair("MVAR", &variations.expandedMetricStore),
+                                           std::make_pair("GDEF", &variations.expandedGdefStore) }) {
+            if (!store->subtables.empty()) {
+                size_t expanded = std::count_if(store->subtables.begin(), store->subtables.end(),
+                                                [](const auto& subtable) { return subtable.expanded; });
+                printf("  %s deltas: %zu bytes packed, %zu of %zu subtables expanded to %zu bytes\n", name,
+                       store->packedBytes, expanded, store->subtables.size(), store->expandedBytes);
+            }
+        }
+        for (const auto& [tag, axes] : influence.metricAxes) {
+            printf("  metric %s: %s\n", tag_to_string(tag).c_str(), describe_axes(influence.axisTags, axes).c_str());
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    return 0;
+}
+
+// Benchmarks: throughput of the CoreText calls a variable font exercises, per test case and
+// thread count. bench.sh runs them over generated fonts of increasing size.
+
+// A random request over every axis, anywhere in range.
+CFMutableDictionaryRef random_variation(std::mt19937_64& rng, const AxisValues& axes) {
+    CFMutableDictionaryRef variation =
+            CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+                                      &kCFTypeDictionaryKeyCallBacks,
+                                      &kCFTypeDictionaryValueCallBacks);
+    for (int i = 0; i < axes.count; ++i) {
+        add_axis_value(variation, axes.tags[i], std::uniform_real_distribution<double>(axes.minimums[i], axes.maximums[i])(rng));
+    }
+    return variation;
+}
+
+// Each thread's view of one benchmark run. Instances are made once per thread, so the read-only
+// benchmarks don't measure instance creation. Each instance has a neighbor with one axis bumped
+// by 0.0001, as in the sweep, whose advances are known.
+struct BenchmarkThread {
+    const CaseState& state;
+    std::mt19937_64 rng;
+    std::vector<CTFontRef> instances;
+    std::vector<CTFontRef> neighbors;
+    std::vector<AxisMask> neighborChanges;
+    std::vector<std::vector<CGSize>> neighborAdvances;
+    std::vector<std::vector<double>> values; // of each instance, in fvar order
+    std::vector<std::vector<double>> coordinates; // normalized, of each instance
+    std::vector<std::pair<uint32_t, double>> activeRegions;
+    std::vector<double> regionScalars;
+    std::vector<std::vector<double>> rowDeltas; // per subtable
+    std::vector<double> sharedTupleScalars;
+    std::vector<CGGlyph> glyphs;
+    std::vector<CGSize> advances;
+    double checksum = 0; // keeps the evaluation benchmarks from being optimized away
+    size_t next = 0;
+
+    BenchmarkThread(const CaseState& state, uint64_t seed) : state(state), rng(seed) {
+        constexpr int kInstances = 16;
+        const AxisValues& axes = state.originalResolvedVariation;
+        CFIndex glyphCount = std::min<CFIndex>(CTFontGetGlyphCount(state.originalFont), 4096);
+        for (CFIndex glyph = 0; glyph < glyphCount; ++glyph) {
+            glyphs.push_back(glyph);
+        }
+        advances.resize(glyphs.size());
+        for (int i = 0; i < kInstances; ++i) {
+            CFMutableDictionaryRef variation = random_variation(rng, axes);
+            instances.push_back(font_for_variation(state, variation));
+            AxisValues instanceValues = read_axis_values(instances.back());
+            values.push_back(state.variations().fvar_values(instanceValues));
+            coordinates.push_back(state.variations().normalize(instanceValues));
+            InstanceKey key = instance_key(state, variation);
+            if (axes.count) {
+                int axis = i % axes.count;
+                double value = std::min(key.values[axis] + 0.0001, axes.maximums[axis]);
+                CFDictionaryRemoveAllValues(variation);
+                for (int j = 0; j < axes.count; ++j) {
+                    add_axis_value(variation, axes.tags[j], j == axis ? value : key.values[j]);
+                }
+            }
+            CTFontRef neighbor = font_for_variation(state, variation);
+            neighbors.push_back(neighbor);
+            neighborChanges.push_back(changed_axes(state, key, instance_key(state, variation)));
+            neighborAdvances.emplace_back(glyphs.size());
+            CTFontGetAdvancesForGlyphs(neighbor, kCTFontOrientationDefault, glyphs.data(),
+                                       neighborAdvances.back().data(), glyphs.size());
+            CFRelease(variation);
+        }
+    }
+    ~BenchmarkThread() {
+        for (CTFontRef instance : instances) {
+            CFRelease(instance);
+        }
+        for (CTFontRef neighbor : neighbors) {
+            CFRelease(neighbor);
+        }
+    }
+    CTFontRef instance() { return instances[next++ % instances.size()]; }
+    size_t instance_index() { return next++ % instances.size(); }
+    const double* instance_coordinates() { return coordinates[next++ % coordinates.size()].data(); }
+};
+
+uint64_t run_variation_kernels(BenchmarkThread& thread, NormalizeKernel normalize, RegionScalarKernel regionScalar) {
+    const FontVariations& variations = thread.state.variations();
+    const RegionIndex& regions = variations.sparseAdvanceStore.regions;
+    if (variations.hvar.reader.empty() || !regions.size()) {
+        return 0;
+    }
+    size_t i = thread.instance_index();
+    std::vector<double>& coordinates = thread.coordinates[i];
+    normalize_coordinates(normalize, variations.axes, variations.avar.reader, thread.values[i].data(), coordinates.data());
+    thread.regionScalars.resize(regions.size());
+    regions.scalars(regionScalar, coordinates.data(), thread.regionScalars.data());
+    thread.checksum += thread.regionScalars[0];
+    return regions.size();
+}
+
+struct Benchmark {
+    const char* name;
+    const char* unit;
+    // Does one unit of work and returns how many units it did.
+    uint64_t (*run)(BenchmarkThread& thread);
+};
+
+const Benchmark kBenchmarks[] = {
+    // CoreText doesn't expose normalization; reading the resolved variation back is the closest.
+    { "resolve", "instances", [](BenchmarkThread& thread) -> uint64_t {
+          read_axis_values(thread.instance());
+          return 1;
+      } },
+    { "instance", "instances", [](BenchmarkThread& thread) -> uint64_t {
+          CFMutableDictionaryRef variation = random_variation(thread.rng, thread.state.originalResolvedVariation);
+          CTFontRef font = font_for_variation(thread.state, variation);
+          // Make sure the instance is actually realized, not just described.
+          CGGlyph glyph = 0;
+          CTFontGetAdvancesForGlyphs(font, kCTFontOrientationDefault, &glyph, nullptr, 1);
+          CFRelease(font);
+          CFRelease(variation);
+          return 1;
+      } },
+    { "advances", "glyphs", [](BenchmarkThread& thread) -> uint64_t {
+          CTFontGetAdvancesForGlyphs(thread.instance(), kCTFontOrientationDefault, thread.glyphs.data(),
+                                     thread.advances.data(), thread.glyphs.size());
+          return thread.glyphs.size();
+      } },
+    // Only the glyphs whose advance depends on the bumped axis are asked for, the rest come from the neighbor.
+    { "adv-reuse", "glyphs", [](BenchmarkThread& thread) -> uint64_t {
+          size_t i = thread.instance_index();
+          advances_from_neighbor(thread.state, thread.neighborChanges[i], thread.instances[i], thread.glyphs,
+                                 thread.neighborAdvances[i].data(), thread.advances.data());
+          return thread.glyphs.size();
+      } },
+    // Advance deltas from HVAR at an instance's coordinates, done by this file rather than CoreText:
+    // first visiting every region of each row, then only the regions a RegionIndex finds active.
+    { "ivs-naive", "glyphs", [](BenchmarkThread& thread) -> uint64_t {
+          const FontVariations& variations = thread.state.variations();
+          if (variations.hvar.reader.empty()) {
+              return 0;
+          }
+          const double* coordinates = thread.instance_coordinates();
+          for (CGGlyph glyph : thread.glyphs) {
+              auto [outer, inner] = delta_set_index(variations.advanceMap, glyph);
+              thread.checksum += variations.advanceStore.delta(outer, inner, coordinates);
+          }
+          return thread.glyphs.size();
+      } },
+    { "ivs-sparse", "glyphs", [](BenchmarkThread& thread) -> uint64_t {
+          const FontVariations& variations = thread.state.variations();
+          if (variations.hvar.reader.empty()) {
+              return 0;
+          }
+          variations.sparseAdvanceStore.regions.active(thread.instance_coordinates(), &thread.activeRegions);
+          for (CGGlyph glyph : thread.glyphs) {
+              auto [outer, inner] = delta_set_index(variations.advanceMap, glyph);
+              thread.checksum += variations.sparseAdvanceStore.delta(outer, inner, thread.activeRegions);
+          }
+          return thread.glyphs.size();
+      } },
+    // The same with the rows expanded at load: all the deltas of each subtable are computed column by
+    // column over the active regions, then looked up per glyph.
+    { "ivs-soa", "glyphs", [](BenchmarkThread& thread) -> uint64_t {
+          const FontVariations& variations = thread.state.variations();
+          if (variations.hvar.reader.empty()) {
+              return 0;
+          }
+          const ExpandedItemVariationStore& store = variations.expandedAdvanceStore;
+          variations.sparseAdvanceStore.regions.active(thread.instance_coordinates(), &thread.activeRegions);
+          thread.regionScalars.assign(store.store.regionCount, 0);
+          for (const auto& [region, scalar] : thread.activeRegions) {
+              thread.regionScalars[region] = scalar;
+          }
+          thread.rowDeltas.resize(store.subtables.size());
+          for (uint16_t outer = 0; outer < store.subtables.size(); ++outer) {
+              store.deltas(outer, thread.regionScalars.data(), &thread.rowDeltas[outer]);
+          }
+          for (CGGlyph glyph : thread.glyphs) {
+              auto [outer, inner] = delta_set_index(variations.advanceMap, glyph);
+              if (outer < thread.rowDeltas.size() && inner < thread.rowDeltas[outer].size()) {
+                  thread.checksum += thread.rowDeltas[outer][inner];
+              }
+          }
+          return thread.glyphs.size();
+      } },
+    // Normalizing an instance's coordinates and working out the scalar of every HVAR region, with the
+    // generic loops and with the kernels specialized for the font's axis count.
+    { "kern-generic", "regions", [](BenchmarkThread& thread) -> uint64_t {
+          return run_variation_kernels(thread, normalize_generic, region_scalar_generic);
+      } },
+    { "kern-fixed", "regions", [](BenchmarkThread& thread) -> uint64_t {
+          const FontVariations& variations = thread.state.variations();
+          return run_variation_kernels(thread, variations.normalizeKernel, variations.sparseAdvanceStore.regions.kernel);
+      } },
+    // The scalar of every gvar tuple of every glyph, then only of the tuples on active shared peaks.
+    { "gvar-naive", "glyphs", [](BenchmarkThread& thread) -> uint64_t {
+          const FontVariations& variations = thread.state.variations();
+          if (variations.gvar.reader.empty()) {
+              return 0;
+          }
+          const double* coordinates = thread.instance_coordinates();
+          for (CGGlyph glyph : thread.glyphs) {
+              for_each_gvar_tuple(variations.gvar.reader, glyph, [&](const GvarTuple& tuple) {
+                  thread.checksum += gvar_tuple_scalar(tuple, variations.axes.size(), coordinates);
+              });
+          }
+          return thread.glyphs.size();
+      } },
+    { "gvar-sparse", "glyphs", [](BenchmarkThread& thread) -> uint64_t {
+          const FontVariations& variations = thread.state.variations();
+          if (variations.gvar.reader.empty()) {
+              return 0;
+          }
+          const double* coordinates = thread.instance_coordinates();
+          thread.sharedTupleScalars.assign(variations.sharedTuples.size(), 0);
+          variations.sharedTuples.active(coordinates, &thread.activeRegions);
+          for (const auto& [tuple, scalar] : thread.activeRegions) {
+              thread.sharedTupleScalars[tuple] = scalar;
+          }
+          for (CGGlyph glyph : thread.glyphs) {
+              for_each_active_gvar_tuple(variations.gvar.reader, glyph, coordinates, thread.sharedTupleScalars,
+                                         [&](const GvarTuple&, double scalar) { thread.checksum += scalar; });
+          }
+          return thread.glyphs.size();
+      } },
+    { "outlines", "glyphs", [](BenchmarkThread& thread) -> uint64_t {
+          CTFontRef font = thread.instance();
+          for (CGGlyph glyph : thread.glyphs) {
+              if (CGPathRef path = CTFontCreatePathForGlyph(font, glyph, nullptr)) {
+                  CGPathRelease(path);
+              }
+          }
+          return thread.glyphs.size();
+      } },
+};
+
+// Runs benchmark on `threads` threads for about `seconds` and returns units per second.
+double run_benchmark(const CaseState& state, const Benchmark& benchmark, int threads, double seconds) {
+    std::atomic<bool> start(false);
+    std::atomic<int> ready(0);
+    std::vector<uint64_t> units(threads);
+    std::vector<double> elapsed(threads);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i]() {
+            BenchmarkThread thread(state, i + 1);
+            ++ready;
+            while (!start.load()) {
+                std::this_thread::yield();
+            }
+            auto begin = std::chrono::steady_clock::now();
+            auto deadline = begin + std::chrono::duration<double>(seconds);
+            uint64_t done = 0;
+            auto now = begin;
+            do {
+                done += benchmark.run(thread);
+                now = std::chrono::steady_clock::now();
+            } while (now < deadline);
+            units[i] = done;
+            elapsed[i] = std::chrono::duration<double>(now - begin).count();
+        });
+    }
+    while (ready.load() < threads) {
+        std::this_thread::yield();
+    }
+    start = true;
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double rate = 0;
+    for (int i = 0; i < threads; ++i) {
+        rate += units[i] / elapsed[i];
+    }
+    return rate;
+}
+
+double thread_cpu_seconds() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+constexpr int kHerdRounds = 64;
+
+struct HerdResult {
+    double cpuSeconds; // spent in InstanceCache::get, over all threads and rounds
+    uint64_t created;
+};
+
+// Thundering herd: in each round every thread asks the instance cache for the same new instance at
+// once, as on the first paint of a UI at a new weight. Without coalescing each thread creates it.
+HerdResult run_herd_benchmark(const CaseState& state, int threads, bool coalesce) {
+    std::mt19937_64 rng(1);
+    std::vector<InstanceKey> keys;
+    for (int round = 0; round < kHerdRounds; ++round) {
+        CFMutableDictionaryRef variation = random_variation(rng, state.originalResolvedVariation);
+        keys.push_back(instance_key(state, variation));
+        CFRelease(variation);
+    }
+    InstanceCache::Config config;
+    config.capacity = kHerdRounds;
+    config.coalesce = coalesce;
+    InstanceCache cache(config);
+    std::atomic<int> round(-1);
+    std::atomic<int> arrived(0);
+    std::vector<double> cpuSeconds(threads);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i]() {
+            for (int r = 0; r < kHerdRounds; ++r) {
+                while (round.load() < r) {
+                    std::this_thread::yield();
+                }
+                double begin = thread_cpu_seconds();
+                CTFontRef font = cache.get(keys[r]);
+                cpuSeconds[i] += thread_cpu_seconds() - begin;
+                if (font) {
+                    CFRelease(font);
+                }
+                ++arrived;
+            }
+        });
+    }
+    for (int r = 0; r < kHerdRounds; ++r) {
+        round = r;
+        while (arrived.load() < threads * (r + 1)) {
+            std::this_thread::yield();
+        }
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    HerdResult result = { 0, cache.stats.misses };
+    for (double seconds : cpuSeconds) {
+        result.cpuSeconds += seconds;
+    }
+    return result;
+}
+
+int run_benchmarks(const std::vector<int>& threadCounts, double seconds) {
+    printf("%-40s %5s %7s %7s %-10s %14s\n", "case", "axes", "glyphs", "threads", "benchmark", "rate");
+    for (const TestCase& testCase : gTestCases) {
+        CTFontRef font = make_test_font(testCase);
+        if (!font) {
+            continue;
+        }
+        CaseState state(font);
+        // Past kMaxFontAxes, axes aren't varied, so more of them would look free.
+        if (state.originalResolvedVariation.fontAxisCount > state.originalResolvedVariation.count) {
+            printf("%-40s skipped: %d axes, of which only %d are varied\n", testCase.name,
+                   state.originalResolvedVariation.fontAxisCount, state.originalResolvedVariation.count);
+            continue;
+        }
+        for (int threads : threadCounts) {
+            for (const Benchmark& benchmark : kBenchmarks) {
+                double rate = run_benchmark(state, benchmark, threads, seconds);
+                printf("%-40s %5d %7ld %7d %-10s %14.1f %s/s\n", testCase.name, state.originalResolvedVariation.count,
+                       (long)CTFontGetGlyphCount(font), threads, benchmark.name, rate, benchmark.unit);
+                fflush(stdout);
+            }
+            for (bool coalesce : { false, true }) {
+                HerdResult herd = run_herd_benchmark(state, threads, coalesce);
+                printf("%-40s %5d %7ld %7d %-10s %14.1f us CPU/round, %.2f instances/round\n", testCase.name,
+                       state.originalResolvedVariation.count, (long)CTFontGetGlyphCount(font), threads,
+                       coalesce ? "herd-sf" : "herd", herd.cpuSeconds * 1e6 / kHerdRounds,
+                       double(herd.created) / kHerdRounds);
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
+
+// Trace replay: the instance cache's hit rate, and the creation time its misses cost, by policy on
+// a synthetic trace over every test case at once. For each font a working set of hot instances is
+// requested with Zipf-like frequencies, and now and then a sweep of one-off weights goes through,
+// like the sweep's wght loop.
+
+constexpr size_t kReplayRequests = 20000;
+constexpr int kReplayHotInstances = 32; // per font
+constexpr int kReplaySweepLength = 100;
+
+struct ReplayFont {
+    const CaseState* state;
+    std::vector<InstanceKey> hot;
+    std::discrete_distribution<int> popularity;
+    int sweepAxis;
+};
+
+std::vector<InstanceKey> make_replay_trace(const std::vector<std::unique_ptr<CaseState>>& states, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<ReplayFont> fonts;
+    for (const std::unique_ptr<CaseState>& state : states) {
+        const AxisValues& axes = state->originalResolvedVariation;
+        if (!axes.count) {
+            continue;
+        }
+        ReplayFont font = { state.get(), {}, {}, 0 };
+        std::vector<double> weights;
+        for (int i = 0; i < kReplayHotInstances; ++i) {
+            CFMutableDictionaryRef variation = random_variation(rng, axes);
+            font.hot.push_back(instance_key(*state, variation));
+            CFRelease(variation);
+            weights.push_back(1.0 / (i + 1));
+        }
+        font.popularity = std::discrete_distribution<int>(weights.begin(), weights.end());
+        for (int i = 0; i < axes.count; ++i) {
+            if (axes.tags[i] == kWghtTag) {
+                font.sweepAxis = i;
+            }
+        }
+        fonts.push_back(std::move(font));
+    }
+
+    std::vector<InstanceKey> trace;
+    while (!fonts.empty() && trace.size() < kReplayRequests) {
+        ReplayFont& font = fonts[std::uniform_int_distribution<size_t>(0, fonts.size() - 1)(rng)];
+        if (std::uniform_int_distribution<int>(0, 999)(rng) < 2) {
+            // Every weight in the sweep is new, so LRU caches all of them and drops the hot set.
+            const AxisValues& axes = font.state->originalResolvedVariation;
+            int axis = font.sweepAxis;
+            for (int i = 0; i < kReplaySweepLength; ++i) {
+                InstanceKey key = instance_key(*font.state, nullptr);
+                key.values[axis] = std::uniform_real_distribution<double>(axes.minimums[axis], axes.maximums[axis])(rng);
+                key.original = key.values[axis] == axes.values[axis];
+                trace.push_back(key);
+            }
+        } else {
+            trace.push_back(font.hot[font.popularity(rng)]);
+        }
+    }
+    trace.resize(std::min(trace.size(), kReplayRequests));
+    return trace;
+}
+
+struct ReplayPolicy {
+    const char* name;
+    bool costAware;
+    bool admission;
+};
+
+const ReplayPolicy kReplayPolicies[] = {
+    { "LRU", false, false },
+    { "TinyLFU", false, true },
+    { "GDS", true, false },
+    { "GDS+TLFU", true, true },
+};
+
+// sketchWidth 0 sizes each sketch to 16 counters per cache entry. byteBudget 0 is no memory budget.
+int run_replay(uint64_t seed, size_t sketchWidth, size_t byteBudget) {
+    std::vector<std::unique_ptr<CaseState>> states;
+    for (const TestCase& testCase : gTestCases) {
+        if (CTFontRef font = make_test_font(testCase)) {
+            states.emplace_back(new CaseState(font));
+        }
+    }
+    std::vector<InstanceKey> trace = make_replay_trace(states, seed);
+    printf("Replaying %zu requests over %zu fonts", trace.size(), states.size());
+    if (byteBudget) {
+        printf(", memory budget %zu bytes", byteBudget);
+    }
+    printf("\n%8s %-9s %9s %9s %12s %12s\n", "capacity", "policy", "hit rate", "created", "create ms", "peak KB");
+    for (size_t capacity : { 8, 16, 32, 64, 128 }) {
+        for (const ReplayPolicy& policy : kReplayPolicies) {
+            InstanceCache::Config config;
+            config.capacity = capacity;
+            config.byteBudget = byteBudget;
+            config.costAware = policy.costAware;
+            config.sketchWidth = policy.admission ? (sketchWidth ? sketchWidth : 16 * capacity) : 0;
+            InstanceCache cache(config);
+            for (const InstanceKey& key : trace) {
+                if (CTFontRef instance = cache.get(key)) {
+                    CFRelease(instance);
+                }
+            }
+            printf("%8zu %-9s %8.1f%% %9llu %12.1f %12.1f\n", capacity, policy.name,
+                   100.0 * cache.stats.hits / std::max<size_t>(trace.size(), 1), (unsigned long long)cache.stats.misses,
+                   cache.stats.createSeconds * 1e3, cache.stats.peakBytes / 1024.0);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
+
+// Results are flushed to disk at least this often, so an interrupted run loses at most this many cells.
+constexpr uint32_t kCheckpointInterval = 16;
+
+void checkpoint(FILE* results) {
+    fflush(results);
+    fsync(fileno(results));
+}
+
+// Opens the results file of an earlier, interrupted run and reads back the records it completed.
+// Only the leading run of whole records in cell order is kept. The file is truncated after it, so
+// the sweep can append from there and end up with the same file as an uninterrupted run.
+FILE* open_checkpoint(const char* path, std::vector<SweepRecord>* completed) {
+    FILE* results = fopen(path, "r+b");
+    if (!results) {
+        return fopen(path, "wb");
+    }
+    SweepRecord record;
+    while (fread(&record, sizeof(record), 1, results) == 1 &&
+           record.cell == completed->size() && record.cell < cell_count() &&
+           record.caseIndex == sweep_cell(record.cell).caseIndex) {
+        completed->push_back(record);
+    }
+    off_t length = completed->size() * sizeof(SweepRecord);
+    if (ftruncate(fileno(results), length) != 0 || fseeko(results, length, SEEK_SET) != 0) {
+        fclose(results);
+        return nullptr;
+    }
+    return results;
+}
+
+constexpr int kMaxJobs = 64;
+constexpr uint32_t kNoItem = UINT32_MAX;
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared with other processes");
+static_assert(std::atomic<uint8_t>::is_always_lock_free, "shared with other processes");
+
+// Lives in memory shared by the coordinator and its workers.
+struct SharedQueue {
+    std::atomic<uint32_t> nextItem;
+    std::atomic<uint32_t> workerItem[kMaxJobs]; // the item each worker is on, or kNoItem
+};
+
+enum : uint8_t {
+    kItemPending,
+    kItemDone,
+    kItemCrashed,
+};
+
+// Runs work(item) for every item in [firstItem, itemCount) in `jobs` forked worker processes. A
+// child can't use CoreFoundation once its parent has, so the coordinator must not touch CoreText
+// before this returns.
+//
+// Workers take items from a shared counter and write each result into that item's slot of a shared
+// array. As items finish, the coordinator calls finished(item, result), with a null result for an
+// item whose worker crashed; in item order when `ordered`, otherwise as they come. A worker that
+// dies takes only its current item with it, and a replacement worker carries on.
+template <typename Result, typename Work, typename Finished>
+bool run_forked(int jobs, uint32_t firstItem, uint32_t itemCount, bool ordered, Work work, Finished finished) {
+    static_assert(std::is_trivially_copyable<Result>::value, "results are copied between processes");
+    size_t resultsOffset = (sizeof(SharedQueue) + alignof(Result) - 1) / alignof(Result) * alignof(Result);
+    size_t statesOffset = resultsOffset + itemCount * sizeof(Result);
+    size_t mappingSize = statesOffset + itemCount;
+    void* mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+    if (mapping == MAP_FAILED) {
+        printf("Could not map shared memory for %d jobs\n", jobs);
+        return false;
+    }
+    SharedQueue* shared = new (mapping) SharedQueue();
+    Result* results = reinterpret_cast<Result*>(static_cast<char*>(mapping) + resultsOffset);
+    std::atomic<uint8_t>* states = new (static_cast<char*>(mapping) + statesOffset) std::atomic<uint8_t>[itemCount]();
+    shared->nextItem.store(firstItem);
+    for (int worker = 0; worker < jobs; ++worker) {
+        shared->workerItem[worker].store(kNoItem);
+    }
+
+    fflush(stdout);
+    auto spawn = [&](int worker) -> pid_t {
+        pid_t pid = fork();
+        if (pid == 0) {
+            uint32_t item;
+            while ((item = shared->nextItem.fetch_add(1)) < itemCount) {
+                shared->workerItem[worker].store(item);
+                results[item] = work(item);
+                states[item].store(kItemDone, std::memory_order_release);
+            }
+            shared->workerItem[worker].store(kNoItem);
+            // _exit doesn't flush stdio, and anything left in the buffer would be lost.
+            fflush(stdout);
+            _exit(0);
+        }
+        return pid;
+    };
+    std::vector<pid_t> workers(jobs);
+    int running = 0;
+    for (int worker = 0; worker < jobs; ++worker) {
+        workers[worker] = spawn(worker);
+        if (workers[worker] > 0) {
+            ++running;
+        }
+    }
+
+    std::vector<bool> reported(itemCount);
+    uint32_t firstUnreported = firstItem;
+    auto report_finished = [&](uint32_t end) {
+        for (uint32_t item = firstUnreported; item < end; ++item) {
+            if (reported[item]) {
+                continue;
+            }
+            uint8_t state = states[item].load(std::memory_order_acquire);
+            if (state == kItemPending) {
+                if (ordered) {
+                    break;
+                }
+                continue;
+            }
+            reported[item] = true;
+            finished(item, state == kItemDone ? &results[item] : nullptr);
+        }
+        while (firstUnreported < itemCount && reported[firstUnreported]) {
+            ++firstUnreported;
+        }
+    };
+    while (running > 0) {
+        report_finished(std::min(shared->nextItem.load(), itemCount));
+        int status;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid == 0) {
+            usleep(1000);
+            continue;
+        }
+        if (pid < 0) {
+            break;
+        }
+        int worker = std::find(workers.begin(), workers.end(), pid) - workers.begin();
+        if (worker == jobs) {
+            continue;
+        }
+        --running;
+        uint32_t item = shared->workerItem[worker].exchange(kNoItem);
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            continue;
+        }
+        fprintf(stderr, "Worker %d crashed on item %u\n", worker, item);
+        if (item != kNoItem && states[item].load() == kItemPending) {
+            states[item].store(kItemCrashed, std::memory_order_release);
+        }
+        if (shared->nextItem.load() < itemCount) {
+            workers[worker] = spawn(worker);
+            if (workers[worker] > 0) {
+                ++running;
+            }
+        }
+    }
+
+    // A worker that died between taking an item and publishing it leaves a hole; so does a failed fork.
+    for (uint32_t item = firstUnreported; item < itemCount; ++item) {
+        if (states[item].load() == kItemPending) {
+            states[item].store(kItemCrashed);
+        }
+    }
+    report_finished(itemCount);
+    munmap(mapping, mappingSize);
+    return true;
+}
+
+// The record of a cell with no result, with a flag saying why: kWorkerCrashed or kFontNotLoaded.
+SweepRecord unrun_record(uint32_t cell, uint8_t flags) {
+    SweepCell sweepCell = sweep_cell(cell);
+    SweepRecord record = {};
+    record.cell = cell;
+    record.caseIndex = sweepCell.caseIndex;
+    record.omitOpsz = sweepCell.omitOpsz;
+    record.axisToBump = sweepCell.axisToBump;
+    record.flags = flags;
+    return record;
+}
+
+// Runs the sweep in `jobs` worker processes. emit sees the records in cell order, so the output
+// matches a single-process run.
+template <typename Emit>
+bool run_sharded(int jobs, const std::vector<SweepRecord>& completed, Emit emit) {
+    for (uint32_t cell = 0; cell < completed.size(); ++cell) {
+        emit(completed[cell], true);
+    }
+    // Per worker: each case's font, opened on its first cell, or left null if it didn't load.
+    std::vector<std::unique_ptr<CaseState>> states(gTestCases.size());
+    std::vector<bool> opened(gTestCases.size());
+    return run_forked<SweepRecord>(jobs, completed.size(), cell_count(), true,
+        [&](uint32_t cell) {
+            uint32_t caseIndex = sweep_cell(cell).caseIndex;
+            std::unique_ptr<CaseState>& state = states[caseIndex];
+            if (!opened[caseIndex]) {
+                opened[caseIndex] = true;
+                if (CTFontRef font = make_test_font(gTestCases[caseIndex])) {
+                    state.reset(new CaseState(font));
+                }
+            }
+            return state ? run_cell(*state, cell) : unrun_record(cell, kFontNotLoaded);
+        },
+        [&](uint32_t cell, const SweepRecord* record) {
+            emit(record ? *record : unrun_record(cell, kWorkerCrashed), false);
+        });
+}
+
+// Catalog mode: the sweep over every font file in a directory tree, one font per work item.
+// Fonts are handed out largest first, so a big font doesn't start last and hold up the end of the
+// run, and each font is closed as soon as its sweep is done.
+
+constexpr CGFloat kCatalogSize = 24;
+
+struct CatalogFont {
+    std::string path;
+    uintmax_t size;
+};
+
+std::vector<CatalogFont> scan_catalog(const char* directory) {
+    std::vector<CatalogFont> fonts;
+    std::error_code error;
+    for (auto it = std::filesystem::recursive_directory_iterator(directory, error);
+         it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+        if (error || !it->is_regular_file(error)) {
+            continue;
+        }
+        std::string extension = it->path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if (extension == ".ttf" || extension == ".otf" || extension == ".ttc") {
+            fonts.push_back({ it->path().string(), it->file_size(error) });
+        }
+    }
+    std::sort(fonts.begin(), fonts.end(), [](const CatalogFont& a, const CatalogFont& b) {
+        return a.size != b.size ? a.size > b.size : a.path < b.path;
+    });
+    return fonts;
+}
+
+// What --sidecars did for a variable font in the catalog.
+enum SidecarOutcome : uint8_t { kNoSidecar, kSidecarValid, kSidecarWritten, kSidecarNotWritten };
+
+struct CatalogSummary {
+    uint8_t loaded;     // CoreText made a font from the file
+    uint8_t axisCount;  // 0 for a static font, which isn't swept
+    uint8_t sidecar;    // a SidecarOutcome
+    uint32_t cells;
+    uint32_t variationDiffers;
+    uint32_t fontEqual;
+    uint32_t fontEqualDespiteVariation; // the bug this file is about
+    double seconds;
+};
+
+CatalogSummary sweep_catalog_font(const CatalogFont& catalogFont) {
+    CatalogSummary summary = {};
+    auto begin = std::chrono::steady_clock::now();
+    CTFontRef font = make_ctfont_from_file(catalogFont.path.c_str(), kCatalogSize);
+    if (!font) {
+        return summary;
+    }
+    CaseState state(font);
+    summary.loaded = 1;
+    summary.axisCount = state.originalResolvedVariation.count;
+    if (gSidecarDirectory && summary.axisCount) {
+        const FontVariations& variations = state.variations();
+        summary.sidecar = variations.fromSidecar ? kSidecarValid
+                        : write_sidecar(variations.sidecarKey, variations.sidecarTablesHash, variations.influence, variations.sparseAdvanceStore.regions,
+                                        variations.sharedTuples) ? kSidecarWritten : kSidecarNotWritten;
+    }
+    for (uint32_t cell = 0; summary.axisCount && cell < kCellsPerCase; ++cell) {
+        SweepRecord record = run_cell(state, cell);
+        bool variationEqual = record.flags & kVariationEqual;
+        bool fontEqual = record.flags & kFontEqual;
+        ++summary.cells;
+        summary.variationDiffers += !variationEqual;
+        summary.fontEqual += fontEqual;
+        summary.fontEqualDespiteVariation += !variationEqual && fontEqual;
+    }
+    summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return summary;
+}
+
+int run_catalog(const char* directory, int jobs) {
+    std::vector<CatalogFont> fonts = scan_catalog(directory);
+    printf("Catalog: %s, %zu font files\n", directory, fonts.size());
+
+    uint32_t finishedCount = 0, swept = 0, staticFonts = 0, failed = 0, crashed = 0, affected = 0;
+    uint32_t sidecars[4] = {}; // by SidecarOutcome
+    bool ran = run_forked<CatalogSummary>(jobs, 0, fonts.size(), false,
+        [&](uint32_t item) { return sweep_catalog_font(fonts[item]); },
+        [&](uint32_t item, const CatalogSummary* summary) {
+            const CatalogFont& font = fonts[item];
+            printf("[%u/%zu] %s (%.1f MB): ", ++finishedCount, fonts.size(), font.path.c_str(), font.size / 1e6);
+            if (!summary) {
+                ++crashed;
+                printf("crashed\n");
+            } else if (!summary->loaded) {
+                ++failed;
+                printf("could not load\n");
+            } else if (!summary->axisCount) {
+                ++staticFonts;
+                printf("static\n");
+            } else {
+                ++swept;
+                affected += summary->fontEqualDespiteVariation > 0;
+                ++sidecars[summary->sidecar];
+                const char* sidecarNotes[] = { "", ", sidecar valid", ", sidecar written", ", sidecar not written" };
+                printf("%u axes, %u cells, variation differs in %u, font equal in %u, font equal despite variation in %u, %.2f s%s\n",
+                       summary->axisCount, summary->cells, summary->variationDiffers, summary->fontEqual,
+                       summary->fontEqualDespiteVariation, summary->seconds, sidecarNotes[summary->sidecar]);
+            }
+            fflush(stdout);
+        });
+    if (!ran) {
+        return 1;
+    }
+
+    printf("--------------------------\n");
+    printf("%u variable fonts swept, %u affected; %u static, %u could not load, %u crashed\n",
+           swept, affected, staticFonts, failed, crashed);
+    if (gSidecarDirectory) {
+        printf("Sidecars in %s: %u valid, %u written, %u not written\n", gSidecarDirectory, sidecars[kSidecarValid],
+               sidecars[kSidecarWritten], sidecars[kSidecarNotWritten]);
+    }
+    return 0;
+}
+
+// Hot-table layout: which tables a first use of a font reads, and a copy of the font with those
+// tables at the front, so that opening it from a cold disk cache reads fewer, adjacent pages.
+// --cold-open measures that: each run evicts the file from the page cache, as vmtouch -e does, then
+// opens the font and uses it, counting page faults and the file's pages read in.
+
+constexpr int kFirstUseGlyphs = 256;
+constexpr int kFirstUseOutlines = 16;
+
+// What a first use of a font reads: its axes, the advances and bounds of its first glyphs, a few
+// outlines, and the same again for an instance at the maximum of every axis.
+void run_first_use(CTFontRef font) {
+    AxisValues axes = read_axis_values(font);
+    std::vector<CGGlyph> glyphs(std::min<CFIndex>(CTFontGetGlyphCount(font), kFirstUseGlyphs));
+    for (size_t i = 0; i < glyphs.size(); ++i) {
+        glyphs[i] = i;
+    }
+    std::vector<CGSize> advances(glyphs.size());
+    std::vector<CGRect> bounds(glyphs.size());
+    auto use = [&](CTFontRef font) {
+        CTFontGetAdvancesForGlyphs(font, kCTFontOrientationDefault, glyphs.data(), advances.data(), glyphs.size());
+        CTFontGetBoundingRectsForGlyphs(font, kCTFontOrientationDefault, glyphs.data(), bounds.data(), glyphs.size());
+        for (size_t i = 0; i < std::min<size_t>(glyphs.size(), kFirstUseOutlines); ++i) {
+            CGPathRef path = CTFontCreatePathForGlyph(font, glyphs[i], nullptr);
+            if (path) {
+                CGPathRelease(path);
+            }
+        }
+    };
+    use(font);
+    if (!axes.count) {
+        return;
+    }
+    CFMutableDictionaryRef variation = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+        &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    for (int i = 0; i < axes.count; ++i) {
+        add_axis_value(variation, axes.tags[i], axes.maximums[i]);
+    }
+    CFMutableDictionaryRef attributes = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+        &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    CFDictionaryAddValue(attributes, kCTFontVariationAttribute, variation);
+    CTFontDescriptorRef descriptor = CTFontDescriptorCreateWithAttributes(attributes);
+    CTFontRef instance = CTFontCreateCopyWithAttributes(font, 0, nullptr, descriptor);
+    if (instance) {
+        use(instance);
+        CFRelease(instance);
+    }
+    CFRelease(descriptor);
+    CFRelease(attributes);
+    CFRelease(variation);
+}
+
+// The pages of a font file the first use reads, in the order it first reads them.
+bool trace_first_use(const TestCase& testCase, std::vector<uint32_t>* pages) {
+    PageTrace trace;
+    CTFontRef font = make_ctfont_from_file(testCase.file, testCase.size, &trace);
+    if (!font) {
+        trace.stop();
+        return false;
+    }
+    run_first_use(font);
+    *pages = trace.stop();
+    CFRelease(font);
+    return true;
+}
+
+// The tables on the pages read, in the order their first page was read. A table that shares a
+// page with one that was read counts as read too, as the pages can't tell them apart; that includes
+// the tables on the directory's page.
+std::vector<uint32_t> tables_on_pages(const Reader& file, const std::vector<uint32_t>& pages) {
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    std::vector<uint32_t> tags;
+    for (uint32_t page : pages) {
+        for (TableRecordView record : sfnt_directory(file).tableRecords()) {
+            size_t first = record.offset() / pageSize;
+            size_t last = (record.offset() + std::max<size_t>(record.length(), 1) - 1) / pageSize;
+            if (page >= first && page <= last && std::find(tags.begin(), tags.end(), record.tableTag()) == tags.end()) {
+                tags.push_back(record.tableTag());
+            }
+        }
+    }
+    return tags;
+}
+
+// The font with the hot tables first, in the order given, then the rest by tag.
+bool write_hot_layout(const Reader& file, const std::vector<uint32_t>& hotTables, const char* outputPath) {
+    FontSerializer serializer;
+    serializer.order = hotTables;
+    serializer.sfntVersion = sfnt_directory(file).sfntVersion();
+    for (TableRecordView record : sfnt_directory(file).tableRecords()) {
+        Reader table = file.at(record.offset(), record.length());
+        serializer.add(record.tableTag(), std::vector<uint8_t>(table.data, table.data + table.length));
+    }
+    serializer.finish();
+    return serializer.write_file(outputPath);
+}
+
+// Drops a file's pages from the page cache, as vmtouch -e does on macOS.
+bool evict_file(const char* path) {
+    MappedFile file(path);
+    return file.ok() && !msync(file.mapping, file.length, MS_INVALIDATE);
+}
+
+// How many of a file's pages are in the page cache.
+size_t resident_pages(const char* path) {
+    MappedFile file(path);
+    if (!file.ok()) {
+        return 0;
+    }
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    std::vector<char> residency((file.length + pageSize - 1) / pageSize);
+    if (mincore(file.mapping, file.length, residency.data())) {
+        return 0;
+    }
+    return std::count_if(residency.begin(), residency.end(), [](char page) { return page & 1; });
+}
+
+struct ColdOpen {
+    double openMs = 0;
+    double firstUseMs = 0;
+    long majorFaults = 0;
+    long minorFaults = 0;
+    size_t pagesRead = 0; // resident afterwards, so including the kernel's read-ahead
+};
+
+bool cold_open(const TestCase& testCase, ColdOpen* result) {
+    if (!evict_file(testCase.file)) {
+        printf("Could not evict: %s\n", testCase.file);
+        return false;
+    }
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    auto begin = std::chrono::steady_clock::now();
+    CTFontRef font = make_ctfont_from_file(testCase.file, testCase.size);
+    if (!font) {
+        return false;
+    }
+    auto opened = std::chrono::steady_clock::now();
+    run_first_use(font);
+    auto used = std::chrono::steady_clock::now();
+    getrusage(RUSAGE_SELF, &after);
+    result->openMs = std::chrono::duration<double, std::milli>(opened - begin).count();
+    result->firstUseMs = std::chrono::duration<double, std::milli>(used - opened).count();
+    result->majorFaults = after.ru_majflt - before.ru_majflt;
+    result->minorFaults = after.ru_minflt - before.ru_minflt;
+    result->pagesRead = resident_pages(testCase.file);
+    CFRelease(font);
+    return true;
+}
+
+// Medians over runs, each field on its own. The fonts take turns, so drift in the system's state
+// affects them alike.
+bool run_cold_opens(const std::vector<TestCase>& testCases, int runs) {
+    std::vector<std::vector<ColdOpen>> results(testCases.size());
+    for (int run = 0; run < runs; ++run) {
+        for (size_t i = 0; i < testCases.size(); ++i) {
+            ColdOpen result;
+            if (!cold_open(testCases[i], &result)) {
+                return false;
+            }
+            results[i].push_back(result);
+        }
+    }
+    auto median = [](std::vector<ColdOpen>& results, auto field) {
+        std::sort(results.begin(), results.end(), [&](const ColdOpen& a, const ColdOpen& b) { return a.*field < b.*field; });
+        return results[results.size() / 2].*field;
+    };
+    printf("%-40s %9s %12s %12s %12s %10s\n", "font", "open ms", "first use ms", "major faults", "minor faults", "pages read");
+    for (size_t i = 0; i < testCases.size(); ++i) {
+        printf("%-40s %9.2f %12.2f %12ld %12ld %10zu\n", testCases[i].name, median(results[i], &ColdOpen::openMs),
+               median(results[i], &ColdOpen::firstUseMs), median(results[i], &ColdOpen::majorFaults),
+               median(results[i], &ColdOpen::minorFaults), median(results[i], &ColdOpen::pagesRead));
+    }
+    return true;
+}
+
+std::vector<TestCase> file_test_cases() {
+    std::vector<TestCase> testCases;
+    std::copy_if(gTestCases.begin(), gTestCases.end(), std::back_inserter(testCases),
+                 [](const TestCase& testCase) { return testCase.file; });
+    return testCases;
+}
+
+int run_cold_open_report(int runs) {
+    std::vector<TestCase> testCases = file_test_cases();
+    printf("Cold opens, median of %d runs\n", runs);
+    return run_cold_opens(testCases, runs) ? 0 : 1;
+}
+
+int run_hot_layout(const char* outputPath, int runs) {
+    std::vector<TestCase> testCases = file_test_cases();
+    if (testCases.empty()) {
+        printf("--hot-layout needs a font file (--font)\n");
+        return 1;
+    }
+    TestCase original = testCases[0];
+    MappedFile file(original.file);
+    if (!file.ok()) {
+        printf("Could not open: %s\n", original.file);
+        return 1;
+    }
+    if (TtcHeaderView(file.reader()).ttcTag() == sfnt_tag('t', 't', 'c', 'f')) {
+        printf("%s is a collection, which --hot-layout doesn't rewrite\n", original.file);
+        return 1;
+    }
+    std::vector<uint32_t> pages;
+    if (!trace_first_use(original, &pages)) {
+        return 1;
+    }
+    std::vector<uint32_t> hotTables = tables_on_pages(file.reader(), pages);
+    size_t pageCount = (file.length + sysconf(_SC_PAGESIZE) - 1) / sysconf(_SC_PAGESIZE);
+    printf("%s: the first use reads %zu of %zu pages, in %zu of %zu tables:", original.file, pages.size(), pageCount,
+           hotTables.size(), size_t(sfnt_directory(file.reader()).numTables()));
+    for (uint32_t tag : hotTables) {
+        printf(" %s", tag_to_string(tag).c_str());
+    }
+    printf("\n");
+
+    if (!write_hot_layout(file.reader(), hotTables, outputPath)) {
+        printf("Could not write: %s\n", outputPath);
+        return 1;
+    }
+    TestCase rewritten = { outputPath, original.size, outputPath };
+    std::vector<uint32_t> rewrittenPages;
+    if (!trace_first_use(rewritten, &rewrittenPages)) {
+        return 1;
+    }
+    printf("%s: the first use reads %zu pages\n", outputPath, rewrittenPages.size());
+
+    printf("Cold opens, median of %d runs\n", runs);
+    return run_cold_opens({ original, rewritten }, runs) ? 0 : 1;
+}
+
+struct Options {
+    const char* resultsPath = nullptr;
+    bool resume = false;
+    int jobs = 1;
+    uint64_t checkCount = 0;
+    uint64_t seed = 1;
+    const char* diffPaths[2] = {};
+    std::vector<TestCase> fonts;
+    bool bench = false;
+    bool replay = false;
+    bool affected = false;
+    size_t sketchWidth = 0;
+    size_t cacheBytes = 0;
+    std::vector<int> benchThreads = { 1 };
+    double benchSeconds = 0.5;
+    bool boundaries = false;
+    bool classes = false;
+    const char* catalogPath = nullptr;
+    double tolerance = 1e-6;
+    const char* hotLayoutPath = nullptr;
+    bool coldOpen = false;
+    int runs = 5;
+};
+
+bool parse_options(int argc, char** argv, Options* options) {
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            options->resultsPath = argv[++i];
+        } else if (!strcmp(argv[i], "--resume")) {
+            options->resume = true;
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            options->jobs = std::clamp(atoi(argv[++i]), 1, kMaxJobs);
+        } else if (!strcmp(argv[i], "--check") && i + 1 < argc) {
+            options->checkCount = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            options->seed = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--copy-with-attributes")) {
+            gCopyWithAttributes = true;
+        } else if (!strcmp(argv[i], "--font") && i + 1 < argc) {
+            // file.ttf or file.ttf@size
+            char* file = argv[++i];
+            char* at = strrchr(file, '@');
+            CGFloat size = 24;
+            if (at) {
+                *at = 0;
+                size = atof(at + 1);
+            }
+            options->fonts.push_back({ file, size, file });
+        } else if (!strcmp(argv[i], "--sidecars") && i + 1 < argc) {
+            gSidecarDirectory = argv[++i];
+        } else if (!strcmp(argv[i], "--trust-sidecars")) {
+            gTrustSidecars = true;
+        } else if (!strcmp(argv[i], "--catalog") && i + 1 < argc) {
+            options->catalogPath = argv[++i];
+        } else if (!strcmp(argv[i], "--classes")) {
+            options->classes = true;
+        } else if (!strcmp(argv[i], "--boundaries")) {
+            options->boundaries = true;
+        } else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc) {
+            options->tolerance = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--bench")) {
+            options->bench = true;
+        } else if (!strcmp(argv[i], "--affected")) {
+            options->affected = true;
+        } else if (!strcmp(argv[i], "--delta-budget") && i + 1 < argc) {
+            gDeltaExpansionBudget = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--replay")) {
+            options->replay = true;
+        } else if (!strcmp(argv[i], "--sketch-width") && i + 1 < argc) {
+            options->sketchWidth = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--cache-bytes") && i + 1 < argc) {
+            options->cacheBytes = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            // A comma separated list, e.g. 1,2,4,8.
+            options->benchThreads.clear();
+            for (char* count = strtok(argv[++i], ","); count; count = strtok(nullptr, ",")) {
+                options->benchThreads.push_back(std::clamp(atoi(count), 1, 256));
+            }
+        } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            options->benchSeconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--hot-layout") && i + 1 < argc) {
+            options->hotLayoutPath = argv[++i];
+        } else if (!strcmp(argv[i], "--cold-open")) {
+            options->coldOpen = true;
+        } else if (!strcmp(argv[i], "--runs") && i + 1 < argc) {
+            options->runs = std::max(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "--diff") && i + 2 < argc) {
+            options->diffPaths[0] = argv[++i];
+            options->diffPaths[1] = argv[++i];
+        } else {
+            printf("Usage: %s [--font file.ttf[@size] ...] [--copy-with-attributes] [-j jobs] [-o results.bin [--resume]]\n", argv[0]);
+            printf("       %s [--font file.ttf[@size] ...] [--copy-with-attributes] --check count [--seed seed]\n", argv[0]);
+            printf("       %s [--font file.ttf[@size] ...] --bench [--threads 1,2,4] [--seconds s] [--delta-budget bytes]\n", argv[0]);
+            printf("       %s [--font file.ttf[@size] ...] --replay [--sketch-width n] [--cache-bytes n] [--seed seed]\n", argv[0]);
+            printf("       %s [--font file.ttf[@size] ...] [--copy-with-attributes] --classes\n", argv[0]);
+            printf("       %s [--font file.ttf[@size] ...] --affected [--delta-budget bytes] [--sidecars directory [--trust-sidecars]]\n", argv[0]);
+            printf("       %s [--font file.ttf[@size] ...] --boundaries [--tolerance t]\n", argv[0]);
+            printf("       %s [--font file.ttf[@size] ...] --cold-open [--runs n]\n", argv[0]);
+            printf("       %s [--font file.ttf[@size]] --hot-layout out.ttf [--runs n]\n", argv[0]);
+            printf("       %s [--copy-with-attributes] [-j jobs] [--sidecars directory [--trust-sidecars]] --catalog directory\n", argv[0]);
+            printf("       %s --diff a.bin b.bin\n", argv[0]);
+            return false;
+        }
+    }
+    if (options->resume && !options->resultsPath) {
+        printf("--resume needs a results file (-o)\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+      return 1;
+  }
+  if (!options.fonts.empty()) {
+      gTestCases = options.fonts;
+  }
+  if (options.diffPaths[0]) {
+      return diff_results(options.diffPaths[0], options.diffPaths[1]);
+  }
+  if (options.hotLayoutPath) {
+      return run_hot_layout(options.hotLayoutPath, options.runs);
+  }
+  if (options.coldOpen) {
+      return run_cold_open_report(options.runs);
+  }
+  if (options.catalogPath) {
+      return run_catalog(options.catalogPath, options.jobs);
+  }
+  if (options.classes) {
+      return run_equivalence_classes();
+  }
+  if (options.boundaries) {
+      return run_boundary_search(options.tolerance);
+  }
+  if (options.affected) {
+      return run_affected_report();
+  }
+  if (options.replay) {
+      return run_replay(options.seed, options.sketchWidth, options.cacheBytes);
+  }
+  if (options.bench) {
+      return run_benchmarks(options.benchThreads, options.benchSeconds);
+  }
+  if (options.checkCount) {
+      return run_checks(options.checkCount, options.seed);
+  }
+
+  FILE* results = nullptr;
+  std::vector<SweepRecord> completed;
+  if (options.resultsPath) {
+      results = options.resume ? open_checkpoint(options.resultsPath, &completed)
+                               : fopen(options.resultsPath, "wb");
+      if (!results) {
+          printf("Could not open: %s\n", options.resultsPath);
+          return 1;
+      }
+  }
+
+  auto emit = [&](const SweepRecord& record, bool resumed) {
+      if (record.cell % kCellsPerCase == 0) {
+          print_case_header(gTestCases[record.caseIndex].name, record);
+      }
+      print_record(record);
+      if (results && !resumed) {
+          fwrite(&record, sizeof(record), 1, results);
+          if ((record.cell + 1) % kCheckpointInterval == 0) {
+              checkpoint(results);
+          }
+      }
+  };
+
+  if (options.jobs > 1) {
+      if (!run_sharded(options.jobs, completed, emit)) {
+          return 1;
+      }
+  } else {
+      for (uint32_t caseIndex = 0; caseIndex < gTestCases.size(); ++caseIndex) {
+          // The font is opened before the case's first cell is printed, even when every cell was
+          // resumed, so that anything opening it prints, such as a font that won't open, lands
+          // in the same place as in an uninterrupted run.
+          std::unique_ptr<CaseState> state;
+          if (CTFontRef font = make_test_font(gTestCases[caseIndex])) {
+              state.reset(new CaseState(font));
+          }
+          for (uint32_t cell = caseIndex * kCellsPerCase; cell < (caseIndex + 1) * kCellsPerCase; ++cell) {
+              // Cells from a resumed run are printed from their records, so the output matches an
+              // uninterrupted run.
+              if (cell < completed.size()) {
+                  emit(completed[cell], true);
+                  continue;
+              }
+              // Cells of a font that can't be opened still get records, so a results file always
+              // has one per cell, in order.
+              emit(state ? run_cell(*state, cell) : unrun_record(cell, kFontNotLoaded), false);
+          }
+      }
+  }
+
+  if (results) {
+      checkpoint(results);
+      fclose(results);
   }
 }